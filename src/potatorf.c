@@ -1,18 +1,28 @@
 /*
  * potatorf.c — Lightweight file-based database manager in C
  *
- * Commands: CREATE TABLE, INSERT INTO, SELECT, UPDATE, DELETE FROM,
- *           DROP TABLE, SHOW TABLES, DESCRIBE, VACUUM
+ * Commands: CREATE TABLE, INSERT INTO, SELECT [... JOIN | GROUP BY], UPDATE,
+ *           DELETE FROM, DROP TABLE, SHOW TABLES, DESCRIBE, VACUUM,
+ *           BEGIN, COMMIT, ROLLBACK, EXPLAIN [ANALYZE], ANALYZE,
+ *           SET [GLOBAL] DURABILITY, SHOW DURABILITY, BGSAVE, BACKUP TO,
+ *           SHOW REPLICATION, CREATE / DROP MATERIALIZED VIEW,
+ *           CREATE / DROP INDEX
  *
- * Build:  gcc -Wall -O2 -o potatorf potatorf.c
+ * Build:  gcc -Wall -O2 -pthread -o potatorf potatorf.c
  * Usage:  ./potatorf <db.dbm>            — interactive REPL
+ *         ./potatorf <db.dbm> --serve unix:/path/sock | [host:]port ...
+ *         ./potatorf <db.dbm> --restore full.dbm delta.dbm ...
+ *         ./potatorf <replica.dbm> --follow primary.dbm [--serve ...]
  */
 
+#define _GNU_SOURCE   /* strcasestr */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <ctype.h>
+#include <stdarg.h>
 #include <time.h>
 
 /* strcasestr / strncasecmp are GNU/POSIX extensions not available on Windows.
@@ -28,30 +38,241 @@ static char *my_strcasestr(const char *hay, const char *needle) {
     return NULL;
 }
 #  define strcasestr my_strcasestr
+#  define strtok_r    strtok_s
+#endif
+
+/* Scans are split across worker threads where pthreads exist; elsewhere
+   they simply run on the calling thread. */
+#if !defined(_WIN32)
+#  include <pthread.h>
+#  include <sched.h>
+#  include <unistd.h>
+#  include <sys/wait.h>
+#  include <sys/stat.h>
+#  define HAVE_THREADS 1
+#endif
+
+/* Readers run without locks against values writers publish: row counts,
+   array pointers, version stamps. Single-threaded builds use plain access. */
+#if defined(HAVE_THREADS)&&defined(__GNUC__)
+#  define ald(p)      __atomic_load_n(p,__ATOMIC_ACQUIRE)
+#  define ast(p,v)    __atomic_store_n(p,v,__ATOMIC_RELEASE)
+#  define acas(p,e,v) __atomic_compare_exchange_n(p,e,v,0,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST)
+#  define aadd(p,v)   __atomic_add_fetch(p,v,__ATOMIC_SEQ_CST)
+#  define afence()    __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#  define ald(p)      (*(p))
+#  define ast(p,v)    (*(p)=(v))
+#  define acas(p,e,v) (*(p)==*(e)?(*(p)=(v),1):0)
+#  define aadd(p,v)   (*(p)+=(v))
+#  define afence()    ((void)0)
+#endif
+#ifdef HAVE_THREADS
+typedef pthread_mutex_t  Mutex;
+typedef pthread_rwlock_t RWLock;
+#  define mtx_init(m)   pthread_mutex_init(m,NULL)
+#  define mtx_free(m)   pthread_mutex_destroy(m)
+#  define mtx_lock(m)   pthread_mutex_lock(m)
+#  define mtx_unlock(m) pthread_mutex_unlock(m)
+/* Readers arrive continuously; DDL must not wait for a gap between them. */
+#  if defined(__GLIBC__)
+static void rw_init(RWLock *l){
+    pthread_rwlockattr_t a; pthread_rwlockattr_init(&a);
+    pthread_rwlockattr_setkind_np(&a,PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(l,&a); pthread_rwlockattr_destroy(&a);
+}
+#  else
+#    define rw_init(l)  pthread_rwlock_init(l,NULL)
+#  endif
+#  define rw_free(l)    pthread_rwlock_destroy(l)
+#  define rw_rdlock(l)  pthread_rwlock_rdlock(l)
+#  define rw_wrlock(l)  pthread_rwlock_wrlock(l)
+#  define rw_unlock(l)  pthread_rwlock_unlock(l)
+#  define cpu_yield()   sched_yield()
+#else
+typedef int Mutex, RWLock;
+#  define mtx_init(m)   ((void)(m))
+#  define mtx_free(m)   ((void)(m))
+#  define mtx_lock(m)   ((void)(m))
+#  define mtx_unlock(m) ((void)(m))
+#  define rw_init(l)    ((void)(l))
+#  define rw_free(l)    ((void)(l))
+#  define rw_rdlock(l)  ((void)(l))
+#  define rw_wrlock(l)  ((void)(l))
+#  define rw_unlock(l)  ((void)(l))
+#  define cpu_yield()   ((void)0)
+#endif
+
+/* Server mode is built on epoll, so it exists on Linux only. */
+#if defined(__linux__)&&defined(HAVE_THREADS)
+#  include <signal.h>
+#  include <netdb.h>
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  define HAVE_SERVER 1
+#endif
+
+/* Durable replace of the database file: fsync + rename on POSIX,
+   write-through MoveFileEx on Windows. Checkpoints are written with
+   positioned writes, emulated by seek + write on Windows. */
+#include <errno.h>
+#include <fcntl.h>
+#if defined(_WIN32)
+#  include <io.h>
+#  include <windows.h>
+#  define fsync_fd(fd) _commit(fd)
+#  define replace_file(from,to) (MoveFileExA(from,to,MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH)?0:-1)
+static long pwrite_w(int fd,const void *p,size_t n,uint64_t off){
+    return _lseeki64(fd,(__int64)off,SEEK_SET)<0?-1:_write(fd,p,(unsigned)n);
+}
+#  define pwrite(fd,p,n,off) pwrite_w(fd,p,n,off)
+#  define fseeko _fseeki64
+#  define ftello _ftelli64
+#else
+#  define fsync_fd(fd) fsync(fd)
+#  define replace_file(from,to) rename(from,to)
+#endif
+#ifndef O_BINARY
+#  define O_BINARY 0
+#endif
+
+/* On Linux checkpoints go through io_uring when the kernel headers have it
+   (build with -DPOTATORF_NO_IO_URING to leave it out); a kernel that
+   refuses a ring gets the pwrite path at run time. */
+#if defined(__linux__)&&defined(HAVE_THREADS)&&!defined(POTATORF_NO_IO_URING)&&defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <sys/uio.h>
+#    if defined(__NR_io_uring_setup)&&defined(IORING_FEAT_RW_CUR_POS)   /* 5.6: IORING_OP_WRITE */
+#      define HAVE_IO_URING 1
+#    endif
+#  endif
+#endif
+
+/* CRC32C uses the SSE4.2 / ARMv8 CRC instructions when the CPU has them. */
+#if (defined(__x86_64__)||defined(__i386__))&&defined(__GNUC__)
+#  include <nmmintrin.h>
+#  define HAVE_CRC32C_HW 1
+#elif defined(__aarch64__)&&defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#  define HAVE_CRC32C_HW 1
 #endif
 
 /* ── Constants ─────────────────────────────────────────────── */
-#define MAX_TABLES   64
+#define MAX_TABLES   256             /* partitions included */
 #define MAX_COLUMNS  32
 #define MAX_NAME_LEN 64
 #define MAX_STR_LEN  256
-#define MAX_SQL_LEN  4096
+#define MAX_SQL_LEN  65536           /* also bounds a single TEXT/BLOB literal */
 #define DB_MAGIC     0x444D4742u
+#define DB_VERSION   10              /* 2: zone maps, 3: dictionaries, 4: compressed blocks,
+                                        5: checksummed header, table meta block, end marker,
+                                        6: ANALYZE statistics, 7: varint TEXT/BLOB lengths,
+                                        8: range partitions, 9: materialized views, 10: indexes */
+#define DB_END_MAGIC 0x444E4542u
+#define DLT_MAGIC    0x544C4442u     /* BACKUP ... INCREMENTAL delta file */
+#define ZONE_ROWS    4096            /* rows per zone-map block (power of two) */
+#define MAX_CONDS    8               /* AND-ed WHERE conditions */
+#define MAX_SNAPS    64              /* concurrently open read snapshots */
+#define MAX_AGGS     16
+#define MAX_PARTS    64              /* range partitions per table */
+#define MAX_INDEXES  8               /* indexes per table */
+#define IX_TAIL      1024            /* unsorted index entries before a merge (plus 1/16 of the sorted ones) */
+#define IX_SCAN_SEL  0.2             /* estimated share of rows in the key range above which a full scan wins */
+#define MAX_WORKERS  16
+#define PAR_MIN_ROWS 16384           /* rows per worker before a scan is split */
+#define GB_MEM_BUDGET (64u<<20)      /* group state bytes held before spilling */
+#define GB_PARTS     16              /* spill partitions */
+#define HIST_BUCKETS 16              /* equi-depth histogram buckets per column */
+#define STAT_SAMPLE  30000           /* rows ANALYZE sorts for histograms */
+#define HLL_BITS     10              /* 2^HLL_BITS HyperLogLog registers */
+#define PLAN_CACHE   64              /* cached statement plans */
+#define MAX_PARAMS   64              /* literals lifted out of a cached statement */
+#define CELL_INLINE  11              /* TEXT/BLOB bytes kept in the row itself */
+#define OVF_PAGE     4096            /* overflow page, header included */
+#define IO_CHUNK     (1u<<20)        /* bytes per checkpoint write */
+#define IO_BUFS      4               /* checkpoint writes in flight */
+#define GROUP_MS     5               /* default GROUP commit window */
+#define ASYNC_MS     1000            /* default ASYNC checkpoint delay */
+#define FOLLOW_MS    10              /* how often a follower looks for a new image */
 
 /* ── Types ──────────────────────────────────────────────────── */
-typedef enum { T_INT=1, T_FLOAT=2, T_TEXT=3, T_BOOL=4 } CType;
+typedef enum { T_INT=1, T_FLOAT=2, T_TEXT=3, T_BOOL=4, T_BLOB=5 } CType;
 
+/* A value outside the row store: literals, zone bounds, statistics, group
+   keys. TEXT here is cut to MAX_STR_LEN-1 bytes. */
 typedef union { int64_t i; double f; char s[MAX_STR_LEN]; int8_t b; } Val;
 
-typedef struct { char name[MAX_NAME_LEN]; CType type; int8_t nullable, pk; } Col;
+/* Long TEXT/BLOB values live in a chain of pages of up to OVF_PAGE bytes,
+   each NUL-terminated so the head doubles as a C-string prefix. refs (head
+   only) counts the row versions sharing the chain: UPDATE copies a row
+   without copying its unchanged values. */
+typedef struct Ovf { struct Ovf *next; int32_t refs; uint32_t n; char d[]; } Ovf;
+#define OVF_DATA ((uint32_t)(OVF_PAGE-sizeof(Ovf)-1))
+/* A column of a stored row. Numbers and DICT codes are held in place;
+   TEXT and BLOB of up to CELL_INLINE bytes inline and NUL-terminated,
+   longer ones as their length and overflow chain (n tells which). */
+typedef union {
+    int64_t i; double f; int8_t b;
+    struct { uint32_t n; char s[CELL_INLINE+1]; } in;
+    struct { uint32_t n; Ovf *pg; } ov;
+} Cell;
+
+typedef struct { char name[MAX_NAME_LEN]; CType type; int8_t nullable, pk, dict; } Col;
+
+/* A row version is visible to snapshot s when xmin <= s < xmax (xmax 0 =
+   current). Once published a version only ever changes by gaining an xmax;
+   UPDATE appends a new version instead of writing in place. (A view's
+   group row its own statement created is the exception; see mv_group.) */
+typedef struct { Cell data[MAX_COLUMNS]; int8_t null[MAX_COLUMNS]; uint64_t xmin,xmax; } Row;
+typedef struct { Val data[MAX_COLUMNS]; int8_t null[MAX_COLUMNS], del; } RowV3;   /* files v1-3 */
+
+/* Memory a writer replaced while readers may still hold it; freed once
+   every snapshot that could have seen it has ended. */
+typedef struct Ret { struct Ret *next; void *p; uint64_t tag; } Ret;
 
-typedef struct { Val data[MAX_COLUMNS]; int8_t null[MAX_COLUMNS], del; } Row;
+/* Per-block column stats. Only ever widened between rebuilds, so they may
+   over-approximate a block but never exclude a row that is in it. open:
+   some TEXT value was longer than a Val, so mx (its prefix) bounds nothing.
+   lsn is the commit timestamp of the block's last change, UINT64_MAX while
+   one is uncommitted; it is not saved (see do_backup). */
+typedef struct { Val mn, mx; int32_t nnull; int8_t has, open; } ZCol;
+typedef struct { ZCol c[MAX_COLUMNS]; uint64_t lsn; } Zone;
+
+/* Dictionary for a TEXT column declared DICT: each distinct string is kept
+   once and rows hold its code in Cell.i. ix is an open-addressing index of
+   code+1 keyed on the exact bytes, so codes preserve the original case. */
+typedef struct { int n,cap; uint32_t icap,*ix; char **s; } Dict;
+
+/* ANALYZE statistics of one column: NULL fraction, a HyperLogLog estimate
+   of distinct values, and equi-depth histogram bounds (nb buckets, nb+1
+   bounds) over the non-NULL values of a sample, DICT columns by string. */
+typedef struct { double nullfrac, ndv; int nb; Val b[HIST_BUCKETS+1]; } CStat;
+typedef struct { int64_t rows, sampled; CStat c[MAX_COLUMNS]; } TStat;
+
+/* PARTITION BY RANGE (key): the table holds no rows itself. Partition i
+   is the hidden table "<table>#<pn[i]>" with the rows whose key is below
+   hi[i] (any key, for max[i]) and not below hi[i-1]; the bounds ascend. */
+typedef struct { int key, n; char pn[MAX_PARTS][MAX_NAME_LEN]; Val hi[MAX_PARTS]; int8_t max[MAX_PARTS]; } Part;
 
 typedef struct {
     char  name[MAX_NAME_LEN];
-    int   ncols, nrows, cap, next_id;
+    int   ncols, nrows, cap, next_id, zcap;
     Col   cols[MAX_COLUMNS];
     Row  *rows;
+    Zone *zones;    /* one per ZONE_ROWS rows */
+    Dict  dict[MAX_COLUMNS];
+    Ret  *ret;      /* retired rows/zones/dictionary arrays */
+    TStat *stats;   /* NULL until ANALYZE; replaced whole, old one retired */
+    uint64_t relsn; /* when CREATE or VACUUM last laid the rows out */
+    Part *part;     /* NULL unless partitioned */
+    char *mvsql;    /* a materialized view's SELECT, else NULL */
+    struct MView *mv;   /* ... compiled (see Materialized views) */
+    int   nix; struct Index *ix[MAX_INDEXES];   /* see Indexes */
 } Table;
 
 typedef struct {
@@ -60,7 +281,93 @@ typedef struct {
     char     name[MAX_NAME_LEN], created[32];
 } DBHdr;
 
-typedef struct { DBHdr hdr; Table tbl[MAX_TABLES]; char file[512]; } DB;
+/* An incremental backup holds what changed since the backup whose file
+   checksum is base: db, its CRC32C, then per table the meta block, a block
+   of one flag per row block, the flagged row blocks and the dictionary
+   block, all as in a checkpoint; then DB_END_MAGIC. */
+typedef struct { uint32_t magic, version, base, pad; DBHdr db; } DltHdr;
+
+/* Checkpoint writer state kept from one checkpoint to the next: the chunk
+   buffers and, with io_uring, the ring they are registered with (see
+   wr_open). state: 0 not set up yet, 1 io_uring, -1 pwrite. */
+typedef struct {
+    int      state;
+    uint8_t *buf[IO_BUFS];
+#ifdef HAVE_IO_URING
+    int      rfd, fixed;
+    unsigned *sqh,*sqt,*sqmask,*sqarr,*cqh,*cqt,*cqmask;
+    struct io_uring_sqe *sqes; struct io_uring_cqe *cqes;
+    void    *sqm,*cqm; size_t sqsz,cqsz,sqesz;
+#endif
+} Io;
+
+/* Plan cache entry: key is the statement with its literals lifted out. */
+typedef struct { uint64_t h, used; char *key; struct Plan *plan; } PEnt;
+
+/* Writing statements (and save_db) are serialised by wlock. Each runs as
+   part of a transaction whose versions carry its id (TX_BIT|n) until
+   COMMIT restamps them with wts = clock+1 and publishes clock=wts.
+   Readers take no lock: they register clock as their snapshot in snaps[]
+   and see exactly the transactions committed before it. DDL and VACUUM
+   take ddl exclusively; every other statement holds it shared. ntx counts
+   open BEGIN blocks, whose logs DROP and VACUUM would invalidate. pc is
+   the plan cache, guarded by pcl and emptied by CREATE and DROP. io
+   belongs to whoever is running save_db. dseq counts committed changes,
+   sseq those on disk and ckat those a checkpoint has been tried for; they
+   and the checkpointer, BGSAVE, last BACKUP and follower state are
+   guarded by ckl (after wlock). follow is set on a read-only follower. */
+typedef struct {
+    DBHdr    hdr; Table tbl[MAX_TABLES]; char file[512];
+    uint64_t clock, wts, snaps[MAX_SNAPS], txseq;
+    int      ntx;
+    Mutex    wlock; RWLock ddl;
+    PEnt     pc[PLAN_CACHE]; uint64_t pctick; Mutex pcl;
+    Io       io;
+    int      dur, group_ms, async_ms;   /* database durability (see db_durable) */
+    uint64_t dseq, sseq, ckat;
+    uint64_t bksnap; uint32_t bkcrc;   /* last BACKUP: snapshot, file checksum */
+    Mutex    ckl;
+    char     follow[512];       /* the primary's file on a follower, else "" */
+#ifdef HAVE_THREADS
+    pthread_cond_t ckc, ckdone; pthread_t ckth;
+    int      ckrun, ckstop, ckwait;
+    struct timespec dirty_at;   /* when sseq last fell behind dseq */
+    pid_t    bgpid; pthread_t bgth; uint64_t bgupto;
+    int      bgst;              /* BGSAVE: 0 none yet, 1 running, 2 done, 3 failed */
+    pthread_t fth; int frun, fstop;
+    struct stat fid, fbad;      /* follower: image applied last, last one that did not load */
+    uint64_t fn; double flag;   /* images applied; age of the last one when applied (s) */
+#endif
+} DB;
+
+/* Transaction ids sort above every commit timestamp, so by the plain
+   snapshot rule nobody else sees a transaction's versions before COMMIT. */
+#define TX_BIT (1ull<<63)
+#define SNAP_LATEST (TX_BIT-1)   /* a snapshot that sees every commit */
+/* Transaction log entry: version j of table ti was created (ins) or had
+   its xmax set. COMMIT replays it forward to stamp the commit timestamp,
+   ROLLBACK backwards to undo. */
+typedef struct { int16_t ti; int8_t ins; int32_t j; } TxLog;
+/* Per-client state. Outside BEGIN..COMMIT db_exec runs every writing
+   statement as a transaction of its own. dur: SET DURABILITY, 0 for the
+   database's level. */
+enum { DUR_SYNC=1, DUR_GROUP, DUR_ASYNC };
+typedef struct {
+    uint64_t tx, snap; int slot, open, dur;
+    TxLog *log; int nlog, cap;
+} Sess;
+
+/* EXPLAIN [ANALYZE] profile of one statement. Handlers note per stage what
+   they will do; plain EXPLAIN (plan) stops them before any row is touched.
+   Under ANALYZE they switch cur as work moves between stages, so a stage's
+   time is the wall time spent while it was current. */
+enum { ST_PARSE, ST_SCAN, ST_FILTER, ST_JOIN, ST_AGGREGATE, ST_WRITE, ST_MATERIALIZE, ST_COMMIT, ST_PRINT, ST_N };
+typedef struct {
+    int     plan, cur;
+    double  t0, t[ST_N];
+    int64_t in[ST_N], out[ST_N], bytes[ST_N], allocs[ST_N];
+    char    note[ST_N][256];
+} Prof;
 
 /* Dynamic result set */
 typedef struct {
@@ -69,6 +376,14 @@ typedef struct {
     char  cname[MAX_COLUMNS][MAX_NAME_LEN];
     CType ctype[MAX_COLUMNS];
     char **cells;   /* flat: row*ncols+col */
+    /* typed: also keep each cell's value (vals/vnull, same layout as cells)
+       for clients that want binary results rather than text. Cells set
+       with res_cell are staged in sv/sn until res_addrow, as are values
+       too long for its row buffer, in big. */
+    int8_t typed, staged, sn[MAX_COLUMNS];
+    Val   *vals; int8_t *vnull; Val sv[MAX_COLUMNS];
+    char  *big[MAX_COLUMNS];
+    Prof  *prof;    /* set by EXPLAIN on the statement it runs */
 } Res;
 
 /* ── Result helpers ─────────────────────────────────────────── */
@@ -77,28 +392,62 @@ static void res_ok(Res *r, const char *m, int n)
 static void res_err(Res *r, const char *m)
     { r->ok=0; snprintf(r->msg,sizeof(r->msg),"%s",m); }
 
+static void str2val(const char *s,CType t,Val *v);
+static void val2str(Val *v,CType t,char *o,size_t n);
 static void res_addrow(Res *r, char v[][MAX_STR_LEN], int nc){
     if(r->nrows>=r->cap){
         int nc2=r->cap?r->cap*2:64;
         r->cells=(char**)realloc(r->cells,sizeof(char*)*nc2*nc);
         memset(r->cells+r->cap*nc,0,sizeof(char*)*(nc2-r->cap)*nc);
+        if(r->typed){
+            Val *nv=(Val*)realloc(r->vals,sizeof(Val)*nc2*nc); if(nv) r->vals=nv;
+            int8_t *nn=(int8_t*)realloc(r->vnull,(size_t)nc2*nc); if(nn) r->vnull=nn;
+            if(!nv||!nn){ free(r->vals); free(r->vnull); r->vals=NULL; r->vnull=NULL; r->typed=0; }
+        }
         r->cap=nc2;
+        if(r->prof) r->prof->allocs[ST_MATERIALIZE]+=r->typed?3:1;
     }
     for(int j=0;j<nc;j++){
         char **c=&r->cells[r->nrows*nc+j];
-        free(*c); *c=strdup(v[j]);
+        free(*c);
+        if(r->big[j]){ *c=r->big[j]; r->big[j]=NULL; } else *c=strdup(v[j]);
+    }
+    if(r->typed){
+        /* rows built without res_cell (SHOW, DESCRIBE) never hold NULLs */
+        if(!r->staged) for(int j=0;j<nc;j++){ r->sn[j]=0; str2val(v[j],r->ctype[j],&r->sv[j]); }
+        memcpy(&r->vals[r->nrows*nc],r->sv,sizeof(Val)*nc);
+        memcpy(&r->vnull[r->nrows*nc],r->sn,(size_t)nc);
+    }
+    r->staged=0; r->nrows++;
+    if(r->prof){
+        Prof *p=r->prof; p->in[ST_MATERIALIZE]++; p->out[ST_MATERIALIZE]++; p->allocs[ST_MATERIALIZE]+=nc;
+        for(int j=0;j<nc;j++){
+            const char *c=r->cells[(r->nrows-1)*nc+j];
+            p->bytes[ST_MATERIALIZE]+=(int64_t)(c?strlen(c):0)+1+(r->typed?(int64_t)sizeof(Val)+1:0);
+        }
     }
-    r->nrows++;
+}
+/* Renders cell k of the row being built (v NULL for SQL NULL). */
+static void res_cell(Res *r,char rv[][MAX_STR_LEN],int k,const Val *v,CType t){
+    if(!v) strcpy(rv[k],"NULL"); else val2str((Val*)v,t,rv[k],MAX_STR_LEN);
+    if(r->typed){ r->sn[k]=!v; if(v) r->sv[k]=*v; r->staged=1; }
 }
 static const char *res_get(Res *r,int row,int col){
     if(!r->cells) return "";
     char *v=r->cells[row*r->ncols+col]; return v?v:"";
 }
+/* Drops the cells of a previous result so r can be handed to db_exec again. */
+static void res_reset(Res *r){
+    if(r->cells){for(int i=0;i<r->cap*r->ncols;i++) free(r->cells[i]);free(r->cells);}
+    free(r->vals); free(r->vnull);
+    memset(r,0,sizeof(*r));
+}
 static void res_free(Res *r){
     if(r&&r->cells){
         for(int i=0;i<r->cap*r->ncols;i++) free(r->cells[i]);
         free(r->cells);
     }
+    if(r){ free(r->vals); free(r->vnull); }
     free(r);
 }
 
@@ -110,462 +459,4566 @@ static void strtrim(char *s){
 }
 static int strswci(const char *s,const char *p){ return strncasecmp(s,p,strlen(p))==0; }
 
+static double mono_now(void){
+    struct timespec ts;
+#if defined(_WIN32)
+    timespec_get(&ts,TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+#endif
+    return (double)ts.tv_sec+ts.tv_nsec*1e-9;
+}
+static void sleep_sec(double s){
+#if defined(_WIN32)
+    Sleep((DWORD)(s*1000));
+#else
+    struct timespec ts={(time_t)s,(long)((s-(double)(time_t)s)*1e9)};
+    while(nanosleep(&ts,&ts)&&errno==EINTR) {}
+#endif
+}
+/* Charges the time since the last switch to the current stage. */
+static void prof_enter(Prof *p,int st){ double n=mono_now(); p->t[p->cur]+=n-p->t0; p->t0=n; p->cur=st; }
+#define PROF(r,st) do{ if((r)->prof) prof_enter((r)->prof,(st)); }while(0)
+/* Appends to a stage's note, "; "-separated. */
+static void prof_note(Prof *p,int st,const char *fmt,...){
+    char *d=p->note[st]; size_t l=strlen(d);
+    if(l&&l<sizeof(p->note[st])-2){ memcpy(d+l,"; ",3); l+=2; }
+    va_list ap; va_start(ap,fmt); vsnprintf(d+l,sizeof(p->note[st])-l,fmt,ap); va_end(ap);
+}
+
 static const char *tname(CType t){
     switch(t){case T_INT:return"INT";case T_FLOAT:return"FLOAT";
-              case T_TEXT:return"TEXT";case T_BOOL:return"BOOL";default:return"?";}
+              case T_TEXT:return"TEXT";case T_BOOL:return"BOOL";case T_BLOB:return"BLOB";default:return"?";}
 }
 static CType tparse(const char *s){
     if(!strcasecmp(s,"INT")||!strcasecmp(s,"INTEGER"))return T_INT;
     if(!strcasecmp(s,"FLOAT")||!strcasecmp(s,"DOUBLE")||!strcasecmp(s,"REAL"))return T_FLOAT;
     if(!strcasecmp(s,"TEXT")||!strcasecmp(s,"VARCHAR")||!strcasecmp(s,"STRING"))return T_TEXT;
     if(!strcasecmp(s,"BOOL")||!strcasecmp(s,"BOOLEAN"))return T_BOOL;
+    if(!strcasecmp(s,"BLOB")||!strcasecmp(s,"BYTEA"))return T_BLOB;
     return 0;
 }
 static void val2str(Val *v,CType t,char *o,size_t n){
     switch(t){case T_INT:snprintf(o,n,"%lld",(long long)v->i);break;
               case T_FLOAT:snprintf(o,n,"%.6g",v->f);break;
-              case T_TEXT:snprintf(o,n,"%s",v->s);break;
+              case T_TEXT:case T_BLOB:snprintf(o,n,"%s",v->s);break;
               case T_BOOL:snprintf(o,n,"%s",v->b?"true":"false");break;
               default:snprintf(o,n,"NULL");}
 }
 static void str2val(const char *s,CType t,Val *v){
     switch(t){case T_INT:v->i=strtoll(s,NULL,10);break;
               case T_FLOAT:v->f=strtod(s,NULL);break;
-              case T_TEXT:strncpy(v->s,s,MAX_STR_LEN-1);v->s[MAX_STR_LEN-1]=0;break;
+              case T_TEXT:case T_BLOB:snprintf(v->s,MAX_STR_LEN,"%s",s);break;
               case T_BOOL:v->b=(!strcasecmp(s,"true")||!strcmp(s,"1"))?1:0;break;
               default:break;}
 }
-
-/* ── DB I/O ─────────────────────────────────────────────────── */
-static Table *find_tbl(DB *db,const char *n){
-    for(int i=0;i<db->hdr.ntables;i++)
-        if(!strcasecmp(db->tbl[i].name,n)) return &db->tbl[i];
-    return NULL;
+static int val_cmp(const Val *a,const Val *b,CType t){
+    switch(t){case T_INT:return(a->i>b->i)-(a->i<b->i);
+              case T_FLOAT:return(a->f>b->f)-(a->f<b->f);
+              case T_TEXT:return strcasecmp(a->s,b->s);
+              case T_BOOL:return a->b-b->b;
+              case T_BLOB:return strcmp(a->s,b->s);
+              default:return 0;}
 }
-static int save_db(DB *db){
-    FILE *f=fopen(db->file,"wb"); if(!f) return -1;
-    fwrite(&db->hdr,sizeof(DBHdr),1,f);
-    for(int i=0;i<db->hdr.ntables;i++){
-        Table *t=&db->tbl[i];
-        fwrite(t->name,MAX_NAME_LEN,1,f);
-        fwrite(&t->ncols,sizeof(int),1,f);
-        fwrite(t->cols,sizeof(Col)*t->ncols,1,f);
-        fwrite(&t->nrows,sizeof(int),1,f);
-        fwrite(&t->next_id,sizeof(int),1,f);
-        for(int j=0;j<t->nrows;j++) fwrite(&t->rows[j],sizeof(Row),1,f);
-    }
-    fclose(f); return 0;
+/* Hash agreeing with val_cmp()==0: TEXT folds case, -0.0 hashes as 0.0. */
+static uint64_t hmix(uint64_t h){
+    h^=h>>33; h*=0xff51afd7ed558ccdULL; h^=h>>33; h*=0xc4ceb9fe1a85ec53ULL; h^=h>>33; return h;
 }
-static int load_db(DB *db){
-    FILE *f=fopen(db->file,"rb"); if(!f) return -1;
-    if(fread(&db->hdr,sizeof(DBHdr),1,f)!=1){fclose(f);return -1;}
-    if(db->hdr.magic!=DB_MAGIC){fclose(f);return -2;}
-    for(int i=0;i<db->hdr.ntables;i++){
-        Table *t=&db->tbl[i];
-        if(!fread(t->name,MAX_NAME_LEN,1,f)) break;
-        if(!fread(&t->ncols,sizeof(int),1,f)) break;
-        if(!fread(t->cols,sizeof(Col)*t->ncols,1,f)) break;
-        if(!fread(&t->nrows,sizeof(int),1,f)) break;
-        if(!fread(&t->next_id,sizeof(int),1,f)) break;
-        t->cap=t->nrows>0?t->nrows*2:16;
-        t->rows=(Row*)malloc(sizeof(Row)*t->cap);
-        if(!t->rows){fclose(f);return -3;}
-        for(int j=0;j<t->nrows;j++)
-            if(!fread(&t->rows[j],sizeof(Row),1,f)) break;
-    }
-    fclose(f); return 0;
+static uint64_t val_hash(const Val *v,CType t,uint64_t h){
+    switch(t){case T_INT:return hmix(h^(uint64_t)v->i);
+              case T_FLOAT:{double d=v->f==0?0.0:v->f;uint64_t u;memcpy(&u,&d,8);return hmix(h^u);}
+              case T_TEXT:for(const char *c=v->s;*c;c++) h=(h^(uint64_t)tolower((unsigned char)*c))*0x100000001b3ULL;
+                          return hmix(h);
+              case T_BOOL:return hmix(h^(uint64_t)(v->b!=0));
+              case T_BLOB:for(const char *c=v->s;*c;c++) h=(h^(uint64_t)(unsigned char)*c)*0x100000001b3ULL;
+                          return hmix(h);
+              default:return h;}
 }
-static DB *open_db(const char *fn){
-    DB *db=(DB*)calloc(1,sizeof(DB)); if(!db) return NULL;
-    strncpy(db->file,fn,sizeof(db->file)-1);
-    if(load_db(db)==0) return db;
-    db->hdr.magic=DB_MAGIC; db->hdr.version=1;
-    const char *b=strrchr(fn,'/'); b=b?b+1:fn;
-    strncpy(db->hdr.name,b,MAX_NAME_LEN-1);
-    char *d=strrchr(db->hdr.name,'.'); if(d)*d=0;
-    time_t now=time(NULL); struct tm *tm=localtime(&now);
-    strftime(db->hdr.created,32,"%Y-%m-%d %H:%M:%S",tm);
-    return db;
+
+/* ── Parallel scan ──────────────────────────────────────────── */
+static int nworkers(int nrows){
+    int n=nrows/PAR_MIN_ROWS;
+#ifdef HAVE_THREADS
+    long c=sysconf(_SC_NPROCESSORS_ONLN); if(c>0&&n>c) n=(int)c;
+#else
+    n=1;
+#endif
+    if(n>MAX_WORKERS) n=MAX_WORKERS;
+    return n<1?1:n;
 }
-static void close_db(DB *db){
-    if(!db) return;
-    save_db(db);
-    for(int i=0;i<db->hdr.ntables;i++) free(db->tbl[i].rows);
-    free(db);
+/* Runs fn over n argument blocks of size sz; block 0 runs on the caller. */
+static void par_run(int n,void *(*fn)(void*),void *args,size_t sz){
+#ifdef HAVE_THREADS
+    pthread_t th[MAX_WORKERS]; int ok[MAX_WORKERS]={0};
+    for(int i=1;i<n;i++) ok[i]=pthread_create(&th[i],NULL,fn,(char*)args+i*sz)==0;
+    fn(args);
+    for(int i=1;i<n;i++){ if(ok[i]) pthread_join(th[i],NULL); else fn((char*)args+i*sz); }
+#else
+    for(int i=0;i<n;i++) fn((char*)args+i*sz);
+#endif
 }
 
-/* ── WHERE ──────────────────────────────────────────────────── */
-typedef struct { char col[MAX_NAME_LEN],op[4],val[MAX_STR_LEN]; int isnull,nullexp; } Cond;
+/* ── Checkpoint I/O ─────────────────────────────────────────── */
+/* A checkpoint is streamed into IO_BUFS chunk buffers of IO_CHUNK bytes;
+   each full chunk is handed to the kernel and encoding carries on in the
+   next one while it is written. With io_uring the buffers are registered
+   once, so the kernel does not map them again for every write, and the
+   last write is linked to the fsync that ends the file: both go out in a
+   single submission. Otherwise chunks are written with pwrite as they
+   fill and the file fsynced at the end. */
+typedef struct {
+    Io      *io;
+    int      fd, err, cur, busy[IO_BUFS], inflight, resync;
+    size_t   n, len[IO_BUFS];   /* bytes in the current chunk; per-chunk write size */
+    uint64_t off, boff[IO_BUFS];
+    double   rate, t0;          /* bytes/s cap (0: none) and when writing began */
+    int      sum; uint32_t crc; /* sum set: crc accumulates the file's CRC32C */
+} Fw;
 
-static int parse_cond(const char *w,Cond *c){
-    char tmp[MAX_SQL_LEN]; strncpy(tmp,w,sizeof(tmp)-1); strtrim(tmp);
-    char *p;
-    if((p=strcasestr(tmp," IS NOT NULL"))){*p=0;strtrim(tmp);strncpy(c->col,tmp,MAX_NAME_LEN-1);c->isnull=1;c->nullexp=0;return 1;}
-    if((p=strcasestr(tmp," IS NULL"))){*p=0;strtrim(tmp);strncpy(c->col,tmp,MAX_NAME_LEN-1);c->isnull=1;c->nullexp=1;return 1;}
-    c->isnull=0;
-    const char *ops[]={"<=",">=","!=","<>","=","<",">",NULL};
-    for(int i=0;ops[i];i++){
-        if((p=strstr(tmp,ops[i]))){
-            *p=0; strncpy(c->col,tmp,MAX_NAME_LEN-1); strtrim(c->col);
-            strncpy(c->op,strcmp(ops[i],"<>")?"!=":ops[i],3); /* use != for <> */
-            strncpy(c->op,ops[i],3); if(!strcmp(c->op,"<>")) strcpy(c->op,"!=");
-            char *v=p+strlen(ops[i]); strtrim(v);
-            if(*v=='\''||*v=='"'){v++;char *e=v+strlen(v)-1;if(*e=='\''||*e=='"')*e=0;}
-            strncpy(c->val,v,MAX_STR_LEN-1); return 1;
-        }
+static int pwrite_all(int fd,const uint8_t *p,size_t n,uint64_t off){
+    while(n){
+        long k=(long)pwrite(fd,p,n,off);
+        if(k<0&&errno==EINTR) continue;
+        if(k<=0) return -1;
+        p+=k; n-=(size_t)k; off+=(uint64_t)k;
     }
     return 0;
 }
-static int eval_cond(Row *row,Table *t,Cond *c){
-    int ci=-1;
-    for(int i=0;i<t->ncols;i++) if(!strcasecmp(t->cols[i].name,c->col)){ci=i;break;}
-    if(ci<0) return 0;
-    if(c->isnull) return c->nullexp?row->null[ci]:!row->null[ci];
-    if(row->null[ci]) return 0;
-    Val *v=&row->data[ci]; CType tp=t->cols[ci].type;
-    Val cv; str2val(c->val,tp,&cv);
-    int cmp=0;
-    if(tp==T_INT)  cmp=(v->i>cv.i)-(v->i<cv.i);
-    else if(tp==T_FLOAT) cmp=(v->f>cv.f)-(v->f<cv.f);
-    else if(tp==T_TEXT)  cmp=strcasecmp(v->s,cv.s);
-    else if(tp==T_BOOL)  cmp=v->b-cv.b;
-    if(!strcmp(c->op,"="))  return cmp==0;
-    if(!strcmp(c->op,"!=")) return cmp!=0;
-    if(!strcmp(c->op,"<"))  return cmp<0;
-    if(!strcmp(c->op,">"))  return cmp>0;
-    if(!strcmp(c->op,"<=")) return cmp<=0;
-    if(!strcmp(c->op,">=")) return cmp>=0;
-    return 0;
-}
 
-/* ── Commands ───────────────────────────────────────────────── */
-static void do_create(DB *db,char *sql,Res *r){
-    if(db->hdr.ntables>=MAX_TABLES){res_err(r,"Max tables reached");return;}
-    char *p=sql+12; while(isspace((unsigned char)*p))p++;
-    char tn[MAX_NAME_LEN]={0}; int i=0;
-    while(*p&&!isspace((unsigned char)*p)&&*p!='('&&i<MAX_NAME_LEN-1) tn[i++]=*p++;
-    while(isspace((unsigned char)*p))p++;
-    if(*p!='('){res_err(r,"Expected '('");return;}
-    if(find_tbl(db,tn)){char m[128];snprintf(m,128,"Table '%s' exists",tn);res_err(r,m);return;}
-    p++; char *end=strrchr(p,')'); if(!end){res_err(r,"Missing ')'");return;} *end=0;
-    Table *t=&db->tbl[db->hdr.ntables];
-    memset(t,0,sizeof(Table));
-    strncpy(t->name,tn,MAX_NAME_LEN-1);
-    t->cap=16; t->rows=(Row*)malloc(sizeof(Row)*t->cap);
-    if(!t->rows){res_err(r,"OOM");return;}
-    char buf[MAX_SQL_LEN]; strncpy(buf,p,sizeof(buf)-1);
-    char *cd=strtok(buf,",");
-    while(cd&&t->ncols<MAX_COLUMNS){
-        strtrim(cd); if(!*cd){cd=strtok(NULL,",");continue;}
-        int ispk=strcasestr(cd,"PRIMARY KEY")?1:0;
-        char cn[MAX_NAME_LEN]={0},cs[32]={0};
-        sscanf(cd,"%63s %31s",cn,cs);
-        CType ct=tparse(cs);
-        if(!ct){char m[128];snprintf(m,128,"Unknown type '%s'",cs);res_err(r,m);free(t->rows);return;}
-        Col *col=&t->cols[t->ncols];
-        strncpy(col->name,cn,MAX_NAME_LEN-1); col->type=ct; col->pk=ispk;
-        col->nullable=strcasestr(cd,"NOT NULL")?0:1; t->ncols++;
-        cd=strtok(NULL,",");
-    }
-    if(!t->ncols){res_err(r,"No columns defined");free(t->rows);return;}
-    db->hdr.ntables++;
-    save_db(db);
-    char m[128];snprintf(m,128,"Table '%s' created (%d cols)",tn,t->ncols);res_ok(r,m,0);
+#ifdef HAVE_IO_URING
+static void ring_free(Io *io){
+    if(io->sqes&&io->sqes!=MAP_FAILED) munmap(io->sqes,io->sqesz);
+    if(io->cqm&&io->cqm!=MAP_FAILED&&io->cqm!=io->sqm) munmap(io->cqm,io->cqsz);
+    if(io->sqm&&io->sqm!=MAP_FAILED) munmap(io->sqm,io->sqsz);
+    close(io->rfd);
+    io->sqes=NULL; io->sqm=io->cqm=NULL; io->state=-1;
 }
-
-static void do_drop(DB *db,char *sql,Res *r){
-    char *p=sql+10; strtrim(p);
-    Table *t=find_tbl(db,p);
-    if(!t){char m[128];snprintf(m,128,"Table '%s' not found",p);res_err(r,m);return;}
-    int idx=(int)(t-db->tbl);
-    free(t->rows);
-    for(int i=idx;i<db->hdr.ntables-1;i++) db->tbl[i]=db->tbl[i+1];
-    db->hdr.ntables--;
-    save_db(db);
-    char m[128];snprintf(m,128,"Table '%s' dropped",p);res_ok(r,m,0);
+static int ring_init(Io *io){
+    struct io_uring_params p; memset(&p,0,sizeof(p));
+    if((io->rfd=(int)syscall(__NR_io_uring_setup,IO_BUFS*2,&p))<0) return -1;
+    int one=(p.features&IORING_FEAT_SINGLE_MMAP)!=0;
+    io->sqsz=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+    io->cqsz=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    if(one) io->sqsz=io->cqsz=io->sqsz>io->cqsz?io->sqsz:io->cqsz;
+    io->sqesz=p.sq_entries*sizeof(struct io_uring_sqe);
+    io->sqm=mmap(NULL,io->sqsz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,io->rfd,IORING_OFF_SQ_RING);
+    io->cqm=one?io->sqm:mmap(NULL,io->cqsz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,io->rfd,IORING_OFF_CQ_RING);
+    io->sqes=(struct io_uring_sqe*)mmap(NULL,io->sqesz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,io->rfd,IORING_OFF_SQES);
+    if(io->sqm==MAP_FAILED||io->cqm==MAP_FAILED||io->sqes==MAP_FAILED){ ring_free(io); return -1; }
+    uint8_t *s=(uint8_t*)io->sqm,*c=(uint8_t*)io->cqm;
+    io->sqh=(unsigned*)(s+p.sq_off.head); io->sqt=(unsigned*)(s+p.sq_off.tail);
+    io->sqmask=(unsigned*)(s+p.sq_off.ring_mask); io->sqarr=(unsigned*)(s+p.sq_off.array);
+    io->cqh=(unsigned*)(c+p.cq_off.head); io->cqt=(unsigned*)(c+p.cq_off.tail);
+    io->cqmask=(unsigned*)(c+p.cq_off.ring_mask); io->cqes=(struct io_uring_cqe*)(c+p.cq_off.cqes);
+    /* Registration counts against RLIMIT_MEMLOCK; past it, plain writes. */
+    struct iovec iv[IO_BUFS];
+    for(int i=0;i<IO_BUFS;i++){ iv[i].iov_base=io->buf[i]; iv[i].iov_len=IO_CHUNK; }
+    io->fixed=syscall(__NR_io_uring_register,io->rfd,IORING_REGISTER_BUFFERS,iv,IO_BUFS)==0;
+    return 0;
 }
-
-static void do_insert(DB *db,char *sql,Res *r){
-    char *p=sql+11; while(isspace((unsigned char)*p))p++;
-    char tn[MAX_NAME_LEN]={0}; int i=0;
-    while(*p&&!isspace((unsigned char)*p)&&*p!='('&&i<MAX_NAME_LEN-1) tn[i++]=*p++;
-    while(isspace((unsigned char)*p))p++;
-    Table *t=find_tbl(db,tn);
-    if(!t){char m[128];snprintf(m,128,"Table '%s' not found",tn);res_err(r,m);return;}
-    int ord[MAX_COLUMNS],ns=0;
-    if(*p=='('){
-        p++; char *e=strchr(p,')'); if(!e){res_err(r,"Missing ')'");return;} *e=0;
-        char buf[MAX_SQL_LEN]; strncpy(buf,p,sizeof(buf)-1);
-        char *cn=strtok(buf,",");
-        while(cn&&ns<MAX_COLUMNS){
-            strtrim(cn); int f=-1;
-            for(int j=0;j<t->ncols;j++) if(!strcasecmp(t->cols[j].name,cn)){f=j;break;}
-            if(f<0){char m[128];snprintf(m,128,"Column '%s' not found",cn);res_err(r,m);return;}
-            ord[ns++]=f; cn=strtok(NULL,",");
-        }
-        p=e+1; while(isspace((unsigned char)*p))p++;
-    } else { for(int j=0;j<t->ncols;j++) ord[j]=j; ns=t->ncols; }
-    char *vs=strcasestr(p,"VALUES"); if(!vs){res_err(r,"Missing VALUES");return;}
-    vs+=6; while(isspace((unsigned char)*vs))vs++;
-    if(*vs!='('){res_err(r,"Expected '('");return;} vs++;
-    char *ve=strrchr(vs,')'); if(!ve){res_err(r,"Missing ')'");return;} *ve=0;
-    if(t->nrows>=t->cap){
-        t->cap*=2; t->rows=(Row*)realloc(t->rows,sizeof(Row)*t->cap);
-        if(!t->rows){res_err(r,"OOM");return;}
+/* Submission slot k past the ones already queued, cleared. */
+static struct io_uring_sqe *ring_sqe(Io *io,unsigned k){
+    unsigned i=(*io->sqt+k)&*io->sqmask;
+    struct io_uring_sqe *e=&io->sqes[i]; memset(e,0,sizeof(*e));
+    io->sqarr[i]=i; return e;
+}
+/* Publishes n prepared slots and submits everything the kernel has not
+   consumed yet, waiting for at least wait completions. */
+static int ring_enter(Io *io,unsigned n,unsigned wait){
+    __atomic_store_n(io->sqt,*io->sqt+n,__ATOMIC_RELEASE);
+    for(;;){
+        unsigned q=*io->sqt-__atomic_load_n(io->sqh,__ATOMIC_ACQUIRE);
+        if(syscall(__NR_io_uring_enter,io->rfd,q,wait,wait?IORING_ENTER_GETEVENTS:0,NULL,0)>=0) return 0;
+        if(errno!=EINTR&&errno!=EAGAIN&&errno!=EBUSY) return -1;
     }
-    Row *row=&t->rows[t->nrows];
-    memset(row,0,sizeof(Row));
-    for(int j=0;j<t->ncols;j++) row->null[j]=1;
-    int vi=0; char *vp=vs;
-    while(*vp&&vi<ns){
-        while(isspace((unsigned char)*vp))vp++;
-        char vb[MAX_STR_LEN]={0}; int bi=0;
-        if(*vp=='\''||*vp=='"'){
-            char q=*vp++;
-            while(*vp&&*vp!=q&&bi<MAX_STR_LEN-1) vb[bi++]=*vp++;
-            if(*vp==q) vp++;
-        } else {
-            while(*vp&&*vp!=','&&bi<MAX_STR_LEN-1) vb[bi++]=*vp++;
-            strtrim(vb);
+}
+/* Takes one completion, waiting for it if there is none; returns its
+   user_data and stores the result in *res, or -1 if the ring failed. */
+static int ring_reap(Io *io,int *res){
+    for(;;){
+        unsigned h=*io->cqh;
+        if(h!=__atomic_load_n(io->cqt,__ATOMIC_ACQUIRE)){
+            struct io_uring_cqe *c=&io->cqes[h&*io->cqmask];
+            int u=(int)c->user_data; *res=c->res;
+            __atomic_store_n(io->cqh,h+1,__ATOMIC_RELEASE);
+            return u;
         }
-        while(*vp==','||isspace((unsigned char)*vp)) vp++;
-        int ci=ord[vi];
-        if(!strcasecmp(vb,"NULL")) row->null[ci]=1;
-        else{row->null[ci]=0;str2val(vb,t->cols[ci].type,&row->data[ci]);}
-        vi++;
+        if(ring_enter(io,0,1)) return -1;
+    }
+}
+/* Collects one finished write (user_data: buffer index) or the closing
+   fsync (IO_BUFS). A short write is finished with pwrite, which the
+   ring's fsync then no longer covers. A failing ring is torn down and
+   err=2 asks save_db to write the checkpoint again without it. */
+static void fw_reap(Fw *w){
+    int res,u=ring_reap(w->io,&res);
+    if(u<0){ ring_free(w->io); w->err=2; w->inflight=0; memset(w->busy,0,sizeof(w->busy)); return; }
+    w->inflight--;
+    if(u==IO_BUFS){ if(res==-ECANCELED) w->resync=1; else if(res<0&&!w->err) w->err=1; return; }
+    w->busy[u]=0;
+    if(res<0){ if(!w->err) w->err=1; }
+    else if((size_t)res<w->len[u]){
+        w->resync=1;
+        if(pwrite_all(w->fd,w->io->buf[u]+res,w->len[u]-(size_t)res,w->boff[u]+(uint64_t)res)&&!w->err) w->err=1;
     }
-    t->nrows++; t->next_id++;
-    save_db(db);
-    res_ok(r,"1 row inserted",1);
 }
+#endif
 
-static void do_select(DB *db,char *sql,Res *r){
-    char *p=sql+6; while(isspace((unsigned char)*p))p++;
-    char *from=strcasestr(p,"FROM"); if(!from){res_err(r,"Missing FROM");return;}
-    char cl[MAX_SQL_LEN]={0}; strncpy(cl,p,(size_t)(from-p)); strtrim(cl);
-    p=from+4; while(isspace((unsigned char)*p))p++;
-    char tn[MAX_NAME_LEN]={0}; int i=0;
-    while(*p&&!isspace((unsigned char)*p)&&i<MAX_NAME_LEN-1) tn[i++]=*p++;
-    while(isspace((unsigned char)*p))p++;
-    Table *t=find_tbl(db,tn);
-    if(!t){char m[128];snprintf(m,128,"Table '%s' not found",tn);res_err(r,m);return;}
-    Cond c; int hc=0;
-    char *wh=strcasestr(p,"WHERE");
-    if(wh){wh+=5;strtrim(wh);hc=parse_cond(wh,&c);}
-    int oc[MAX_COLUMNS],no=0;
-    if(!strcmp(cl,"*")){for(int j=0;j<t->ncols;j++) oc[no++]=j;}
-    else{
-        char buf[MAX_SQL_LEN]; strncpy(buf,cl,sizeof(buf)-1);
-        char *cn=strtok(buf,",");
-        while(cn&&no<MAX_COLUMNS){
-            strtrim(cn); int f=-1;
-            for(int j=0;j<t->ncols;j++) if(!strcasecmp(t->cols[j].name,cn)){f=j;break;}
-            if(f<0){char m[128];snprintf(m,128,"Column '%s' not found",cn);res_err(r,m);return;}
-            oc[no++]=f; cn=strtok(NULL,",");
-        }
+/* Sets up the writer state on first use and creates path. */
+static int fw_open(Io *io,Fw *w,const char *path){
+    memset(w,0,sizeof(*w)); w->io=io; w->fd=-1; w->t0=mono_now();
+    for(int i=0;i<IO_BUFS;i++)
+        if(!io->buf[i]&&!(io->buf[i]=(uint8_t*)malloc(IO_CHUNK))) return -1;
+    if(!io->state){
+        io->state=-1;
+#ifdef HAVE_IO_URING
+        if(!ring_init(io)) io->state=1;
+#endif
     }
-    r->ok=1; r->ncols=no;
-    for(int j=0;j<no;j++){strncpy(r->cname[j],t->cols[oc[j]].name,MAX_NAME_LEN-1);r->ctype[j]=t->cols[oc[j]].type;}
-    char rv[MAX_COLUMNS][MAX_STR_LEN];
-    for(int j=0;j<t->nrows;j++){
-        Row *row=&t->rows[j]; if(row->del) continue;
-        if(hc&&!eval_cond(row,t,&c)) continue;
-        for(int k=0;k<no;k++){
-            int ci=oc[k];
-            if(row->null[ci]) strcpy(rv[k],"NULL");
-            else val2str(&row->data[ci],t->cols[ci].type,rv[k],MAX_STR_LEN);
+    w->fd=open(path,O_WRONLY|O_CREAT|O_TRUNC|O_BINARY,0644);
+    return w->fd<0?-1:0;
+}
+/* Hands the current chunk to the kernel; last also queues the fsync. */
+static void fw_submit(Fw *w,int last){
+    Io *io=w->io; int b=w->cur; size_t n=w->n;
+    if(w->rate>0){   /* throttled: no chunk leaves before its byte budget allows */
+        double due=w->t0+(double)(w->off+n)/w->rate-mono_now();
+        if(due>0) sleep_sec(due);
+    }
+    w->boff[b]=w->off; w->len[b]=n; w->off+=n; w->n=0;
+#ifdef HAVE_IO_URING
+    if(io->state==1){
+        unsigned k=0;
+        if(n){
+            struct io_uring_sqe *e=ring_sqe(io,k++);
+            e->opcode=io->fixed?IORING_OP_WRITE_FIXED:IORING_OP_WRITE;
+            e->fd=w->fd; e->addr=(uint64_t)(uintptr_t)io->buf[b]; e->len=(uint32_t)n;
+            e->off=w->boff[b]; e->buf_index=(uint16_t)b; e->user_data=(uint64_t)b;
+            if(last) e->flags=IOSQE_IO_LINK;
+            w->busy[b]=1;
         }
-        res_addrow(r,rv,no);
+        if(last){   /* drained: runs once every earlier chunk is written */
+            struct io_uring_sqe *e=ring_sqe(io,k++);
+            e->opcode=IORING_OP_FSYNC; e->fd=w->fd; e->flags=IOSQE_IO_DRAIN; e->user_data=IO_BUFS;
+        }
+        w->inflight+=(int)k;
+        if(k&&ring_enter(io,k,0)){ ring_free(io); w->err=2; w->inflight=0; memset(w->busy,0,sizeof(w->busy)); }
+        return;
     }
-    char m[64];snprintf(m,64,"%d row(s) returned",r->nrows);
-    strncpy(r->msg,m,sizeof(r->msg)-1); r->affected=r->nrows;
+#endif
+    if(n&&pwrite_all(w->fd,io->buf[b],n,w->boff[b])) w->err=1;
+    if(last&&!w->err&&fsync_fd(w->fd)) w->err=1;
 }
-
-static void do_update(DB *db,char *sql,Res *r){
-    char *p=sql+6; while(isspace((unsigned char)*p))p++;
-    char tn[MAX_NAME_LEN]={0}; int i=0;
-    while(*p&&!isspace((unsigned char)*p)&&i<MAX_NAME_LEN-1) tn[i++]=*p++;
-    while(isspace((unsigned char)*p))p++;
-    Table *t=find_tbl(db,tn);
-    if(!t){char m[128];snprintf(m,128,"Table '%s' not found",tn);res_err(r,m);return;}
-    if(!strswci(p,"SET")){res_err(r,"Expected SET");return;}
-    p+=3; while(isspace((unsigned char)*p))p++;
-    char *wkw=strcasestr(p,"WHERE");
-    Cond c; int hc=0;
-    char sc[MAX_SQL_LEN]={0};
-    if(wkw){strncpy(sc,p,(size_t)(wkw-p));strtrim(sc);char *wh=wkw+5;strtrim(wh);hc=parse_cond(wh,&c);}
-    else{strncpy(sc,p,sizeof(sc)-1);strtrim(sc);}
-    char scols[MAX_COLUMNS][MAX_NAME_LEN], svals[MAX_COLUMNS][MAX_STR_LEN]; int ns=0;
-    char *a=strtok(sc,",");
-    while(a&&ns<MAX_COLUMNS){
-        strtrim(a);
-        char *eq=strchr(a,'='); if(!eq){res_err(r,"Bad SET");return;}
-        *eq=0; strncpy(scols[ns],a,MAX_NAME_LEN-1); strtrim(scols[ns]);
-        char *sv=eq+1; strtrim(sv);
-        if(*sv=='\''||*sv=='"'){sv++;char *e=sv+strlen(sv)-1;if(*e=='\''||*e=='"')*e=0;}
-        strncpy(svals[ns],sv,MAX_STR_LEN-1); ns++;
-        a=strtok(NULL,",");
-    }
-    int upd=0;
-    for(int j=0;j<t->nrows;j++){
-        Row *row=&t->rows[j]; if(row->del) continue;
-        if(hc&&!eval_cond(row,t,&c)) continue;
-        for(int k=0;k<ns;k++){
-            int ci=-1;
-            for(int m=0;m<t->ncols;m++) if(!strcasecmp(t->cols[m].name,scols[k])){ci=m;break;}
-            if(ci<0) continue;
-            if(!strcasecmp(svals[k],"NULL")) row->null[ci]=1;
-            else{row->null[ci]=0;str2val(svals[k],t->cols[ci].type,&row->data[ci]);}
-        }
-        upd++;
+static uint32_t crc32c(uint32_t crc,const void *data,size_t n);
+static void fw_put(Fw *w,const void *d,size_t n){
+    const uint8_t *p=(const uint8_t*)d;
+    if(w->sum) w->crc=crc32c(w->crc,p,n);
+    while(n&&!w->err){
+        size_t k=IO_CHUNK-w->n; if(k>n) k=n;
+        memcpy(w->io->buf[w->cur]+w->n,p,k); w->n+=k; p+=k; n-=k;
+        if(w->n<IO_CHUNK) continue;
+        fw_submit(w,0); w->cur=(w->cur+1)%IO_BUFS;
+#ifdef HAVE_IO_URING
+        while(w->busy[w->cur]) fw_reap(w);
+#endif
     }
-    save_db(db);
-    char m[64];snprintf(m,64,"%d row(s) updated",upd);res_ok(r,m,upd);
+}
+/* Writes the rest, waits for every write and makes the file durable.
+   Returns 0, -1 on failure, -2 if the ring failed under it. */
+static int fw_close(Fw *w){
+    if(!w->err) fw_submit(w,1);
+#ifdef HAVE_IO_URING
+    while(w->inflight) fw_reap(w);
+    if(w->resync&&!w->err&&fsync_fd(w->fd)) w->err=1;
+#endif
+    if(w->fd>=0&&close(w->fd)&&!w->err) w->err=1;
+    return w->err==2?-2:w->err?-1:0;
+}
+static void io_free(Io *io){
+#ifdef HAVE_IO_URING
+    if(io->state==1) ring_free(io);
+#endif
+    for(int i=0;i<IO_BUFS;i++) free(io->buf[i]);
+    memset(io,0,sizeof(*io));
 }
 
-static void do_delete(DB *db,char *sql,Res *r){
-    char *p=sql+11; while(isspace((unsigned char)*p))p++;
-    char tn[MAX_NAME_LEN]={0}; int i=0;
-    while(*p&&!isspace((unsigned char)*p)&&i<MAX_NAME_LEN-1) tn[i++]=*p++;
-    while(isspace((unsigned char)*p))p++;
-    Table *t=find_tbl(db,tn);
-    if(!t){char m[128];snprintf(m,128,"Table '%s' not found",tn);res_err(r,m);return;}
-    Cond c; int hc=0;
-    char *wh=strcasestr(p,"WHERE");
-    if(wh){wh+=5;strtrim(wh);hc=parse_cond(wh,&c);}
-    int del=0;
-    for(int j=0;j<t->nrows;j++){
-        Row *row=&t->rows[j]; if(row->del) continue;
-        if(hc&&!eval_cond(row,t,&c)) continue;
-        row->del=1; del++;
-    }
-    save_db(db);
-    char m[64];snprintf(m,64,"%d row(s) deleted",del);res_ok(r,m,del);
+/* ── Block codec ─────────────────────────────────────────────── */
+/* Growable byte buffer and bounds-checked reader for the file format.
+   Errors are sticky so a long run of puts/gets is checked once. */
+typedef struct { uint8_t *p; size_t n,cap; int err; } Buf;
+typedef struct { const uint8_t *p; size_t n,o; int err; } Rd;
+
+static int buf_reserve(Buf *b,size_t n){
+    if(b->n+n<=b->cap) return 0;
+    size_t c=b->cap?b->cap:4096; while(c<b->n+n) c*=2;
+    uint8_t *p=(uint8_t*)realloc(b->p,c); if(!p){b->err=1;return -1;}
+    b->p=p; b->cap=c; return 0;
+}
+static void buf_put(Buf *b,const void *d,size_t n){
+    if(!n||buf_reserve(b,n)) return;
+    memcpy(b->p+b->n,d,n); b->n+=n;
+}
+static void rd_get(Rd *r,void *d,size_t n){
+    if(r->err||r->n-r->o<n){r->err=1;memset(d,0,n);return;}
+    memcpy(d,r->p+r->o,n); r->o+=n;
+}
+/* Unsigned LEB128: 7 bits a byte, low first, high bit = more follow. */
+static void buf_uv(Buf *b,uint64_t v){
+    uint8_t x[10]; size_t n=0;
+    do{ x[n]=(uint8_t)(v&127); v>>=7; if(v) x[n]|=128; n++; } while(v);
+    buf_put(b,x,n);
+}
+static uint64_t rd_uv(Rd *r){
+    uint64_t v=0; uint8_t x=128;
+    for(int s=0;s<64&&(x&128);s+=7){ rd_get(r,&x,1); v|=(uint64_t)(x&127)<<s; }
+    return v;
 }
 
-static void do_show(DB *db,Res *r){
-    r->ok=1; r->ncols=3;
-    strcpy(r->cname[0],"Table");   r->ctype[0]=T_TEXT;
-    strcpy(r->cname[1],"Columns"); r->ctype[1]=T_INT;
-    strcpy(r->cname[2],"Rows");    r->ctype[2]=T_INT;
-    char v[MAX_COLUMNS][MAX_STR_LEN];
-    for(int i=0;i<db->hdr.ntables;i++){
-        Table *t=&db->tbl[i]; int rc=0;
-        for(int j=0;j<t->nrows;j++) if(!t->rows[j].del) rc++;
-        strncpy(v[0],t->name,MAX_STR_LEN-1);
-        snprintf(v[1],MAX_STR_LEN,"%d",t->ncols);
-        snprintf(v[2],MAX_STR_LEN,"%d",rc);
-        res_addrow(r,v,3);
+/* CRC32C (Castagnoli), reflected. Hardware path where available, else a
+   byte-at-a-time table. */
+#if defined(HAVE_CRC32C_HW)&&(defined(__x86_64__)||defined(__i386__))
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t c,const uint8_t *p,size_t n){
+#  if defined(__x86_64__)
+    uint64_t c64=c;
+    for(;n>=8;n-=8,p+=8){uint64_t v;memcpy(&v,p,8);c64=_mm_crc32_u64(c64,v);}
+    c=(uint32_t)c64;
+#  endif
+    while(n--) c=_mm_crc32_u8(c,*p++);
+    return c;
+}
+static int crc32c_hw_ok(void){ return __builtin_cpu_supports("sse4.2"); }
+#elif defined(HAVE_CRC32C_HW)
+static uint32_t crc32c_hw(uint32_t c,const uint8_t *p,size_t n){
+    for(;n>=8;n-=8,p+=8){uint64_t v;memcpy(&v,p,8);c=__crc32cd(c,v);}
+    while(n--) c=__crc32cb(c,*p++);
+    return c;
+}
+static int crc32c_hw_ok(void){ return 1; }
+#endif
+static uint32_t crc32c(uint32_t crc,const void *data,size_t n){
+    static uint32_t tab[256]; static volatile int init;
+    const uint8_t *p=(const uint8_t*)data; crc=~crc;
+#ifdef HAVE_CRC32C_HW
+    static volatile int hw=-1;
+    if(hw<0) hw=crc32c_hw_ok();
+    if(hw) return ~crc32c_hw(crc,p,n);
+#endif
+    if(!init){
+        for(uint32_t i=0;i<256;i++){
+            uint32_t c=i; for(int k=0;k<8;k++) c=c&1?(c>>1)^0x82F63B78u:c>>1;
+            tab[i]=c;
+        }
+        init=1;
     }
-    char m[64];snprintf(m,64,"%d table(s)",r->nrows);
-    strncpy(r->msg,m,sizeof(r->msg)-1); r->affected=r->nrows;
+    while(n--) crc=tab[(crc^*p++)&0xff]^(crc>>8);
+    return ~crc;
 }
 
-static void do_desc(DB *db,char *sql,Res *r){
-    char *p=sql; while(*p&&!isspace((unsigned char)*p))p++; strtrim(p);
-    Table *t=find_tbl(db,p);
-    if(!t){char m[128];snprintf(m,128,"Table '%s' not found",p);res_err(r,m);return;}
-    r->ok=1; r->ncols=4;
-    strcpy(r->cname[0],"Column");  r->ctype[0]=T_TEXT;
-    strcpy(r->cname[1],"Type");    r->ctype[1]=T_TEXT;
-    strcpy(r->cname[2],"Nullable");r->ctype[2]=T_TEXT;
-    strcpy(r->cname[3],"PK");      r->ctype[3]=T_TEXT;
-    char v[MAX_COLUMNS][MAX_STR_LEN];
-    for(int i=0;i<t->ncols;i++){
-        strncpy(v[0],t->cols[i].name,MAX_STR_LEN-1);
-        strncpy(v[1],tname(t->cols[i].type),MAX_STR_LEN-1);
-        strcpy(v[2],t->cols[i].nullable?"YES":"NO");
-        strcpy(v[3],t->cols[i].pk?"YES":"NO");
-        res_addrow(r,v,4);
+/* LZ77 block codec in the LZ4 mould: a token byte holds the literal run
+   (high nibble) and match length-4 (low nibble), 15 meaning "more bytes
+   follow"; then the literals, then a 16-bit little-endian match offset. The
+   final sequence is literals only. Rows are mostly short runs and zero
+   padding, which this handles well at memcpy-like speed. */
+#define LZ_HASH_BITS 13
+static size_t lz_bound(size_t n){ return n+n/255+16; }
+static uint8_t *lz_len(uint8_t *op,size_t l){
+    while(l>=255){*op++=255;l-=255;}
+    *op++=(uint8_t)l; return op;
+}
+static size_t lz_compress(const uint8_t *in,size_t n,uint8_t *out){
+    uint32_t ht[1<<LZ_HASH_BITS]; memset(ht,0,sizeof(ht));
+    size_t ip=0,anchor=0; uint8_t *op=out;
+    while(n>=12&&ip+12<=n){
+        uint32_t seq; memcpy(&seq,in+ip,4);
+        uint32_t h=(seq*2654435761u)>>(32-LZ_HASH_BITS);
+        size_t ref=ht[h]; ht[h]=(uint32_t)ip+1;
+        if(!ref||ip-(ref-1)>65535||memcmp(in+ref-1,in+ip,4)){ip++;continue;}
+        ref--;
+        size_t ml=4; while(ip+ml+5<n&&in[ref+ml]==in[ip+ml]) ml++;
+        size_t lit=ip-anchor,off=ip-ref;
+        uint8_t *tok=op++;
+        *tok=(uint8_t)((lit>=15?15:lit)<<4|(ml-4>=15?15:ml-4));
+        if(lit>=15) op=lz_len(op,lit-15);
+        memcpy(op,in+anchor,lit); op+=lit;
+        *op++=(uint8_t)off; *op++=(uint8_t)(off>>8);
+        if(ml-4>=15) op=lz_len(op,ml-4-15);
+        ip+=ml; anchor=ip;
     }
-    char m[128];snprintf(m,128,"Table '%s': %d column(s)",t->name,t->ncols);
-    strncpy(r->msg,m,sizeof(r->msg)-1);
+    size_t lit=n-anchor;
+    *op++=(uint8_t)((lit>=15?15:lit)<<4);
+    if(lit>=15) op=lz_len(op,lit-15);
+    memcpy(op,in+anchor,lit); op+=lit;
+    return (size_t)(op-out);
 }
-
-static void do_vacuum(DB *db,Res *r){
-    int tot=0;
-    for(int i=0;i<db->hdr.ntables;i++){
-        Table *t=&db->tbl[i]; int w=0;
-        for(int j=0;j<t->nrows;j++)
-            if(!t->rows[j].del) t->rows[w++]=t->rows[j]; else tot++;
-        t->nrows=w;
+/* Returns the decoded size, or -1 if the input is malformed. */
+static long lz_decompress(const uint8_t *in,size_t n,uint8_t *out,size_t cap){
+    const uint8_t *ip=in,*ie=in+n; uint8_t *op=out,*oe=out+cap;
+    while(ip<ie){
+        unsigned tok=*ip++; size_t lit=tok>>4,ml=tok&15;
+        if(lit==15){ unsigned c; do{ if(ip>=ie) return -1; c=*ip++; lit+=c; }while(c==255); }
+        if((size_t)(ie-ip)<lit||(size_t)(oe-op)<lit) return -1;
+        memcpy(op,ip,lit); op+=lit; ip+=lit;
+        if(ip==ie) break;
+        if(ie-ip<2) return -1;
+        size_t off=ip[0]|(size_t)ip[1]<<8; ip+=2;
+        if(ml==15){ unsigned c; do{ if(ip>=ie) return -1; c=*ip++; ml+=c; }while(c==255); }
+        ml+=4;
+        if(!off||off>(size_t)(op-out)||(size_t)(oe-op)<ml) return -1;
+        const uint8_t *m=op-off; while(ml--) *op++=*m++;
     }
-    save_db(db);
-    char m[64];snprintf(m,64,"VACUUM: purged %d row(s)",tot);res_ok(r,m,tot);
+    return (long)(op-out);
 }
 
-/* ── Dispatcher ─────────────────────────────────────────────── */
-void db_exec(DB *db,const char *in,Res *r){
-    memset(r,0,sizeof(*r));
-    char sql[MAX_SQL_LEN]; strncpy(sql,in,MAX_SQL_LEN-1); strtrim(sql);
-    int l=(int)strlen(sql); if(l>0&&sql[l-1]==';') sql[--l]=0; strtrim(sql);
-    if(!*sql){res_ok(r,"Empty",0);return;}
-    if(strswci(sql,"CREATE TABLE"))     do_create(db,sql,r);
-    else if(strswci(sql,"DROP TABLE"))  do_drop(db,sql,r);
-    else if(strswci(sql,"INSERT INTO")) do_insert(db,sql,r);
-    else if(strswci(sql,"SELECT"))      do_select(db,sql,r);
-    else if(strswci(sql,"UPDATE"))      do_update(db,sql,r);
-    else if(strswci(sql,"DELETE FROM")) do_delete(db,sql,r);
-    else if(strswci(sql,"SHOW TABLES")) do_show(db,r);
-    else if(strswci(sql,"DESCRIBE")||strswci(sql,"DESC ")) do_desc(db,sql,r);
-    else if(strswci(sql,"VACUUM"))      do_vacuum(db,r);
-    else res_err(r,"Unknown command");
+/* On-disk block: header, then clen bytes that are either LZ data or, when
+   clen==raw, the raw bytes themselves. crc covers the decoded bytes. */
+typedef struct { uint32_t raw,clen,crc; } BlkHdr;
+
+static int blk_write(Fw *w,const Buf *raw,Buf *tmp){
+    BlkHdr h={(uint32_t)raw->n,0,crc32c(0,raw->p,raw->n)};
+    tmp->n=0; if(buf_reserve(tmp,lz_bound(raw->n))) return -1;
+    size_t c=raw->n?lz_compress(raw->p,raw->n,tmp->p):0;
+    const uint8_t *d=tmp->p;
+    if(c>=raw->n){c=raw->n;d=raw->p;}
+    h.clen=(uint32_t)c;
+    fw_put(w,&h,sizeof(h)); fw_put(w,d,c);
+    return w->err?-1:0;
+}
+/* 0 ok, -1 short or malformed, -2 checksum mismatch. */
+static int blk_read(FILE *f,Buf *raw,Buf *tmp){
+    BlkHdr h;
+    if(fread(&h,sizeof(h),1,f)!=1||h.clen>h.raw) return -1;
+    raw->n=tmp->n=0;
+    if(buf_reserve(raw,h.raw)||buf_reserve(tmp,h.clen)) return -1;
+    if(h.clen&&fread(tmp->p,1,h.clen,f)!=h.clen) return -1;
+    if(h.clen==h.raw){ if(h.raw) memcpy(raw->p,tmp->p,h.raw); }
+    else if(lz_decompress(tmp->p,h.clen,raw->p,h.raw)!=(long)h.raw) return -1;
+    raw->n=h.raw;
+    return crc32c(0,raw->p,raw->n)==h.crc?0:-2;
 }
 
-/* ── Printer ────────────────────────────────────────────────── */
-static void print_res(Res *r){
-    if(!r->ok){fprintf(stderr,"ERROR: %s\n",r->msg);return;}
-    if(!r->ncols){printf("OK: %s\n",r->msg);return;}
-    int w[MAX_COLUMNS];
-    for(int j=0;j<r->ncols;j++){
-        w[j]=(int)strlen(r->cname[j]);
-        for(int i=0;i<r->nrows;i++){int l=(int)strlen(res_get(r,i,j));if(l>w[j])w[j]=l;}
+/* Cells are stored at their natural width; TEXT as a length byte plus bytes. */
+static void enc_val(Buf *b,const Val *v,CType t){
+    switch(t){case T_INT:buf_put(b,&v->i,8);break;
+              case T_FLOAT:buf_put(b,&v->f,8);break;
+              case T_BOOL:buf_put(b,&v->b,1);break;
+              case T_TEXT:{uint8_t l=(uint8_t)strnlen(v->s,MAX_STR_LEN-1);buf_put(b,&l,1);buf_put(b,v->s,l);break;}
+              default:break;}
+}
+static void dec_val(Rd *r,Val *v,CType t){
+    switch(t){case T_INT:rd_get(r,&v->i,8);break;
+              case T_FLOAT:rd_get(r,&v->f,8);break;
+              case T_BOOL:rd_get(r,&v->b,1);break;
+              case T_TEXT:{uint8_t l=0;rd_get(r,&l,1);rd_get(r,v->s,l);v->s[l]=0;break;}
+              default:break;}
+}
+
+/* ── MVCC ───────────────────────────────────────────────────── */
+static void retire(Ret **l,void *p){
+    if(!p) return;
+    Ret *r=(Ret*)malloc(sizeof(Ret));
+    if(!r) return;   /* leak rather than free under a reader */
+    r->p=p; r->tag=UINT64_MAX; r->next=*l; *l=r;
+}
+/* New entries are pushed at the head, so the untagged ones are a prefix. */
+static void ret_tag(Ret *l,uint64_t tag){ for(;l&&l->tag==UINT64_MAX;l=l->next) l->tag=tag; }
+static void ret_free(Ret **l,uint64_t before){
+    for(Ret **pp=l;*pp;){
+        Ret *r=*pp;
+        if(r->tag<before){*pp=r->next;free(r->p);free(r);} else pp=&r->next;
     }
-    printf("+");for(int j=0;j<r->ncols;j++){for(int k=0;k<w[j]+2;k++)printf("-");printf("+");}printf("\n");
-    printf("|");for(int j=0;j<r->ncols;j++) printf(" %-*s |",w[j],r->cname[j]);printf("\n");
-    printf("+");for(int j=0;j<r->ncols;j++){for(int k=0;k<w[j]+2;k++)printf("-");printf("+");}printf("\n");
-    for(int i=0;i<r->nrows;i++){
-        printf("|");for(int j=0;j<r->ncols;j++) printf(" %-*s |",w[j],res_get(r,i,j));printf("\n");
+}
+/* Visible to snapshot snap of transaction tx: committed by snap or
+   written by tx itself, and not deleted by either. */
+static int row_visible(const Row *r,uint64_t snap,uint64_t tx){
+    uint64_t x0=ald(&r->xmin),x1=ald(&r->xmax);
+    if(x1&&(x1==tx||x1<=snap)) return 0;
+    return x0&&(x0==tx||x0<=snap);
+}
+static const char *ERR_CONFLICT="Write conflict: row changed by a concurrent transaction";
+/* Next free version slot. The array grows by copying so a reader keeps a
+   valid (older) array; the caller fills the slot and then publishes it
+   with ast(&t->nrows,t->nrows+1). */
+static Row *tbl_append(Table *t){
+    if(t->nrows>=t->cap){
+        int nc=t->cap?t->cap*2:16;
+        Row *nr=(Row*)malloc(sizeof(Row)*nc); if(!nr) return NULL;
+        if(t->nrows) memcpy(nr,t->rows,sizeof(Row)*t->nrows);
+        retire(&t->ret,t->rows); ast(&t->rows,nr); t->cap=nc;
+    }
+    Row *row=&t->rows[t->nrows]; memset(row,0,sizeof(Row));
+    return row;
+}
+static int snap_begin(DB *db,uint64_t *ts){
+    for(;;){
+        uint64_t s=ald(&db->clock);
+        for(int i=0;i<MAX_SNAPS;i++){
+            uint64_t z=0;
+            if(!ald(&db->snaps[i])&&acas(&db->snaps[i],&z,s)){ afence(); *ts=s; return i; }
+        }
+        cpu_yield();
+    }
+}
+static void snap_end(DB *db,int slot){ ast(&db->snaps[slot],0); }
+/* Ends a writer statement: memory it retired may still be held by any
+   snapshot up to wts-1, so that is its tag; publishing clock=wts then
+   exposes the statement, and whatever no active snapshot can see is freed. */
+static void wr_commit(DB *db){
+    for(int i=0;i<db->hdr.ntables;i++) ret_tag(db->tbl[i].ret,db->wts-1);
+    ast(&db->clock,db->wts);
+    afence();
+    uint64_t m=UINT64_MAX;
+    for(int i=0;i<MAX_SNAPS;i++){ uint64_t v=ald(&db->snaps[i]); if(v&&v<m) m=v; }
+    for(int i=0;i<db->hdr.ntables;i++) ret_free(&db->tbl[i].ret,m);
+}
+static int tx_reserve(Sess *s,int n){
+    if(s->nlog+n<=s->cap) return 0;
+    int c=s->cap?s->cap*2:256; while(c<s->nlog+n) c*=2;
+    TxLog *l=(TxLog*)realloc(s->log,sizeof(TxLog)*c); if(!l) return -1;
+    s->log=l; s->cap=c; return 0;
+}
+/* Callers tx_reserve first so the change and its log entry go together. */
+static void tx_note(Sess *s,const DB *db,const Table *t,int j,int ins){
+    TxLog *l=&s->log[s->nlog++]; l->ti=(int16_t)(t-db->tbl); l->ins=(int8_t)ins; l->j=j;
+}
+static void row_drop(const Table *t,Row *row,Ret **ret);
+/* Marks the zone block of version j as changed at ts. */
+static void zone_touch(Table *t,int j,uint64_t ts){ ast(&t->zones[j/ZONE_ROWS].lsn,ts); }
+/* Undoes the log back to entry `to`; created versions become dead slots.
+   Callers hold wlock with db->wts set, which dates the undo. */
+static void tx_undo(DB *db,Sess *s,int to){
+    while(s->nlog>to){
+        TxLog *l=&s->log[--s->nlog]; Row *row=&db->tbl[l->ti].rows[l->j];
+        zone_touch(&db->tbl[l->ti],l->j,db->wts);
+        if(l->ins){ ast(&row->xmin,0); ast(&row->xmax,1); row_drop(&db->tbl[l->ti],row,&db->tbl[l->ti].ret); }
+        else ast(&row->xmax,0);
+    }
+}
+/* Restamps the log with db->wts; wr_commit then makes it visible. */
+static void tx_stamp(DB *db,Sess *s){
+    for(int i=0;i<s->nlog;i++){
+        TxLog *l=&s->log[i]; Row *row=&db->tbl[l->ti].rows[l->j];
+        if(l->ins) ast(&row->xmin,db->wts); else ast(&row->xmax,db->wts);
+        zone_touch(&db->tbl[l->ti],l->j,db->wts);
     }
-    printf("+");for(int j=0;j<r->ncols;j++){for(int k=0;k<w[j]+2;k++)printf("-");printf("+");}printf("\n");
-    printf("%s\n",r->msg);
+    s->nlog=0;
 }
 
-/* ── Main ───────────────────────────────────────────────────── */
-int main(int argc,char *argv[]){
-    if(argc<2){
-        fprintf(stderr,"Usage:\n  %s <db.dbm>         — REPL\n  %s <db.dbm> \"SQL\"  — single command\n",argv[0],argv[0]);
-        return 1;
+/* ── Cells ──────────────────────────────────────────────────── */
+/* Type of the bits actually held in Row.data: codes for DICT columns. */
+static CType col_stype(const Col *c){ return c->dict?T_INT:c->type; }
+/* TEXT and BLOB cells hold one reference to their chain, if they have one. */
+static int col_ovf(const Col *c){ return !c->dict&&(c->type==T_TEXT||c->type==T_BLOB); }
+static const char *cell_head(const Cell *c){ return c->in.n>CELL_INLINE?c->ov.pg->d:c->in.s; }
+static void ovf_free(Ovf *p,Ret **ret){
+    while(p){ Ovf *n=p->next; if(ret) retire(ret,p); else free(p); p=n; }
+}
+/* Stores the n bytes at s in c, inline or in a new chain; -1 on OOM. */
+static int cell_put(Cell *c,const char *s,size_t n){
+    memset(c,0,sizeof(*c));
+    if(n<=CELL_INLINE){ c->in.n=(uint32_t)n; memcpy(c->in.s,s,n); return 0; }
+    if(n>UINT32_MAX) return -1;
+    Ovf *h=NULL,**pp=&h;
+    for(size_t o=0;o<n;){
+        uint32_t k=n-o<OVF_DATA?(uint32_t)(n-o):OVF_DATA;
+        Ovf *p=(Ovf*)malloc(sizeof(Ovf)+k+1); if(!p){ ovf_free(h,NULL); return -1; }
+        p->next=NULL; p->refs=1; p->n=k; memcpy(p->d,s+o,k); p->d[k]=0;
+        *pp=p; pp=&p->next; o+=k;
     }
-    char fn[512]; strncpy(fn,argv[1],sizeof(fn)-1);
-    if(!strstr(fn,".dbm")) strncat(fn,".dbm",sizeof(fn)-strlen(fn)-1);
-    DB *db=open_db(fn);
-    if(!db){fprintf(stderr,"Fatal: cannot open '%s'\n",fn);return 1;}
-    printf("potatorf v1.0  db=%s  tables=%d\n",db->hdr.name,db->hdr.ntables);
-    Res *r=(Res*)calloc(1,sizeof(Res)); if(!r){close_db(db);return 1;}
-    if(argc>=3){
-        char sql[MAX_SQL_LEN]={0};
-        for(int i=2;i<argc;i++){strncat(sql,argv[i],sizeof(sql)-strlen(sql)-1);if(i<argc-1)strncat(sql," ",sizeof(sql)-strlen(sql)-1);}
-        db_exec(db,sql,r); print_res(r); res_free(r);
-    } else {
-        printf("Type SQL (end with ;) or 'quit'.\n\n");
-        char line[MAX_SQL_LEN],buf[MAX_SQL_LEN]={0};
-        while(1){
-            printf(*buf==0?"db> ":"... "); fflush(stdout);
-            if(!fgets(line,sizeof(line),stdin)) break;
-            strtrim(line);
-            if(!strcasecmp(line,"quit")||!strcasecmp(line,"exit")) break;
-            if(!*line) continue;
-            strncat(buf,line,sizeof(buf)-strlen(buf)-1);
-            strncat(buf," ",sizeof(buf)-strlen(buf)-1);
-            if(strchr(line,';')||strswci(buf,"SHOW")||strswci(buf,"VACUUM")||strswci(buf,"DESC")){
-                if(r->cells){for(int i=0;i<r->cap*r->ncols;i++) free(r->cells[i]);free(r->cells);}
-                memset(r,0,sizeof(*r));
-                db_exec(db,buf,r); print_res(r); buf[0]=0;
-            }
+    c->ov.n=(uint32_t)n; c->ov.pg=h; return 0;
+}
+/* Gives up c's reference; the last one frees the chain, through ret while
+   readers may still be on it. c is left empty. */
+static void cell_drop(Cell *c,Ret **ret){
+    if(c->in.n>CELL_INLINE&&--c->ov.pg->refs==0) ovf_free(c->ov.pg,ret);
+    memset(c,0,sizeof(*c));
+}
+static void row_drop(const Table *t,Row *row,Ret **ret){
+    for(int c=0;c<t->ncols;c++) if(col_ovf(&t->cols[c])) cell_drop(&row->data[c],ret);
+}
+/* A copied row version shares its long values with the original. */
+static void row_share(const Table *t,Row *row){
+    for(int c=0;c<t->ncols;c++)
+        if(col_ovf(&t->cols[c])&&row->data[c].in.n>CELL_INLINE) row->data[c].ov.pg->refs++;
+}
+/* Copies c's bytes to o (room for n+1) and NUL-terminates them. */
+static void cell_read(const Cell *c,char *o){
+    if(c->in.n<=CELL_INLINE){ memcpy(o,c->in.s,(size_t)c->in.n+1); return; }
+    for(const Ovf *p=c->ov.pg;p;p=p->next){ memcpy(o,p->d,p->n); o+=p->n; }
+    *o=0;
+}
+/* BLOBs are shown as \x and two hex digits a byte (o: room for 2n+3). */
+static void cell_hex(const Cell *c,char *o){
+    static const char hx[]="0123456789abcdef";
+    const Ovf *p=c->in.n>CELL_INLINE?c->ov.pg:NULL;
+    const unsigned char *d=(const unsigned char*)(p?p->d:c->in.s); size_t m=p?p->n:c->in.n;
+    *o++='\\'; *o++='x';
+    for(;;){
+        for(size_t i=0;i<m;i++){ *o++=hx[d[i]>>4]; *o++=hx[d[i]&15]; }
+        if(!p||!(p=p->next)) break;
+        d=(const unsigned char*)p->d; m=p->n;
+    }
+    *o=0;
+}
+/* Compares c with the n bytes at s page by page, never assembling the
+   value: TEXT ignoring case as strcasecmp does, BLOB bytewise. */
+static int cell_cmp(const Cell *c,const char *s,size_t n,CType t){
+    const Ovf *p=c->in.n>CELL_INLINE?c->ov.pg:NULL;
+    const unsigned char *d=(const unsigned char*)(p?p->d:c->in.s); size_t m=p?p->n:c->in.n,k=0;
+    for(;;){
+        for(size_t i=0;i<m;i++,k++){
+            if(k==n) return 1;
+            int a=d[i],b=(unsigned char)s[k];
+            if(t!=T_BLOB){ a=tolower(a); b=tolower(b); }
+            if(a!=b) return a-b;
         }
-        if(r->cells){for(int i=0;i<r->cap*r->ncols;i++) free(r->cells[i]);free(r->cells);}
-        free(r);
+        if(!p||!(p=p->next)) break;
+        d=(const unsigned char*)p->d; m=p->n;
+    }
+    return k<n?-1:0;
+}
+/* val_cmp for a numeric or BOOL cell. */
+static int cell_ncmp(const Cell *c,const Val *v,CType t){
+    switch(t){case T_INT:return(c->i>v->i)-(c->i<v->i);
+              case T_FLOAT:return(c->f>v->f)-(c->f<v->f);
+              default:return c->b-v->b;}
+}
+static int hexv(int c){ return isdigit(c)?c-'0':isxdigit(c)?tolower(c)-'a'+10:-1; }
+/* A BLOB literal stands for its own bytes, or with a \x prefix for the
+   bytes its hex digits spell. Writes them to o (room for strlen(s)) and
+   returns how many. */
+static size_t blob_lit(const char *s,char *o){
+    size_t n=strlen(s),i=2; int hex=s[0]=='\\'&&(s[1]=='x'||s[1]=='X')&&n%2==0;
+    for(;hex&&i<n;i+=2) hex=hexv((unsigned char)s[i])>=0&&hexv((unsigned char)s[i+1])>=0;
+    if(!hex){ memcpy(o,s,n); return n; }
+    for(i=2;i<n;i+=2) *o++=(char)(hexv((unsigned char)s[i])<<4|hexv((unsigned char)s[i+1]));
+    return (n-2)/2;
+}
+/* Cells are written as enc_val writes values, except that TEXT and BLOB
+   carry a varint length (file version 7) and stream from their pages. */
+static void enc_cell(Buf *b,const Cell *c,const Col *cl){
+    switch(col_stype(cl)){
+        case T_INT:   buf_put(b,&c->i,8); break;
+        case T_FLOAT: buf_put(b,&c->f,8); break;
+        case T_BOOL:  buf_put(b,&c->b,1); break;
+        default:
+            buf_uv(b,c->in.n);
+            if(c->in.n<=CELL_INLINE) buf_put(b,c->in.s,c->in.n);
+            else for(const Ovf *p=c->ov.pg;p;p=p->next) buf_put(b,p->d,p->n);
     }
-    close_db(db); printf("Goodbye.\n"); return 0;
 }
+static void dec_cell(Rd *r,Cell *c,const Col *cl){
+    switch(col_stype(cl)){
+        case T_INT:   rd_get(r,&c->i,8); break;
+        case T_FLOAT: rd_get(r,&c->f,8); break;
+        case T_BOOL:  rd_get(r,&c->b,1); break;
+        default: {
+            uint64_t n=rd_uv(r);
+            if(r->err||n>r->n-r->o||cell_put(c,(const char*)r->p+r->o,(size_t)n)){ r->err=1; return; }
+            r->o+=(size_t)n;
+        }
+    }
+}
+/* Older files hold Vals, TEXT at most MAX_STR_LEN-1 bytes. */
+static int cell_from(Cell *c,const Val *v,const Col *cl){
+    if(col_ovf(cl)) return cell_put(c,v->s,strnlen(v->s,MAX_STR_LEN-1));
+    memset(c,0,sizeof(*c)); memcpy(c,v,sizeof(int64_t)); return 0;
+}
+
+/* ── Dictionaries ───────────────────────────────────────────── */
+static uint64_t str_hash(const char *s){
+    uint64_t h=0xcbf29ce484222325ULL;
+    while(*s) h=(h^(unsigned char)*s++)*0x100000001b3ULL;
+    return hmix(h);
+}
+static void dict_free(Dict *d){
+    for(int i=0;i<d->n;i++) free(d->s[i]);
+    free(d->s); free(d->ix); memset(d,0,sizeof(*d));
+}
+static int dict_find(const Dict *d,const char *s){
+    if(!d->icap) return -1;
+    for(uint32_t i=(uint32_t)str_hash(s)&(d->icap-1);d->ix[i];i=(i+1)&(d->icap-1))
+        if(!strcmp(d->s[d->ix[i]-1],s)) return (int)d->ix[i]-1;
+    return -1;
+}
+static const char *dict_str(const Dict *d,int64_t c){
+    int n=ald(&d->n); char **s=ald(&d->s);
+    return c>=0&&c<n?s[c]:"";
+}
+/* Code for s, appending it if new; -1 on OOM. The string array grows by
+   copying (old one retired to ret) because readers index it unlocked. */
+static int dict_add(Dict *d,const char *s,Ret **ret){
+    int c=dict_find(d,s); if(c>=0) return c;
+    if((uint32_t)(d->n+1)*2>d->icap){
+        uint32_t ic=d->icap?d->icap*2:64;
+        uint32_t *ix=(uint32_t*)calloc(ic,sizeof(uint32_t)); if(!ix) return -1;
+        for(int k=0;k<d->n;k++){
+            uint32_t i=(uint32_t)str_hash(d->s[k])&(ic-1);
+            while(ix[i]) i=(i+1)&(ic-1);
+            ix[i]=(uint32_t)k+1;
+        }
+        free(d->ix); d->ix=ix; d->icap=ic;
+    }
+    if(d->n>=d->cap){
+        int nc=d->cap?d->cap*2:64;
+        char **ns=(char**)malloc(sizeof(char*)*nc); if(!ns) return -1;
+        if(d->n) memcpy(ns,d->s,sizeof(char*)*d->n);
+        if(ret) retire(ret,d->s); else free(d->s);
+        ast(&d->s,ns); d->cap=nc;
+    }
+    if(!(d->s[d->n]=strdup(s))) return -1;
+    uint32_t i=(uint32_t)str_hash(s)&(d->icap-1);
+    while(d->ix[i]) i=(i+1)&(d->icap-1);
+    d->ix[i]=(uint32_t)d->n+1;
+    ast(&d->n,d->n+1);
+    return d->n-1;
+}
+/* Value of non-NULL cell c of column ci as the column type sees it, in
+   tmp: dictionary codes decoded, TEXT and BLOB cut to MAX_STR_LEN-1 bytes
+   (see col_big). */
+static const Val *cell_val(const Table *t,int ci,const Cell *c,Val *tmp){
+    if(t->cols[ci].dict) snprintf(tmp->s,MAX_STR_LEN,"%s",dict_str(&t->dict[ci],c->i));
+    else if(col_ovf(&t->cols[ci])){
+        size_t n=c->in.n<MAX_STR_LEN-1?c->in.n:MAX_STR_LEN-1;
+        memcpy(tmp->s,cell_head(c),n); tmp->s[n]=0;
+    } else memcpy(tmp,c,sizeof(int64_t));
+    return tmp;
+}
+static const Val *col_val(const Table *t,const Row *row,int ci,Val *tmp){ return cell_val(t,ci,&row->data[ci],tmp); }
+/* True when col_val cuts the value short. */
+static int col_big(const Table *t,const Row *row,int ci){
+    if(t->cols[ci].dict) return strlen(dict_str(&t->dict[ci],row->data[ci].i))>MAX_STR_LEN-1;
+    return col_ovf(&t->cols[ci])&&row->data[ci].in.n>MAX_STR_LEN-1;
+}
+/* Sets a cell to the value literal s spells, or to SQL NULL when s is
+   NULL; a long value it replaces loses this version's reference. -1 on OOM. */
+static int col_set(Table *t,Row *row,int ci,const char *s){
+    const Col *cl=&t->cols[ci]; Cell *c=&row->data[ci];
+    if(col_ovf(cl)) cell_drop(c,&t->ret);
+    row->null[ci]=!s;
+    if(!s) return 0;
+    if(cl->dict){ int k=dict_add(&t->dict[ci],s,&t->ret); if(k<0) return -1; c->i=k; return 0; }
+    if(cl->type==T_TEXT) return cell_put(c,s,strlen(s));
+    if(cl->type==T_BLOB){
+        char *b=(char*)malloc(strlen(s)+1); if(!b) return -1;
+        int rc=cell_put(c,b,blob_lit(s,b)); free(b); return rc;
+    }
+    Val v; str2val(s,cl->type,&v); memcpy(c,&v,sizeof(int64_t)); return 0;
+}
+/* Cell k of the row being built from column ci of row (NULL: a missing
+   outer-join row), as res_cell. TEXT and BLOB render from the row itself;
+   one too long for rv is copied once, straight off its pages, into big[k]. */
+static void res_col(Res *r,char rv[][MAX_STR_LEN],int k,const Table *t,const Row *row,int ci){
+    const Col *cl=&t->cols[ci]; Val tmp;
+    if(!row||row->null[ci]){ res_cell(r,rv,k,NULL,cl->type); return; }
+    if(!cl->dict&&!col_ovf(cl)){ res_cell(r,rv,k,col_val(t,row,ci,&tmp),cl->type); return; }
+    const Cell *c=&row->data[ci]; const char *ds=cl->dict?dict_str(&t->dict[ci],c->i):NULL;
+    size_t n=ds?strlen(ds):cl->type==T_BLOB?2*(size_t)c->in.n+2:c->in.n;
+    char *o=n<MAX_STR_LEN?rv[k]:(r->big[k]=(char*)malloc(n+1));
+    if(!o){ res_cell(r,rv,k,col_val(t,row,ci,&tmp),cl->type); return; }
+    if(ds) memcpy(o,ds,n+1); else if(cl->type==T_BLOB) cell_hex(c,o); else cell_read(c,o);
+    if(r->typed){ r->sn[k]=0; snprintf(r->sv[k].s,MAX_STR_LEN,"%s",o); r->staged=1; }
+}
+
+/* ── Zone maps ──────────────────────────────────────────────── */
+static int zone_reserve(Table *t,int nz){
+    if(nz<=t->zcap) return 0;
+    int c=t->zcap?t->zcap:1; while(c<nz) c*=2;
+    Zone *z=(Zone*)malloc(sizeof(Zone)*c); if(!z) return -1;
+    if(t->zcap) memcpy(z,t->zones,sizeof(Zone)*t->zcap);
+    memset(z+t->zcap,0,sizeof(Zone)*(c-t->zcap));
+    retire(&t->ret,t->zones); ast(&t->zones,z); t->zcap=c; return 0;
+}
+static void zone_widen(ZCol *z,const Val *v,CType tp){
+    if(!z->has){z->mn=*v;z->mx=*v;z->has=1;return;}
+    if(val_cmp(v,&z->mn,tp)<0) z->mn=*v;
+    if(val_cmp(v,&z->mx,tp)>0) z->mx=*v;
+}
+/* Folds row into block zone z; oldnull is the row's null map before an
+   in-place UPDATE, or NULL for a freshly inserted row. */
+static void zone_fold(const Table *t,Zone *z,const Row *row,const int8_t *oldnull){
+    for(int c=0;c<t->ncols;c++){
+        ZCol *zc=&z->c[c]; const Col *cl=&t->cols[c]; Val v;
+        if(!oldnull) zc->nnull+=row->null[c];
+        else zc->nnull+=row->null[c]-oldnull[c];
+        if(row->null[c]) continue;
+        if(cl->type==T_BLOB){ zc->has=zc->open=1; continue; }   /* bytes have no bounds here */
+        if(cl->dict) v.i=row->data[c].i; else col_val(t,row,c,&v);
+        if(col_ovf(cl)&&row->data[c].in.n>MAX_STR_LEN-1) zc->open=1;
+        zone_widen(zc,&v,col_stype(cl));
+    }
+}
+static int zone_note(Table *t,int j,const int8_t *oldnull){
+    if(zone_reserve(t,j/ZONE_ROWS+1)) return -1;
+    zone_fold(t,&t->zones[j/ZONE_ROWS],&t->rows[j],oldnull);
+    zone_touch(t,j,UINT64_MAX);   /* before the caller publishes the row */
+    return 0;
+}
+static int zone_rebuild(Table *t){
+    if(t->zcap) memset(t->zones,0,sizeof(Zone)*t->zcap);
+    if(zone_reserve(t,(t->nrows+ZONE_ROWS-1)/ZONE_ROWS)) return -1;
+    for(int j=0;j<t->nrows;j++) if(!t->rows[j].xmax) zone_fold(t,&t->zones[j/ZONE_ROWS],&t->rows[j],NULL);
+    return 0;
+}
+/* Worker boundaries fall on block starts so every block is tested whole. */
+static int zone_split(int nrows,int i,int n){
+    if(i>=n) return nrows;
+    int64_t b=(int64_t)((nrows+ZONE_ROWS-1)/ZONE_ROWS)*i/n;
+    return (int)(b*ZONE_ROWS<nrows?b*ZONE_ROWS:nrows);
+}
+
+/* ── Indexes ────────────────────────────────────────────────── */
+/* CREATE INDEX x ON t (key) [INCLUDE (c, ...)] keeps an entry for each
+   row version of t: its slot and a copy of its key and INCLUDE cells, 8
+   bytes plus 16 a column where a Row takes 560. A SELECT reading only
+   those columns is answered from the entries, touching just each
+   version's xmin/xmax to test visibility; conditions on the key narrow
+   it to the key range they bound (see run_ixscan). Entries below nm are
+   sorted by key, NULL first; newer ones follow unsorted in the tail, and
+   when it fills both are merged into a new run that replaces the old one
+   as a grown rows array does. Versions that ended or were rolled back
+   keep their entries until VACUUM drops them (ix_compact). Long TEXT and BLOB
+   values are shared with the row, holding a reference each. */
+typedef struct { int32_t j; uint32_t nul; Cell c[]; } IxEnt;   /* nul: bit k set when c[k] is NULL */
+typedef struct { int nm, nt, cap; _Alignas(max_align_t) char e[]; } IxRun;   /* e holds IxEnts: aligned for their Cells */
+typedef struct Index {
+    char   name[MAX_NAME_LEN];
+    int    nc, col[MAX_COLUMNS];   /* col[0] the key, then INCLUDE */
+    IxRun *run;
+} Index;
+
+static size_t ix_stride(const Index *x){ return sizeof(IxEnt)+sizeof(Cell)*(size_t)x->nc; }
+static IxEnt *ix_ent(const Index *x,const IxRun *r,int i){ return (IxEnt*)(r->e+ix_stride(x)*(size_t)i); }
+static int ix_has(const Index *x,int ci){
+    for(int k=0;k<x->nc;k++) if(x->col[k]==ci) return 1;
+    return 0;
+}
+/* Key of e against v (NULL: against the NULL key). */
+static int ix_vcmp(const Table *t,const Index *x,const IxEnt *e,const Val *v){
+    Val tmp;
+    if(e->nul&1) return v?-1:0;
+    if(!v) return 1;
+    return val_cmp(cell_val(t,x->col[0],&e->c[0],&tmp),v,t->cols[x->col[0]].type);
+}
+static int ix_kcmp(const Table *t,const Index *x,const IxEnt *a,const IxEnt *b){
+    Val tmp;
+    if(b->nul&1) return !(a->nul&1);
+    return ix_vcmp(t,x,a,cell_val(t,x->col[0],&b->c[0],&tmp));
+}
+/* First sorted entry whose key is not below v (upper: is above v). */
+static int ix_bound(const Table *t,const Index *x,const IxRun *r,const Val *v,int upper){
+    int lo=0,hi=r->nm;
+    while(lo<hi){
+        int m=lo+(hi-lo)/2,c=ix_vcmp(t,x,ix_ent(x,r,m),v);
+        if(c<0||(upper&&!c)) lo=m+1; else hi=m;
+    }
+    return lo;
+}
+/* Stable merge sort of the entry numbers in o (tmp: room for n more). */
+static void ix_sort(const Table *t,const Index *x,const IxRun *r,int *o,int *tmp,int n){
+    if(n<2) return;
+    int h=n/2,a=0,b=h,k=0;
+    ix_sort(t,x,r,o,tmp,h); ix_sort(t,x,r,o+h,tmp,n-h);
+    while(a<h&&b<n) tmp[k++]=ix_kcmp(t,x,ix_ent(x,r,o[b]),ix_ent(x,r,o[a]))<0?o[b++]:o[a++];
+    while(a<h) tmp[k++]=o[a++];
+    while(b<n) tmp[k++]=o[b++];
+    memcpy(o,tmp,sizeof(int)*(size_t)k);
+}
+/* Replaces x's run by one with the tail sorted into the rest and an empty
+   tail of its own; the old run is retired to ret (NULL: freed) whole,
+   entries moving over with their references. -1 on OOM. */
+static int ix_merge(const Table *t,Index *x,Ret **ret){
+    IxRun *r=x->run; int nm=r?r->nm:0,nt=r?r->nt:0,n=nm+nt,cap=n+IX_TAIL+n/16;
+    size_t sz=ix_stride(x);
+    IxRun *nr=(IxRun*)malloc(sizeof(IxRun)+sz*(size_t)cap); int *o=(int*)malloc(sizeof(int)*(2*(size_t)nt+1));
+    if(!nr||!o){ free(nr); free(o); return -1; }
+    for(int i=0;i<nt;i++) o[i]=nm+i;
+    ix_sort(t,x,r,o,o+nt,nt);
+    for(int a=0,b=0,k=0;a<nm||b<nt;k++){
+        const IxEnt *ea=a<nm?ix_ent(x,r,a):NULL,*eb=b<nt?ix_ent(x,r,o[b]):NULL;
+        if(ea&&(!eb||ix_kcmp(t,x,eb,ea)>=0)){ memcpy(ix_ent(x,nr,k),ea,sz); a++; }
+        else { memcpy(ix_ent(x,nr,k),eb,sz); b++; }
+    }
+    nr->nm=n; nr->nt=0; nr->cap=cap;
+    if(ret) retire(ret,r); else free(r);
+    ast(&x->run,nr);
+    free(o); return 0;
+}
+static void ix_put(const Table *t,const Index *x,IxRun *r,int j){
+    const Row *row=&t->rows[j]; IxEnt *e=ix_ent(x,r,r->nm+r->nt);
+    e->j=j; e->nul=0;
+    for(int k=0;k<x->nc;k++){
+        int ci=x->col[k]; e->c[k]=row->data[ci];
+        if(row->null[ci]) e->nul|=1u<<k;
+        else if(col_ovf(&t->cols[ci])&&e->c[k].in.n>CELL_INLINE) e->c[k].ov.pg->refs++;
+    }
+}
+/* Adds version j, filled but not yet published, to every index of t:
+   room is made in all of them first, so an OOM leaves none changed. */
+static int ix_note(Table *t,int j){
+    for(int i=0;i<t->nix;i++){
+        IxRun *r=t->ix[i]->run;
+        if(r->nm+r->nt>=r->cap&&ix_merge(t,t->ix[i],&t->ret)) return -1;
+    }
+    for(int i=0;i<t->nix;i++){
+        IxRun *r=t->ix[i]->run;
+        ix_put(t,t->ix[i],r,j); ast(&r->nt,r->nt+1);
+    }
+    return 0;
+}
+/* Drops x's entries; no reader may be on them (ddl held exclusively). */
+static void ix_clear(const Table *t,Index *x){
+    IxRun *r=x->run;
+    for(int i=0;r&&i<r->nm+r->nt;i++){
+        IxEnt *e=ix_ent(x,r,i);
+        for(int k=0;k<x->nc;k++) if(col_ovf(&t->cols[x->col[k]])) cell_drop(&e->c[k],NULL);
+    }
+    free(r); x->run=NULL;
+}
+static void ix_free(const Table *t,Index *x){ if(x){ ix_clear(t,x); free(x); } }
+/* Builds x from the current versions of t, for CREATE INDEX and loading:
+   with ddl held exclusively and no transaction open, no snapshot can see
+   a version that has an xmax. The new run replaces the old one only once
+   it is complete; -1 on OOM, x unchanged. */
+static int ix_build(Table *t,Index *x){
+    int n=0; IxRun *old=x->run,*nr;
+    for(int j=0;j<t->nrows;j++) n+=t->rows[j].xmin&&!t->rows[j].xmax;
+    IxRun *r=(IxRun*)malloc(sizeof(IxRun)+ix_stride(x)*(size_t)(n?n:1));
+    if(!r) return -1;
+    r->nm=r->nt=0; r->cap=n;
+    for(int j=0;j<t->nrows;j++) if(t->rows[j].xmin&&!t->rows[j].xmax){ ix_put(t,x,r,j); r->nt++; }
+    x->run=r;
+    if(ix_merge(t,x,NULL)){ ix_clear(t,x); x->run=old; return -1; }
+    nr=x->run; x->run=old; ix_clear(t,x); x->run=nr;
+    return 0;
+}
+/* After VACUUM moved version j of t to map[j] (-1: purged): drops the
+   purged versions' entries and renumbers the rest in place, which keeps
+   both parts of the run in order and cannot fail. */
+static void ix_compact(const Table *t,Index *x,const int *map){
+    IxRun *r=x->run; size_t sz=ix_stride(x); int k=0,nm=0;
+    for(int i=0;i<r->nm+r->nt;i++){
+        IxEnt *e=ix_ent(x,r,i);
+        if(map[e->j]<0){
+            for(int c=0;c<x->nc;c++) if(col_ovf(&t->cols[x->col[c]])) cell_drop(&e->c[c],NULL);
+            continue;
+        }
+        e->j=map[e->j];
+        if(k!=i) memmove(ix_ent(x,r,k),e,sz);
+        nm+=i<r->nm; k++;
+    }
+    r->nm=nm; r->nt=k-nm;
+}
+
+/* ── Statistics ─────────────────────────────────────────────── */
+static void hll_add(uint8_t *reg,uint64_t h){
+    uint64_t w=h<<HLL_BITS|1ull<<(HLL_BITS-1); uint8_t r=1;   /* the set bit bounds the loop */
+    while(!(w>>63)){ r++; w<<=1; }
+    uint8_t *g=&reg[h>>(64-HLL_BITS)]; if(r>*g) *g=r;
+}
+/* ln x for x >= 1, so the engine needs no libm. */
+static double ln_ge1(double x){
+    int k=0; while(x>=2){ x/=2; k++; }
+    double y=(x-1)/(x+1),y2=y*y,s=0,p=y;
+    for(int i=1;i<40;i+=2){ s+=p/i; p*=y2; }
+    return k*0.6931471805599453+2*s;
+}
+static double hll_count(const uint8_t *reg){
+    int m=1<<HLL_BITS,z=0; double s=0;
+    for(int i=0;i<m;i++){ s+=1.0/(double)(1ull<<reg[i]); z+=!reg[i]; }
+    double e=0.7213/(1+1.079/m)*m*m/s;
+    return e<=2.5*m&&z?m*ln_ge1((double)m/z):e;   /* linear counting while small */
+}
+typedef union { int64_t i; double f; const char *s; } SKey;
+static int skey_i(const void *a,const void *b){ int64_t x=((const SKey*)a)->i,y=((const SKey*)b)->i; return (x>y)-(x<y); }
+static int skey_f(const void *a,const void *b){ double x=((const SKey*)a)->f,y=((const SKey*)b)->f; return (x>y)-(x<y); }
+static int skey_s(const void *a,const void *b){ return strcasecmp(((const SKey*)a)->s,((const SKey*)b)->s); }
+/* Statistics of the rows visible to snap/tx. NULL counts and distinct
+   sketches see every row; histograms are cut from a reservoir sample of
+   STAT_SAMPLE rows so big tables sort a bounded amount. */
+static TStat *stat_build(const Table *t,uint64_t snap,uint64_t tx){
+    int n=ald(&t->nrows),ns=0; const Row *rows=ald(&t->rows);
+    TStat *st=(TStat*)calloc(1,sizeof(TStat));
+    int *smp=(int*)malloc(sizeof(int)*STAT_SAMPLE);
+    uint8_t *reg=(uint8_t*)calloc((size_t)t->ncols+1,(size_t)1<<HLL_BITS);
+    SKey *k=(SKey*)malloc(sizeof(SKey)*STAT_SAMPLE);
+    int64_t nulls[MAX_COLUMNS]={0};
+    if(!st||!smp||!reg||!k){ free(st); free(smp); free(reg); free(k); return NULL; }
+    uint64_t rs=0x9e3779b97f4a7c15ULL^(uint64_t)n; Val tmp;
+    for(int j=0;j<n;j++){
+        const Row *row=&rows[j];
+        if(!row_visible(row,snap,tx)) continue;
+        if(ns<STAT_SAMPLE) smp[ns]=j;
+        else { rs^=rs<<13; rs^=rs>>7; rs^=rs<<17; int64_t x=(int64_t)(rs%(uint64_t)(st->rows+1)); if(x<STAT_SAMPLE) smp[x]=j; }
+        ns+=ns<STAT_SAMPLE; st->rows++;
+        for(int c=0;c<t->ncols;c++){
+            if(row->null[c]){ nulls[c]++; continue; }
+            hll_add(reg+((size_t)c<<HLL_BITS),val_hash(col_val(t,row,c,&tmp),t->cols[c].type,0));
+        }
+    }
+    st->sampled=ns;
+    for(int c=0;c<t->ncols;c++){
+        CStat *cs=&st->c[c]; CType tp=t->cols[c].type; int nk=0;
+        int64_t nn=st->rows-nulls[c];
+        cs->nullfrac=st->rows?(double)nulls[c]/(double)st->rows:0;
+        cs->ndv=nn?hll_count(reg+((size_t)c<<HLL_BITS)):0;
+        if(cs->ndv>nn) cs->ndv=(double)nn;
+        if(nn&&cs->ndv<1) cs->ndv=1;
+        for(int i=0;i<ns;i++){
+            const Row *row=&rows[smp[i]]; if(row->null[c]) continue;
+            switch(tp){case T_INT:k[nk].i=row->data[c].i;break;
+                       case T_FLOAT:k[nk].f=row->data[c].f;break;
+                       case T_BOOL:k[nk].i=row->data[c].b!=0;break;
+                       default:k[nk].s=t->cols[c].dict?dict_str(&t->dict[c],row->data[c].i):cell_head(&row->data[c]);}
+            nk++;
+        }
+        if(!nk||tp==T_BLOB) continue;
+        qsort(k,(size_t)nk,sizeof(SKey),tp==T_TEXT?skey_s:tp==T_FLOAT?skey_f:skey_i);
+        cs->nb=nk<HIST_BUCKETS?nk:HIST_BUCKETS;
+        for(int b=0;b<=cs->nb;b++){
+            const SKey *x=&k[(int64_t)b*(nk-1)/cs->nb]; Val *v=&cs->b[b];
+            switch(tp){case T_INT:v->i=x->i;break; case T_FLOAT:v->f=x->f;break;
+                       case T_BOOL:v->b=(int8_t)x->i;break;
+                       default:snprintf(v->s,MAX_STR_LEN,"%s",x->s);}
+        }
+    }
+    free(smp); free(reg); free(k);
+    return st;
+}
+/* Fraction of a column's non-NULL values below v, read off the histogram
+   (interpolated inside a bucket for numbers). */
+static double hist_frac(const CStat *c,const Val *v,CType t){
+    if(!c->nb) return 0.5;
+    if(val_cmp(v,&c->b[0],t)<=0) return 0;
+    if(val_cmp(v,&c->b[c->nb],t)>0) return 1;
+    int b=0; while(b<c->nb-1&&val_cmp(v,&c->b[b+1],t)>0) b++;
+    double lo=0,hi=0,x=0.5;
+    if(t==T_INT){ lo=(double)c->b[b].i; hi=(double)c->b[b+1].i; x=(double)v->i; }
+    else if(t==T_FLOAT){ lo=c->b[b].f; hi=c->b[b+1].f; x=v->f; }
+    double in=t==T_INT||t==T_FLOAT?(hi>lo?(x-lo)/(hi-lo):0.5):0.5;
+    return (b+in)/c->nb;
+}
+
+/* ── DB I/O ─────────────────────────────────────────────────── */
+static Table *find_tbl(DB *db,const char *n){
+    for(int i=0;i<db->hdr.ntables;i++)
+        if(!strcasecmp(db->tbl[i].name,n)) return &db->tbl[i];
+    return NULL;
+}
+static int col_idx(const Table *t,const char *n){
+    for(int j=0;j<t->ncols;j++) if(!strcasecmp(t->cols[j].name,n)) return j;
+    return -1;
+}
+/* Columns SELECT * and DESCRIBE show: a materialized view's "#" state
+   columns come after them. */
+static int tbl_vcols(const Table *t){
+    int n=0; while(n<t->ncols&&t->cols[n].name[0]!='#') n++;
+    return n;
+}
+/* File layout: DBHdr and its CRC32C; per table a meta block with the
+   header fields, partition bounds and view definition, one block per ZONE_ROWS rows holding
+   the encoded rows and that block's zone stats, and a block with the DICT
+   column dictionaries; then DB_END_MAGIC. Every section is covered by a
+   checksum. */
+/* Writes t as snapshot snap sees it. Table arrays are read the way scans
+   read them, so a BACKUP can run beside writers (see do_backup); its zone
+   maps are rebuilt from the rows it writes, since writers widen the live
+   ones in place. With since set only the row blocks changed after that
+   snapshot are written, behind the map of which ones they are (DltHdr). */
+static int save_tbl(Fw *w,Table *t,Buf *raw,Buf *tmp,uint64_t snap,uint64_t since){
+    int n=ald(&t->nrows),nid=ald(&t->next_id),own=snap!=SNAP_LATEST;
+    const Row *rows=ald(&t->rows); const Zone *zs=ald(&t->zones);
+    int nb=(n+ZONE_ROWS-1)/ZONE_ROWS;
+    Zone *oz=own?(Zone*)malloc(sizeof(Zone)+(since?(size_t)nb:0)):NULL;
+    uint8_t *chg=oz&&since?(uint8_t*)(oz+1):NULL;
+    if(own&&!oz) return -1;
+    raw->n=0;
+    buf_put(raw,t->name,MAX_NAME_LEN);
+    buf_put(raw,&t->ncols,sizeof(int));
+    buf_put(raw,t->cols,sizeof(Col)*t->ncols);
+    buf_put(raw,&n,sizeof(int));
+    buf_put(raw,&nid,sizeof(int));
+    const Part *pt=t->part; int8_t hp=pt!=NULL;
+    buf_put(raw,&hp,1);
+    if(pt){
+        buf_put(raw,&pt->key,sizeof(int)); buf_put(raw,&pt->n,sizeof(int));
+        for(int i=0;i<pt->n;i++){
+            buf_put(raw,pt->pn[i],MAX_NAME_LEN); buf_put(raw,&pt->max[i],1);
+            if(!pt->max[i]) enc_val(raw,&pt->hi[i],t->cols[pt->key].type);
+        }
+    }
+    int8_t hv=t->mvsql!=NULL;
+    buf_put(raw,&hv,1);
+    if(hv){ size_t l=strlen(t->mvsql); buf_uv(raw,l); buf_put(raw,t->mvsql,l); }
+    int8_t nx=(int8_t)t->nix;   /* index definitions; the entries are rebuilt on loading */
+    buf_put(raw,&nx,1);
+    for(int i=0;i<t->nix;i++){
+        const Index *x=t->ix[i];
+        buf_put(raw,x->name,MAX_NAME_LEN); buf_put(raw,&x->nc,sizeof(int)); buf_put(raw,x->col,sizeof(int)*(size_t)x->nc);
+    }
+    /* inserts reserve a row's zone before publishing it */
+    if(raw->err||blk_write(w,raw,tmp)||(nb&&(!own||since)&&!zs)){ free(oz); return -1; }
+    if(chg){
+        /* taken once: a commit may restamp a block while it is written */
+        int re=ald(&t->relsn)>since;
+        for(int b=0;b<nb;b++) chg[b]=(uint8_t)(re||ald(&zs[b].lsn)>since);
+        raw->n=0; buf_put(raw,chg,(size_t)nb);
+        if(raw->err||blk_write(w,raw,tmp)){ free(oz); return -1; }
+    }
+    for(int b=0;b<nb;b++){
+        if(chg&&!chg[b]) continue;
+        const Zone *z=own?oz:&zs[b];
+        if(own) memset(oz,0,sizeof(Zone));
+        raw->n=0;
+        int hi=(b+1)*ZONE_ROWS<n?(b+1)*ZONE_ROWS:n;
+        for(int j=b*ZONE_ROWS;j<hi;j++){
+            /* Only what snap sees is written: newer or uncommitted inserts
+               are dead slots here, such deletes still live rows. */
+            const Row *row=&rows[j];
+            int8_t del=!row_visible(row,snap,0);
+            buf_put(raw,&del,1);
+            if(del) continue;   /* dead versions keep their slot only */
+            buf_put(raw,row->null,t->ncols);
+            for(int c=0;c<t->ncols;c++)
+                if(!row->null[c]) enc_cell(raw,&row->data[c],&t->cols[c]);
+            if(own) zone_fold(t,oz,row,NULL);
+        }
+        for(int c=0;c<t->ncols;c++){
+            const ZCol *zc=&z->c[c]; uint8_t zf=(uint8_t)(zc->has|zc->open<<1);
+            buf_put(raw,&zf,1); buf_put(raw,&zc->nnull,sizeof(int32_t));
+            if(zc->has){ enc_val(raw,&zc->mn,col_stype(&t->cols[c])); enc_val(raw,&zc->mx,col_stype(&t->cols[c])); }
+        }
+        if(raw->err||blk_write(w,raw,tmp)){ free(oz); return -1; }
+    }
+    free(oz);
+    raw->n=0;
+    for(int c=0;c<t->ncols;c++){
+        if(!t->cols[c].dict) continue;
+        Dict *d=&t->dict[c]; int dn=ald(&d->n); char **ds=ald(&d->s);
+        buf_put(raw,&dn,sizeof(int));
+        for(int k=0;k<dn;k++){ size_t l=strlen(ds[k]); buf_uv(raw,l); buf_put(raw,ds[k],l); }
+    }
+    const TStat *st=ald(&t->stats); int8_t hs=st!=NULL;
+    buf_put(raw,&hs,1);
+    if(st){
+        buf_put(raw,&st->rows,8); buf_put(raw,&st->sampled,8);
+        for(int c=0;c<t->ncols;c++){
+            const CStat *cs=&st->c[c];
+            buf_put(raw,&cs->nullfrac,8); buf_put(raw,&cs->ndv,8); buf_put(raw,&cs->nb,sizeof(int));
+            for(int b=0;b<=cs->nb&&cs->nb;b++) enc_val(raw,&cs->b[b],t->cols[c].type);
+        }
+    }
+    return raw->err?-1:blk_write(w,raw,tmp);
+}
+static void fsync_dir(const char *path){
+#if !defined(_WIN32)
+    char d[512]; snprintf(d,sizeof(d),"%s",path);
+    char *s=strrchr(d,'/'); if(s) *(s==d?s+1:s)=0; else strcpy(d,".");
+    int fd=open(d,O_RDONLY); if(fd>=0){fsync(fd);close(fd);}
+#else
+    (void)path;
+#endif
+}
+/* Checkpoints are written to <file>.tmp, flushed to stable storage and
+   renamed over the live file, so a crash leaves either the old image or
+   the new one, never a mix. */
+/* Records a checkpoint of changes up to upto (see db_durable), called
+   under wlock. A failed one leaves them dirty and restarts the
+   checkpointer's delay, so a full disk is retried at that pace rather
+   than in a loop. A BGSAVE image may cover less than was committed since. */
+static void ck_done(DB *db,uint64_t upto,int ok){
+    mtx_lock(&db->ckl);
+    if(ok&&upto>db->sseq) db->sseq=upto;
+    if(upto>db->ckat) db->ckat=upto;
+#ifdef HAVE_THREADS
+    if(!ok) clock_gettime(CLOCK_REALTIME,&db->dirty_at);
+    if(upto==db->dseq) db->ckwait=0;
+    pthread_cond_broadcast(&db->ckdone);
+#endif
+    mtx_unlock(&db->ckl);
+}
+/* Writes a complete image to path and fsyncs it: the tables of hdr as
+   snapshot snap sees them (SNAP_LATEST: everything committed), at most
+   rate bytes/s if rate is set. Callers hold wlock, are the BGSAVE child,
+   which has the process to itself, or a BACKUP holding snap. With since
+   set it is instead the delta since that snapshot against the backup
+   whose checksum is base. sum, if given, receives the file's checksum. */
+static int save_image(DB *db,Io *io,const char *path,const DBHdr *hdr,uint64_t snap,double rate,
+                      uint64_t since,uint32_t base,uint32_t *sum){
+    DltHdr d; memset(&d,0,sizeof(d));
+    d.magic=DLT_MAGIC; d.version=DB_VERSION; d.base=base; d.db=*hdr; d.db.version=DB_VERSION;
+    const void *h=since?(const void*)&d:(const void*)&d.db; size_t hn=since?sizeof(d):sizeof(DBHdr);
+    uint32_t crc=crc32c(0,h,hn),end=DB_END_MAGIC;
+    Buf raw={0},tmp={0}; int rc;
+    /* -2: the io_uring ring failed mid-way and is gone; write it again. */
+    for(int a=0;a<2;a++){
+        Fw w; rc=fw_open(io,&w,path); w.rate=rate; w.sum=sum!=NULL;
+        if(!rc){
+            fw_put(&w,h,hn); fw_put(&w,&crc,sizeof(crc));
+            for(int i=0;i<d.db.ntables&&!w.err;i++) save_tbl(&w,&db->tbl[i],&raw,&tmp,snap,since);
+            if(raw.err||tmp.err) w.err=1;
+            fw_put(&w,&end,sizeof(end));
+        }
+        if(sum) *sum=w.crc;
+        rc=w.fd<0?-1:fw_close(&w);
+        if(rc) remove(path);
+        if(rc!=-2) break;
+    }
+    free(raw.p); free(tmp.p);
+    return rc?-1:0;
+}
+static int save_db(DB *db){
+    char tmpn[sizeof(db->file)+8]; snprintf(tmpn,sizeof(tmpn),"%s.tmp",db->file);
+    uint64_t upto=db->dseq;   /* stable: commits hold wlock, as does every caller */
+    int rc=save_image(db,&db->io,tmpn,&db->hdr,SNAP_LATEST,0,0,0,NULL);
+    if(!rc&&replace_file(tmpn,db->file)){ remove(tmpn); rc=-1; }
+    if(!rc) fsync_dir(db->file);
+    ck_done(db,upto,!rc);
+    return rc;
+}
+static int load_tbl_hdr(FILE *f,Table *t){
+    if(!fread(t->name,MAX_NAME_LEN,1,f)) return -1;
+    if(!fread(&t->ncols,sizeof(int),1,f)||t->ncols<0||t->ncols>MAX_COLUMNS) return -1;
+    if(!fread(t->cols,sizeof(Col)*t->ncols,1,f)) return -1;
+    if(!fread(&t->nrows,sizeof(int),1,f)||t->nrows<0) return -1;
+    if(!fread(&t->next_id,sizeof(int),1,f)) return -1;
+    t->cap=t->nrows>0?t->nrows*2:16;
+    t->rows=(Row*)calloc(t->cap,sizeof(Row));
+    return t->rows?0:-3;
+}
+static int load_tbl(FILE *f,Table *t,uint32_t ver,Buf *raw,Buf *tmp){
+    int rc;
+    if(ver>=5){
+        if(blk_read(f,raw,tmp)) return -3;
+        Rd rd={raw->p,raw->n,0,0};
+        rd_get(&rd,t->name,MAX_NAME_LEN); rd_get(&rd,&t->ncols,sizeof(int));
+        if(rd.err||t->ncols<0||t->ncols>MAX_COLUMNS) return -3;
+        rd_get(&rd,t->cols,sizeof(Col)*t->ncols);
+        rd_get(&rd,&t->nrows,sizeof(int)); rd_get(&rd,&t->next_id,sizeof(int));
+        if(rd.err||t->nrows<0) return -3;
+        int8_t hp=0;
+        if(ver>=8) rd_get(&rd,&hp,1);
+        if(hp){
+            Part *pt=t->part=(Part*)calloc(1,sizeof(Part)); if(!pt) return -3;
+            rd_get(&rd,&pt->key,sizeof(int)); rd_get(&rd,&pt->n,sizeof(int));
+            if(rd.err||pt->key<0||pt->key>=t->ncols||pt->n<0||pt->n>MAX_PARTS) return -3;
+            for(int i=0;i<pt->n&&!rd.err;i++){
+                rd_get(&rd,pt->pn[i],MAX_NAME_LEN); rd_get(&rd,&pt->max[i],1);
+                if(!pt->max[i]) dec_val(&rd,&pt->hi[i],t->cols[pt->key].type);
+                pt->pn[i][MAX_NAME_LEN-1]=0;
+            }
+            if(rd.err) return -3;
+        }
+        int8_t hv=0;
+        if(ver>=9) rd_get(&rd,&hv,1);
+        if(hv){
+            uint64_t l=rd_uv(&rd);
+            if(rd.err||l>rd.n-rd.o||l>=MAX_SQL_LEN||!(t->mvsql=(char*)malloc((size_t)l+1))) return -3;
+            rd_get(&rd,t->mvsql,(size_t)l); t->mvsql[l]=0;
+        }
+        int8_t nx=0;
+        if(ver>=10) rd_get(&rd,&nx,1);
+        if(rd.err||nx<0||nx>MAX_INDEXES) return -3;
+        while(t->nix<nx){
+            Index *x=t->ix[t->nix++]=(Index*)calloc(1,sizeof(Index)); if(!x) return -3;
+            rd_get(&rd,x->name,MAX_NAME_LEN); rd_get(&rd,&x->nc,sizeof(int)); x->name[MAX_NAME_LEN-1]=0;
+            if(rd.err||x->nc<1||x->nc>t->ncols) return -3;
+            rd_get(&rd,x->col,sizeof(int)*(size_t)x->nc);
+            for(int k=0;k<x->nc;k++) if(x->col[k]<0||x->col[k]>=t->ncols) return -3;
+        }
+        t->cap=t->nrows>0?t->nrows*2:16;
+        if(!(t->rows=(Row*)calloc(t->cap,sizeof(Row)))) return -3;
+    } else if((rc=load_tbl_hdr(f,t))) return rc;
+    int nb=(t->nrows+ZONE_ROWS-1)/ZONE_ROWS;
+    if(zone_reserve(t,nb)) return -3;
+    for(int b=0;b<nb;b++){
+        if(blk_read(f,raw,tmp)) return -3;
+        Rd rd={raw->p,raw->n,0,0};
+        int hi=(b+1)*ZONE_ROWS<t->nrows?(b+1)*ZONE_ROWS:t->nrows;
+        for(int j=b*ZONE_ROWS;j<hi;j++){
+            Row *row=&t->rows[j]; int8_t del=0;
+            rd_get(&rd,&del,1);
+            row->xmin=1;
+            if(del){ row->xmax=1; memset(row->null,1,sizeof(row->null)); continue; }
+            rd_get(&rd,row->null,t->ncols);
+            for(int c=0;c<t->ncols&&!rd.err;c++){
+                if(row->null[c]) continue;
+                if(ver>=7){ dec_cell(&rd,&row->data[c],&t->cols[c]); continue; }
+                Val v; dec_val(&rd,&v,col_stype(&t->cols[c]));
+                if(cell_from(&row->data[c],&v,&t->cols[c])) return -3;
+            }
+        }
+        for(int c=0;c<t->ncols;c++){
+            ZCol *zc=&t->zones[b].c[c]; uint8_t zf=0;
+            rd_get(&rd,&zf,1); rd_get(&rd,&zc->nnull,sizeof(int32_t));
+            zc->has=zf&1; zc->open=zf>>1&1;
+            if(zc->has){ dec_val(&rd,&zc->mn,col_stype(&t->cols[c])); dec_val(&rd,&zc->mx,col_stype(&t->cols[c])); }
+        }
+        if(rd.err) return -3;
+    }
+    if(blk_read(f,raw,tmp)) return -3;
+    Rd rd={raw->p,raw->n,0,0};
+    for(int c=0;c<t->ncols;c++){
+        if(!t->cols[c].dict) continue;
+        int n=0; char sb[MAX_STR_LEN],*s;
+        rd_get(&rd,&n,sizeof(int));
+        for(int k=0;k<n&&!rd.err;k++){
+            uint64_t l=0;
+            if(ver>=7) l=rd_uv(&rd); else { uint8_t l8=0; rd_get(&rd,&l8,1); l=l8; }
+            if(rd.err||l>rd.n-rd.o) return -3;
+            if(!(s=l<sizeof(sb)?sb:(char*)malloc((size_t)l+1))) return -3;
+            rd_get(&rd,s,(size_t)l); s[l]=0;
+            int rc=dict_add(&t->dict[c],s,NULL);
+            if(s!=sb) free(s);
+            if(rc!=k) return -3;
+        }
+    }
+    int8_t hs=0;
+    if(ver>=6) rd_get(&rd,&hs,1);
+    if(hs&&!rd.err){
+        TStat *st=t->stats=(TStat*)calloc(1,sizeof(TStat)); if(!st) return -3;
+        rd_get(&rd,&st->rows,8); rd_get(&rd,&st->sampled,8);
+        for(int c=0;c<t->ncols&&!rd.err;c++){
+            CStat *cs=&st->c[c];
+            rd_get(&rd,&cs->nullfrac,8); rd_get(&rd,&cs->ndv,8); rd_get(&rd,&cs->nb,sizeof(int));
+            if(cs->nb<0||cs->nb>HIST_BUCKETS) return -3;
+            for(int b=0;b<=cs->nb&&cs->nb;b++) dec_val(&rd,&cs->b[b],t->cols[c].type);
+        }
+    }
+    for(int i=0;i<t->nix&&!rd.err;i++) if(ix_build(t,t->ix[i])) return -3;
+    return rd.err?-3:0;
+}
+/* Versions 1-3 stored raw Row and ZCol structs. */
+static int load_tbl_v3(FILE *f,Table *t,uint32_t ver){
+    int rc=load_tbl_hdr(f,t); if(rc) return rc;
+    RowV3 old;
+    for(int j=0;j<t->nrows;j++){
+        if(!fread(&old,sizeof(RowV3),1,f)) break;
+        Row *row=&t->rows[j];
+        memcpy(row->null,old.null,sizeof(row->null));
+        row->xmin=1; row->xmax=old.del?1:0;
+        for(int c=0;c<t->ncols;c++)
+            if(!row->null[c]&&cell_from(&row->data[c],&old.data[c],&t->cols[c])) return -3;
+    }
+    int nz=0,ok=ver>=2&&fread(&nz,sizeof(int),1,f)==1&&
+                nz==(t->nrows+ZONE_ROWS-1)/ZONE_ROWS&&!zone_reserve(t,nz);
+    for(int b=0;ok&&b<nz;b++){
+        ok=fread(t->zones[b].c,sizeof(ZCol)*t->ncols,1,f)==1;
+        for(int c=0;c<t->ncols;c++) t->zones[b].c[c].open=0;   /* was struct padding */
+    }
+    if(!ok&&zone_rebuild(t)) return -3;
+    for(int c=0;c<t->ncols;c++){
+        if(!t->cols[c].dict) continue;
+        int n=0; char sb[MAX_STR_LEN]; uint16_t l;
+        if(ver<3||fread(&n,sizeof(int),1,f)!=1) return -3;
+        for(int k=0;k<n;k++){
+            if(fread(&l,sizeof(l),1,f)!=1||l>=MAX_STR_LEN||fread(sb,1,l,f)!=l) return -3;
+            sb[l]=0;
+            if(dict_add(&t->dict[c],sb,NULL)!=k) return -3;
+        }
+    }
+    return 0;
+}
+static int mv_compile(DB *db,Table *v,Res *r,uint64_t ts);
+static int load_db(DB *db){
+    FILE *f=fopen(db->file,"rb"); if(!f) return -1;
+    if(fread(&db->hdr,sizeof(DBHdr),1,f)!=1){fclose(f);return -1;}
+    if(db->hdr.magic!=DB_MAGIC||db->hdr.version>DB_VERSION){fclose(f);return -2;}
+    uint32_t ver=db->hdr.version,crc,end=0;
+    if(ver>=5&&(fread(&crc,sizeof(crc),1,f)!=1||crc!=crc32c(0,&db->hdr,sizeof(DBHdr))||
+                db->hdr.ntables<0||db->hdr.ntables>MAX_TABLES)){fclose(f);return -2;}
+    Buf raw={0},tmp={0}; int rc=0;
+    for(int i=0;i<db->hdr.ntables;i++){
+        Table *t=&db->tbl[i];
+        rc=ver>=4?load_tbl(f,t,ver,&raw,&tmp):load_tbl_v3(f,t,ver);
+        if(rc==-1&&ver<5){rc=0;db->hdr.ntables=i;break;}
+        if(rc){rc=-3;break;}
+    }
+    /* A checkpoint is only valid if it runs to its end marker. */
+    if(!rc&&ver>=5&&(fread(&end,sizeof(end),1,f)!=1||end!=DB_END_MAGIC)) rc=-3;
+    Res r; memset(&r,0,sizeof(r));
+    for(int i=0;!rc&&i<db->hdr.ntables;i++) if(db->tbl[i].mvsql&&mv_compile(db,&db->tbl[i],&r,1)) rc=-3;
+    res_reset(&r);
+    free(raw.p); free(tmp.p);
+    fclose(f); return rc;
+}
+static void mv_free(struct MView *m);
+static void free_tables(DB *db,int n){
+    for(int i=0;i<n;i++){
+        Table *t=&db->tbl[i];
+        for(int j=0;t->rows&&j<t->nrows;j++) row_drop(t,&t->rows[j],NULL);
+        free(t->rows); free(t->zones); free(t->stats); free(t->part); free(t->mvsql); mv_free(t->mv);
+        for(int k=0;k<t->nix;k++) ix_free(t,t->ix[k]);
+        for(int c=0;c<MAX_COLUMNS;c++) dict_free(&t->dict[c]);
+        ret_free(&t->ret,UINT64_MAX);
+    }
+}
+static DB *open_db(const char *fn){
+    DB *db=(DB*)calloc(1,sizeof(DB)); if(!db) return NULL;
+    strncpy(db->file,fn,sizeof(db->file)-1);
+    int rc=load_db(db);
+    if(rc<-1){
+        /* The file exists but is damaged: refuse rather than overwrite it. */
+        free_tables(db,MAX_TABLES); free(db); return NULL;
+    }
+    db->clock=1;   /* everything loaded is version 1 */
+    mtx_init(&db->wlock); rw_init(&db->ddl); mtx_init(&db->pcl); mtx_init(&db->ckl);
+#ifdef HAVE_THREADS
+    pthread_cond_init(&db->ckc,NULL); pthread_cond_init(&db->ckdone,NULL);
+#endif
+    db->dur=DUR_SYNC; db->group_ms=GROUP_MS; db->async_ms=ASYNC_MS;
+    if(rc==0) return db;
+    memset(&db->hdr,0,sizeof(db->hdr));
+    db->hdr.magic=DB_MAGIC; db->hdr.version=DB_VERSION;
+    const char *b=strrchr(fn,'/'); b=b?b+1:fn;
+    strncpy(db->hdr.name,b,MAX_NAME_LEN-1);
+    char *d=strrchr(db->hdr.name,'.'); if(d)*d=0;
+    time_t now=time(NULL); struct tm *tm=localtime(&now);
+    strftime(db->hdr.created,32,"%Y-%m-%d %H:%M:%S",tm);
+    return db;
+}
+static void pc_clear(DB *db);
+static void ck_stop(DB *db);
+static void close_db(DB *db){
+    if(!db) return;
+    ck_stop(db); save_db(db);
+    free_tables(db,db->hdr.ntables);
+    pc_clear(db); io_free(&db->io);
+    mtx_free(&db->wlock); rw_free(&db->ddl); mtx_free(&db->pcl); mtx_free(&db->ckl);
+#ifdef HAVE_THREADS
+    pthread_cond_destroy(&db->ckc); pthread_cond_destroy(&db->ckdone);
+#endif
+    free(db);
+}
+
+/* ── Durability ─────────────────────────────────────────────── */
+/* A commit is made durable according to its level. SYNC writes the
+   checkpoint before the statement returns. GROUP hands the change to the
+   checkpointer thread and waits until a checkpoint covers it, so commits
+   arriving within group_ms share one file write and fsync. ASYNC returns
+   at once; the checkpointer writes within async_ms and a crash may lose
+   what it had not written yet. Any checkpoint (a SYNC commit, DDL) covers
+   everything committed before it. Without threads every level is SYNC. */
+static const char *const dur_name[]={"","SYNC","GROUP","ASYNC"};
+
+#ifdef HAVE_THREADS
+static void ts_add_ms(struct timespec *t,int ms){
+    t->tv_sec+=ms/1000; t->tv_nsec+=(long)(ms%1000)*1000000L;
+    if(t->tv_nsec>=1000000000L){ t->tv_sec++; t->tv_nsec-=1000000000L; }
+}
+static void *ck_main(void *arg){
+    DB *db=(DB*)arg;
+    mtx_lock(&db->ckl);
+    while(!db->ckstop){
+        if(db->sseq==db->dseq){ pthread_cond_wait(&db->ckc,&db->ckl); continue; }
+        struct timespec due=db->dirty_at,now; ts_add_ms(&due,db->ckwait?db->group_ms:db->async_ms);
+        clock_gettime(CLOCK_REALTIME,&now);
+        if(now.tv_sec<due.tv_sec||(now.tv_sec==due.tv_sec&&now.tv_nsec<due.tv_nsec)){
+            pthread_cond_timedwait(&db->ckc,&db->ckl,&due); continue;
+        }
+        mtx_unlock(&db->ckl);
+        rw_rdlock(&db->ddl); mtx_lock(&db->wlock);
+        if(db->sseq!=db->dseq) save_db(db);
+        mtx_unlock(&db->wlock); rw_unlock(&db->ddl);
+        mtx_lock(&db->ckl);
+    }
+    mtx_unlock(&db->ckl);
+    return NULL;
+}
+#endif
+/* Called under wlock once a commit's versions are stamped. Returns what
+   ck_wait must wait for after the locks are released: the change's
+   number for GROUP, else 0. */
+static uint64_t db_durable(DB *db,const Sess *s){
+    mtx_lock(&db->ckl);
+    int lv=s&&s->dur?s->dur:db->dur;
+#ifdef HAVE_THREADS
+    if(db->sseq==db->dseq) clock_gettime(CLOCK_REALTIME,&db->dirty_at);
+    uint64_t seq=++db->dseq;
+    if(lv!=DUR_SYNC&&!db->ckrun) db->ckrun=pthread_create(&db->ckth,NULL,ck_main,db)==0;
+    if(lv!=DUR_SYNC&&db->ckrun){
+        if(lv==DUR_GROUP) db->ckwait++;
+        pthread_cond_signal(&db->ckc); mtx_unlock(&db->ckl);
+        return lv==DUR_GROUP?seq:0;
+    }
+#else
+    (void)lv; db->dseq++;
+#endif
+    mtx_unlock(&db->ckl);
+    save_db(db); return 0;
+}
+static void ck_wait(DB *db,uint64_t seq){
+#ifdef HAVE_THREADS
+    if(!seq) return;
+    mtx_lock(&db->ckl);
+    while(db->ckat<seq) pthread_cond_wait(&db->ckdone,&db->ckl);
+    mtx_unlock(&db->ckl);
+#else
+    (void)db; (void)seq;
+#endif
+}
+/* Stops the checkpointer, leaving dirty what it had not written yet, and
+   waits for a BGSAVE in progress. */
+static void ck_stop(DB *db){
+#ifdef HAVE_THREADS
+    mtx_lock(&db->ckl); db->ckstop=1; pthread_cond_signal(&db->ckc); mtx_unlock(&db->ckl);
+    if(db->ckrun) pthread_join(db->ckth,NULL);
+    db->ckrun=0;
+    if(db->bgst) pthread_join(db->bgth,NULL);
+    db->bgst=0;
+    if(db->frun){ ast(&db->fstop,1); pthread_join(db->fth,NULL); db->frun=0; }
+#else
+    (void)db;
+#endif
+}
+
+/* BGSAVE forks while holding wlock, so the child starts from a copy of
+   exactly the committed state, and writes it to <file>.bg.tmp while the
+   parent goes on serving statements; the kernel copies only the pages the
+   parent changes meanwhile. A thread of the parent waits for the child
+   and renames the image over the file, unless a checkpoint taken since
+   the fork already holds newer data. The child has the forking thread
+   only, so it writes with pwrite and takes no lock. */
+#ifdef HAVE_THREADS
+static void bg_name(const DB *db,char *o,size_t n){ snprintf(o,n,"%s.bg.tmp",db->file); }
+static void *bg_main(void *arg){
+    DB *db=(DB*)arg; int st=0; char tmpn[sizeof(db->file)+8]; bg_name(db,tmpn,sizeof(tmpn));
+    while(waitpid(db->bgpid,&st,0)<0&&errno==EINTR) {}
+    int ok=WIFEXITED(st)&&WEXITSTATUS(st)==0;
+    rw_rdlock(&db->ddl); mtx_lock(&db->wlock);
+    if(ok&&db->sseq<db->bgupto){
+        ok=!replace_file(tmpn,db->file);
+        if(ok){ fsync_dir(db->file); ck_done(db,db->bgupto,1); }
+    }
+    remove(tmpn);
+    mtx_lock(&db->ckl); db->bgst=ok?2:3; mtx_unlock(&db->ckl);
+    mtx_unlock(&db->wlock); rw_unlock(&db->ddl);
+    return NULL;
+}
+#endif
+static void do_bgsave(DB *db,Res *r){
+#ifdef HAVE_THREADS
+    mtx_lock(&db->ckl); int st=db->bgst; if(st!=1) db->bgst=1; mtx_unlock(&db->ckl);
+    if(st==1){res_err(r,"A background save is already running");return;}
+    if(st) pthread_join(db->bgth,NULL);
+    char tmpn[sizeof(db->file)+8]; bg_name(db,tmpn,sizeof(tmpn));
+    rw_rdlock(&db->ddl); mtx_lock(&db->wlock);
+    pid_t pid=fork();
+    if(!pid){ db->io.state=-1; _exit(save_image(db,&db->io,tmpn,&db->hdr,SNAP_LATEST,0,0,0,NULL)?1:0); }
+    db->bgpid=pid; db->bgupto=db->dseq;
+    int ok=pid>0&&!pthread_create(&db->bgth,NULL,bg_main,db);
+    if(pid>0&&!ok) while(waitpid(pid,NULL,0)<0&&errno==EINTR) {}
+    mtx_unlock(&db->wlock); rw_unlock(&db->ddl);
+    if(!ok){
+        remove(tmpn);
+        mtx_lock(&db->ckl); db->bgst=0; mtx_unlock(&db->ckl);
+        res_err(r,"Cannot start a background save"); return;
+    }
+    res_ok(r,"Background save started",0);
+#else
+    (void)db; res_err(r,"BGSAVE is not available on this platform");
+#endif
+}
+
+/* ── Follower ───────────────────────────────────────────────── */
+/* A follower serves reads from the primary's checkpoints: every
+   checkpoint is a complete image renamed into place, so whenever the
+   primary's file changes the follower loads the new image aside, then
+   swaps it in under ddl exclusively, between statements and once no
+   transaction or BACKUP holds a snapshot. Writes are refused. Its own
+   file keeps the last image applied, saved on close. */
+#ifdef HAVE_THREADS
+static int st_same(const struct stat *a,const struct stat *b){
+    return a->st_dev==b->st_dev&&a->st_ino==b->st_ino&&a->st_size==b->st_size&&
+           a->st_mtim.tv_sec==b->st_mtim.tv_sec&&a->st_mtim.tv_nsec==b->st_mtim.tv_nsec;
+}
+static double st_age(const struct stat *st){
+    struct timespec now; clock_gettime(CLOCK_REALTIME,&now);
+    double a=(double)(now.tv_sec-st->st_mtim.tv_sec)+(now.tv_nsec-st->st_mtim.tv_nsec)*1e-9;
+    return a>0?a:0;
+}
+#endif
+/* SHOW REPLICATION: on a follower, the primary's file, the images applied,
+   the current lag (how long the newest image has waited unapplied, 0 when
+   it is applied) and how old the last one was when it was applied. */
+static void do_replication(DB *db,Res *r){
+    if(!*db->follow){res_err(r,"This database is not a follower");return;}
+#ifdef HAVE_THREADS
+    const char *cn[]={"Primary","Images","LagMs","LastApplyLagMs"};
+    CType ct[]={T_TEXT,T_INT,T_FLOAT,T_FLOAT};
+    char v[4][MAX_STR_LEN]; struct stat st;
+    int fresh=!stat(db->follow,&st);
+    mtx_lock(&db->ckl);
+    double lag=fresh&&!st_same(&st,&db->fid)?st_age(&st):0;
+    snprintf(v[0],MAX_STR_LEN,"%.255s",db->follow); snprintf(v[1],MAX_STR_LEN,"%llu",(unsigned long long)db->fn);
+    snprintf(v[2],MAX_STR_LEN,"%.1f",lag*1e3); snprintf(v[3],MAX_STR_LEN,"%.1f",db->flag*1e3);
+    mtx_unlock(&db->ckl);
+    r->ok=1; r->ncols=4;
+    for(int j=0;j<4;j++){strcpy(r->cname[j],cn[j]);r->ctype[j]=ct[j];}
+    res_addrow(r,v,4);
+    snprintf(r->msg,sizeof(r->msg),"REPLICATION: %s",lag>0?"behind":"up to date");
+#endif
+}
+
+/* ── WHERE ──────────────────────────────────────────────────── */
+typedef struct { char col[MAX_NAME_LEN],op[4],val[MAX_STR_LEN]; int isnull,nullexp; } Cond;
+
+/* A WHERE clause is a conjunction of up to MAX_CONDS conditions. */
+typedef struct { int n; Cond c[MAX_CONDS]; } Where;
+/* Literals sql_norm lifted out of a statement, whole, into buf. A literal
+   in a cached plan that reads exactly "?N" stands for v[N]; pa is NULL when
+   none were. */
+typedef struct { int n; const char *v[MAX_PARAMS]; char buf[MAX_SQL_LEN]; } Params;
+static const char *pval(const char *s,const Params *pa){
+    if(!pa||s[0]!='?') return s;
+    char *e; long i=strtol(s+1,&e,10);
+    return e>s+1&&!*e&&i>=0&&i<pa->n?pa->v[i]:s;
+}
+
+
+/* Conditions compiled against a table: column resolved to an ordinal and the
+   literal converted once, instead of per row. */
+enum { OP_EQ, OP_NE, OP_LT, OP_GT, OP_LE, OP_GE };
+/* On a DICT column the condition is evaluated once per distinct string at
+   compile time: dm[code] says whether that code passes, and [dlo,dhi] bound
+   the passing codes for zone skipping. Codes added after compilation (by the
+   running UPDATE) fall back to comparing the decoded string. */
+/* TEXT and BLOB literals are also kept whole in cs/cn (BLOB decoded into
+   own); big says cv, cut to a Val, must not be used to skip blocks. */
+typedef struct {
+    int ci; CType tp; int8_t op,isnull,nullexp,big; Val cv;
+    const char *cs; size_t cn; char *own;
+    const Dict *d; uint8_t *dm; int dn,dlo,dhi;
+    double sel;     /* estimated pass fraction, -1 without ANALYZE */
+} Pred;
+/* A compiled filter also pins the table view a scan runs over: the row
+   count, arrays and snapshot are read once so rows appended meanwhile by
+   a writer are neither scanned nor able to move the arrays underneath. */
+typedef struct {
+    int n; Pred p[MAX_CONDS];
+    uint64_t snap,tx; Table *t; Row *rows; const Zone *zones; int nrows;
+} Filter;
+
+static int op_test(int op,int cmp){
+    switch(op){case OP_EQ:return cmp==0; case OP_NE:return cmp!=0;
+               case OP_LT:return cmp<0;  case OP_GT:return cmp>0;
+               case OP_LE:return cmp<=0; case OP_GE:return cmp>=0;}
+    return 0;
+}
+
+/* Estimated fraction of all rows passing p. */
+static double pred_sel(const TStat *st,const Pred *p){
+    if(p->ci<0) return 0;
+    const CStat *c=&st->c[p->ci]; double nn=1-c->nullfrac,d=c->ndv<1?1:c->ndv,x;
+    if(p->isnull) return p->nullexp?c->nullfrac:nn;
+    switch(p->op){
+        case OP_EQ: return nn/d;
+        case OP_NE: return nn*(1-1/d);
+        case OP_LT: x=hist_frac(c,&p->cv,p->tp); break;
+        case OP_LE: x=hist_frac(c,&p->cv,p->tp)+1/d; break;
+        case OP_GT: x=1-hist_frac(c,&p->cv,p->tp); break;
+        default:    x=1-hist_frac(c,&p->cv,p->tp)+1/d; break;
+    }
+    return nn*(x<0?0:x>1?1:x);
+}
+/* The table-dependent half of compiling a WHERE, kept by cached plans. */
+typedef struct { int16_t ci; int8_t op,isnull,nullexp; } PredT;
+static void where_resolve(const Table *t,const Where *w,PredT *pt){
+    static const char *ops[]={"=","!=","<",">","<=",">=",NULL};
+    for(int i=0;i<w->n;i++){
+        const Cond *c=&w->c[i]; PredT *q=&pt[i];
+        q->ci=-1; q->isnull=(int8_t)c->isnull; q->nullexp=(int8_t)c->nullexp; q->op=OP_EQ;
+        for(int j=0;j<t->ncols;j++) if(!strcasecmp(t->cols[j].name,c->col)){q->ci=(int16_t)j;break;}
+        for(int o=0;ops[o];o++) if(!strcmp(c->op,ops[o])){q->op=(int8_t)o;break;}
+    }
+}
+/* The per-execution half: literals (through pa), dictionary masks,
+   statistics ordering and the pinned view. */
+static void where_bind(Table *t,const Where *w,const PredT *pt,const Params *pa,Filter *f,const Sess *s){
+    f->n=0; f->snap=s->snap; f->tx=s->tx; f->t=t;
+    f->nrows=ald(&t->nrows); f->rows=ald(&t->rows); f->zones=ald(&t->zones);
+    for(int i=0;i<w->n;i++){
+        const PredT *q=&pt[i]; Pred *p=&f->p[f->n++];
+        p->ci=q->ci; p->op=q->op; p->isnull=q->isnull; p->nullexp=q->nullexp; p->sel=-1;
+        p->d=NULL; p->dm=NULL; p->dn=0; p->cs=NULL; p->own=NULL; p->big=0;
+        if(p->ci<0||p->isnull) continue;
+        const char *lv=pval(w->c[i].val,pa);
+        p->tp=t->cols[p->ci].type; str2val(lv,p->tp,&p->cv);
+        if(p->tp==T_TEXT){ p->cs=lv; p->cn=strlen(lv); p->big=p->cn>MAX_STR_LEN-1; }
+        else if(p->tp==T_BLOB){
+            p->big=1; p->cs=lv; p->cn=strlen(lv);
+            if((p->own=(char*)malloc(p->cn+1))){ p->cn=blob_lit(lv,p->own); p->cs=p->own; }
+        }
+        if(!t->cols[p->ci].dict) continue;
+        p->d=&t->dict[p->ci]; p->dlo=INT32_MAX; p->dhi=-1;
+        int dn=ald(&p->d->n); char **ds=ald(&p->d->s);
+        if(!(p->dm=(uint8_t*)malloc((size_t)dn+1))) continue;
+        p->dn=dn;
+        for(int k=0;k<p->dn;k++)
+            if((p->dm[k]=(uint8_t)op_test(p->op,strcasecmp(ds[k],p->cs)))){
+                if(k<p->dlo) p->dlo=k;
+                p->dhi=k;
+            }
+    }
+    /* With statistics, test the most selective predicate first (a stable
+       insertion sort keeps the written order among equals). */
+    const TStat *st=ald(&t->stats);
+    if(!st) return;
+    for(int i=0;i<f->n;i++) f->p[i].sel=pred_sel(st,&f->p[i]);
+    for(int i=1;i<f->n;i++){
+        Pred x=f->p[i]; int j=i;
+        for(;j>0&&f->p[j-1].sel>x.sel;j--) f->p[j]=f->p[j-1];
+        f->p[j]=x;
+    }
+}
+static void compile_where(Table *t,const Where *w,const Params *pa,Filter *f,const Sess *s){
+    PredT pt[MAX_CONDS]; where_resolve(t,w,pt); where_bind(t,w,pt,pa,f,s);
+}
+static void filter_free(Filter *f){ for(int i=0;i<f->n;i++){ free(f->p[i].dm); free(f->p[i].own); } f->n=0; }
+/* f's conditions alone, whatever the row's visibility. */
+static int eval_preds(const Row *row,const Filter *f){
+    for(int i=0;i<f->n;i++){
+        const Pred *p=&f->p[i];
+        if(p->ci<0) return 0;
+        if(p->isnull){ if(row->null[p->ci]!=p->nullexp) return 0; continue; }
+        if(row->null[p->ci]) return 0;
+        if(p->d){
+            int64_t c=row->data[p->ci].i;
+            if(c<p->dn){ if(!p->dm[c]) return 0; continue; }
+            if(!op_test(p->op,strcasecmp(dict_str(p->d,c),p->cs))) return 0;
+            continue;
+        }
+        const Cell *c=&row->data[p->ci];
+        if(!op_test(p->op,p->cs?cell_cmp(c,p->cs,p->cn,p->tp):cell_ncmp(c,&p->cv,p->tp))) return 0;
+    }
+    return 1;
+}
+static int eval_filter(const Row *row,const Filter *f){
+    return row_visible(row,f->snap,f->tx)&&eval_preds(row,f);
+}
+/* True when the filter accepts a row whose columns are all NULL. */
+static int filter_null_ok(const Filter *f){
+    for(int i=0;i<f->n;i++) if(f->p[i].ci<0||!f->p[i].isnull||!f->p[i].nullexp) return 0;
+    return 1;
+}
+/* At a block start, true when no row of the block can pass f. Scans use
+   `if(zone_skip(&f,j)){j|=ZONE_ROWS-1;continue;}` to step over it. Only
+   blocks full in the view are trusted; the tail may still be filling. */
+static int zone_skip(const Filter *f,int j){
+    if(!f->n||(j&(ZONE_ROWS-1))||j+ZONE_ROWS>f->nrows) return 0;
+    const Zone *z=&f->zones[j/ZONE_ROWS];
+    for(int i=0;i<f->n;i++){
+        const Pred *p=&f->p[i];
+        if(p->ci<0) return 1;
+        const ZCol *zc=&z->c[p->ci];
+        if(p->isnull){ if(p->nullexp?!zc->nnull:!zc->has) return 1; continue; }
+        if(!zc->has) return 1;
+        if(p->d){
+            /* codes past dn may pass; only [dlo,dhi] is known to */
+            if(zc->mx.i<p->dn&&(zc->mx.i<p->dlo||zc->mn.i>p->dhi)) return 1;
+            continue;
+        }
+        if(p->big) continue;
+        int lo=val_cmp(&zc->mn,&p->cv,p->tp),hi=zc->open?1:val_cmp(&zc->mx,&p->cv,p->tp);
+        switch(p->op){case OP_EQ:if(lo>0||hi<0)return 1;break;
+                      case OP_NE:if(!lo&&!hi)return 1;break;
+                      case OP_LT:if(lo>=0)return 1;break;
+                      case OP_LE:if(lo>0)return 1;break;
+                      case OP_GT:if(hi<=0)return 1;break;
+                      case OP_GE:if(hi<0)return 1;break;}
+    }
+    return 0;
+}
+/* eval_filter as EXPLAIN ANALYZE sees it: the test is charged to the
+   filter stage and a passing row moves on to stage next. */
+static int eval_prof(const Row *row,const Filter *f,Prof *p,int next){
+    if(!p) return eval_filter(row,f);
+    prof_enter(p,ST_FILTER); p->in[ST_FILTER]++;
+    int ok=eval_filter(row,f);
+    if(ok) p->out[ST_FILTER]++;
+    prof_enter(p,ok?next:ST_SCAN);
+    return ok;
+}
+/* Closes a scan of f that began when p->in[ST_FILTER] was v0. */
+static void prof_scan(Prof *p,const Filter *f,int64_t v0){
+    int64_t v=p->in[ST_FILTER]-v0;
+    p->in[ST_SCAN]+=f->nrows; p->out[ST_SCAN]+=v;
+    p->bytes[ST_SCAN]+=v*(int64_t)sizeof(Row)+(f->n?(int64_t)(f->nrows/ZONE_ROWS)*f->n*(int64_t)sizeof(ZCol):0);
+    p->bytes[ST_FILTER]+=v*f->n*(int64_t)sizeof(Val);
+}
+/* Notes f's predicates in the order eval_filter tests them. */
+static void prof_preds(Prof *p,const Table *t,const char *pre,const Filter *f){
+    static const char *ops[]={"=","!=","<",">","<=",">="};
+    if(!f->n){ prof_note(p,ST_FILTER,"%s: snapshot visibility only",t->name); return; }
+    double est=1;
+    for(int i=0;i<f->n;i++){
+        const Pred *q=&f->p[i]; char v[MAX_STR_LEN],sel[32]="";
+        if(q->sel>=0){ snprintf(sel,sizeof(sel),", sel %.3g",q->sel); est*=q->sel; }
+        if(q->ci<0){ prof_note(p,ST_FILTER,"%sunknown column, no row passes",pre); continue; }
+        const char *cn=t->cols[q->ci].name;
+        if(q->isnull) prof_note(p,ST_FILTER,"%s%s IS %sNULL%s%s%s",pre,cn,q->nullexp?"":"NOT ",*sel?" (":"",*sel?sel+2:"",*sel?")":"");
+        else if(q->d){
+            int k=0; for(int c=0;q->dm&&c<q->dn;c++) k+=q->dm[c];
+            prof_note(p,ST_FILTER,"%s%s %s '%s' (DICT, %d of %d codes pass%s)",pre,cn,ops[q->op],q->cv.s,k,q->dn,sel);
+        } else {
+            val2str((Val*)&q->cv,q->tp,v,sizeof(v));
+            prof_note(p,ST_FILTER,"%s%s %s %s (%s%s)",pre,cn,ops[q->op],v,tname(q->tp),sel);
+        }
+    }
+    const TStat *st=ald(&t->stats);
+    if(st&&f->p[0].sel>=0) prof_note(p,ST_FILTER,"~%.0f of %lld analyzed row(s) pass",est*(double)st->rows,(long long)st->rows);
+}
+/* Notes a full scan, which steps over zone blocks that no predicate can
+   match (an index scan notes itself, see run_ixscan). A
+   partition's predicates are named after it, as its statistics may order
+   them differently. */
+static void prof_plan(Prof *p,const Table *t,const char *pre,const Filter *f,int nw){
+    char px[MAX_NAME_LEN+2]; const char *h=strchr(t->name,'#');
+    if(h&&!*pre){ snprintf(px,sizeof(px),"%s: ",h+1); pre=px; }
+    prof_note(p,ST_SCAN,"%s: full scan, %d row versions in %d block(s), zone maps %s, %d worker(s)",
+              t->name,f->nrows,(f->nrows+ZONE_ROWS-1)/ZONE_ROWS,f->n?"checked":"unused",nw);
+    prof_preds(p,t,pre,f);
+}
+
+/* ── Lexer ──────────────────────────────────────────────────── */
+/* Tokens are slices of the statement text, read one ahead in a single
+   pass; nothing is copied until the parser keeps a name or literal. Names
+   may contain dots ("a.id"). A sign right before a number belongs to it
+   unless the previous token was a value; there is no arithmetic. */
+enum { TK_END, TK_ID, TK_STR, TK_NUM, TK_OP, TK_PUNCT, TK_BAD };
+typedef struct { int k; const char *s; int n; } Tok;
+typedef struct { const char *p, *pe; Tok t; } Lex;   /* pe: end of the previous token */
+
+static void lex_next(Lex *l){
+    const char *p=l->p; int pk=l->t.k; Tok *t=&l->t;
+    l->pe=t->s?t->s+t->n:p;
+    while(isspace((unsigned char)*p)) p++;
+    unsigned char c=(unsigned char)*p,d=(unsigned char)p[1];
+    t->s=p; t->n=1;
+    if(!c){ t->k=TK_END; t->n=0; }
+    else if(isalpha(c)||c=='_'){
+        t->k=TK_ID;
+        while(isalnum((unsigned char)p[t->n])||p[t->n]=='_'||p[t->n]=='.') t->n++;
+    } else if(c=='\''||c=='"'){
+        /* a doubled quote stands for itself */
+        for(t->k=TK_STR;;){
+            if(!p[t->n]){ t->k=TK_BAD; break; }
+            if(p[t->n++]==c){ if(p[t->n]==c) t->n++; else break; }
+        }
+    } else if(isdigit(c)||(c=='.'&&isdigit(d))||((c=='-'||c=='+')&&pk!=TK_ID&&pk!=TK_STR&&pk!=TK_NUM&&
+              (isdigit(d)||(d=='.'&&isdigit((unsigned char)p[2]))))){
+        int e=0; t->k=TK_NUM;
+        for(;;){
+            char x=p[t->n];
+            if(isdigit((unsigned char)x)||x=='.') t->n++;
+            else if((x=='e'||x=='E')&&!e){ e=1; t->n++; if(p[t->n]=='-'||p[t->n]=='+') t->n++; }
+            else break;
+        }
+        if(isalpha((unsigned char)p[t->n])||p[t->n]=='_') t->k=TK_BAD;
+    } else if(c=='='||c=='<'||c=='>'||c=='!'){
+        t->k=TK_OP;
+        if((c=='<'&&(d=='='||d=='>'))||((c=='>'||c=='!')&&d=='=')) t->n=2;
+        else if(c=='!') t->k=TK_BAD;
+    } else t->k=strchr("(),*;",c)?TK_PUNCT:TK_BAD;
+    l->p=p+t->n;
+}
+static void lex_init(Lex *l,const char *s){ memset(l,0,sizeof(*l)); l->p=s; lex_next(l); }
+static int tok_is(const Tok *t,const char *kw){
+    return t->k==TK_ID&&(int)strlen(kw)==t->n&&!strncasecmp(t->s,kw,(size_t)t->n);
+}
+/* A literal's text: quotes removed and doubled ones undone, cut to n-1. */
+static void tok_lit(const Tok *t,char *o,size_t n){
+    size_t k=0;
+    if(t->k!=TK_STR){ k=(size_t)t->n<n-1?(size_t)t->n:n-1; memcpy(o,t->s,k); }
+    else for(int i=1;i<t->n-1&&k<n-1;i++){ o[k++]=t->s[i]; if(t->s[i]==t->s[0]) i++; }
+    o[k]=0;
+}
+
+/* ── Parser ─────────────────────────────────────────────────── */
+typedef enum { A_COUNT=1, A_SUM, A_AVG, A_MIN, A_MAX } AggFn;
+enum { SQ_SELECT=1, SQ_INSERT, SQ_UPDATE, SQ_DELETE, SQ_CREATE, SQ_DROP, SQ_DROPMV };
+/* Select-list item; text is the item as written or its AS name, the result
+   column name. */
+typedef struct { char text[MAX_NAME_LEN], ref[MAX_NAME_LEN]; int fn; } SelItem;   /* fn: AggFn, 0 for a column */
+/* A parsed statement. The second tbl/alias and on[] are set by a JOIN
+   (alias defaults to the table name); col/val hold INSERT's column list
+   and values or UPDATE's SET pairs, def CREATE TABLE's columns and pkey
+   its PARTITION BY RANGE column. Literals are text, or "?N" when the
+   parser lifts them for the plan cache. */
+typedef struct {
+    int  kind, ntbl, left, star, nsel, ngrp, ncol, nval, ndef;
+    char tbl[2][MAX_NAME_LEN], alias[2][MAX_NAME_LEN], on[2][MAX_NAME_LEN];
+    SelItem sel[MAX_COLUMNS];
+    char grp[MAX_COLUMNS][MAX_NAME_LEN], col[MAX_COLUMNS][MAX_NAME_LEN];
+    char val[MAX_COLUMNS][MAX_STR_LEN];
+    Col  def[MAX_COLUMNS];
+    char pkey[MAX_NAME_LEN];
+    Where w;
+} Stmt;
+
+typedef struct { Lex l; int lift, np; char err[160]; } Ps;
+
+static int ps_fail(Ps *p,const char *what){
+    const Tok *t=&p->l.t;
+    if(p->err[0]) return -1;
+    if(t->k==TK_BAD&&(*t->s=='\''||*t->s=='"')) what="Unterminated string";
+    if(t->k==TK_END) snprintf(p->err,sizeof(p->err),"%s at end of statement",what);
+    else snprintf(p->err,sizeof(p->err),"%s near '%.*s'",what,t->n>40?40:t->n,t->s);
+    return -1;
+}
+static int ps_kw(Ps *p,const char *kw){ if(!tok_is(&p->l.t,kw)) return 0; lex_next(&p->l); return 1; }
+static int ps_ch(Ps *p,char c){
+    if(p->l.t.k!=TK_PUNCT||*p->l.t.s!=c) return 0;
+    lex_next(&p->l); return 1;
+}
+static int ps_need(Ps *p,const char *kw){
+    char m[40]; if(ps_kw(p,kw)) return 0;
+    snprintf(m,sizeof(m),"Expected %s",kw); return ps_fail(p,m);
+}
+static int ps_needch(Ps *p,char c){
+    char m[16]; if(ps_ch(p,c)) return 0;
+    snprintf(m,sizeof(m),"Expected '%c'",c); return ps_fail(p,m);
+}
+static int ps_name(Ps *p,char *o){
+    const Tok *t=&p->l.t;
+    if(t->k!=TK_ID) return ps_fail(p,"Expected a name");
+    if(t->n>=MAX_NAME_LEN) return ps_fail(p,"Name too long");
+    memcpy(o,t->s,(size_t)t->n); o[t->n]=0; lex_next(&p->l); return 0;
+}
+/* A literal or a bare word (NULL, true, ...). Without lift the literal
+   is kept in o itself, so one that does not fit is refused. */
+static int ps_value(Ps *p,char *o){
+    const Tok *t=&p->l.t; int n=t->n;
+    if(t->k==TK_ID) return ps_name(p,o);
+    if(t->k!=TK_STR&&t->k!=TK_NUM) return ps_fail(p,"Expected a value");
+    if(t->k==TK_STR){ n-=2; for(int i=1;i<t->n-1;i++) if(t->s[i]==t->s[0]){ n--; i++; } }
+    if(p->lift) snprintf(o,MAX_STR_LEN,"?%d",p->np++);
+    else if(n>=MAX_STR_LEN) return ps_fail(p,"Literal too long here");
+    else tok_lit(t,o,MAX_STR_LEN);
+    lex_next(&p->l); return 0;
+}
+/* Names that end a table reference rather than alias it. */
+static int ps_alias(Ps *p,char *o){
+    static const char *kw[]={"WHERE","GROUP","JOIN","INNER","LEFT","ON","AND",NULL};
+    if(p->l.t.k!=TK_ID) return 0;
+    for(int i=0;kw[i];i++) if(tok_is(&p->l.t,kw[i])) return 0;
+    return ps_name(p,o);
+}
+static int ps_where(Ps *p,Where *w){
+    do{
+        if(w->n>=MAX_CONDS) return ps_fail(p,"Too many WHERE conditions");
+        Cond *c=&w->c[w->n++]; memset(c,0,sizeof(*c));
+        if(ps_name(p,c->col)) return -1;
+        if(ps_kw(p,"IS")){
+            c->isnull=1; c->nullexp=!ps_kw(p,"NOT");
+            if(ps_need(p,"NULL")) return -1;
+            continue;
+        }
+        const Tok *t=&p->l.t;
+        if(t->k!=TK_OP) return ps_fail(p,"Expected a comparison");
+        if(t->n==2&&t->s[1]=='>') strcpy(c->op,"!="); else { memcpy(c->op,t->s,(size_t)t->n); c->op[t->n]=0; }
+        lex_next(&p->l);
+        if(ps_value(p,c->val)) return -1;
+    } while(ps_kw(p,"AND"));
+    return 0;
+}
+static int ps_item(Ps *p,SelItem *it){
+    static const char *fns[]={"COUNT","SUM","AVG","MIN","MAX",NULL};
+    const char *b=p->l.t.s,*q=p->l.p; it->fn=0;
+    while(isspace((unsigned char)*q)) q++;
+    for(int f=0;fns[f]&&*q=='(';f++) if(tok_is(&p->l.t,fns[f])) it->fn=f+1;
+    if(!it->fn){ if(ps_name(p,it->ref)) return -1; }
+    else{
+        lex_next(&p->l); lex_next(&p->l);
+        if(ps_ch(p,'*')) strcpy(it->ref,"*"); else if(ps_name(p,it->ref)) return -1;
+        if(ps_needch(p,')')) return -1;
+    }
+    size_t n=(size_t)(p->l.pe-b); if(n>=MAX_NAME_LEN) n=MAX_NAME_LEN-1;
+    memcpy(it->text,b,n); it->text[n]=0;
+    return ps_kw(p,"AS")?ps_name(p,it->text):0;
+}
+/* Result name of plain column item i, which reads column cn. */
+static const char *sel_name(const Stmt *st,int i,const char *cn){
+    return st->star||!strcasecmp(st->sel[i].text,st->sel[i].ref)?cn:st->sel[i].text;
+}
+static int ps_select(Ps *p,Stmt *st){
+    if(ps_ch(p,'*')){ st->star=1; st->nsel=1; strcpy(st->sel[0].text,"*"); strcpy(st->sel[0].ref,"*"); st->sel[0].fn=0; }
+    else do{
+        if(st->nsel>=MAX_COLUMNS) return ps_fail(p,"Too many columns");
+        if(ps_item(p,&st->sel[st->nsel++])) return -1;
+    } while(ps_ch(p,','));
+    if(ps_need(p,"FROM")||ps_name(p,st->tbl[0])||ps_alias(p,st->alias[0])) return -1;
+    st->ntbl=1;
+    if(ps_kw(p,"LEFT")){ st->left=1; ps_kw(p,"OUTER"); if(ps_need(p,"JOIN")) return -1; st->ntbl=2; }
+    else if(ps_kw(p,"INNER")){ if(ps_need(p,"JOIN")) return -1; st->ntbl=2; }
+    else if(ps_kw(p,"JOIN")) st->ntbl=2;
+    if(st->ntbl==2){
+        if(ps_name(p,st->tbl[1])||ps_alias(p,st->alias[1])||ps_need(p,"ON")||ps_name(p,st->on[0])) return -1;
+        if(p->l.t.k!=TK_OP||p->l.t.n!=1||*p->l.t.s!='=') return ps_fail(p,"JOIN requires ON a = b");
+        lex_next(&p->l);
+        if(ps_name(p,st->on[1])) return -1;
+    }
+    if(ps_kw(p,"WHERE")&&ps_where(p,&st->w)) return -1;
+    if(ps_kw(p,"GROUP")){
+        if(ps_need(p,"BY")) return -1;
+        do{
+            if(st->ngrp>=MAX_COLUMNS) return ps_fail(p,"Too many GROUP BY columns");
+            if(ps_name(p,st->grp[st->ngrp++])) return -1;
+        } while(ps_ch(p,','));
+    }
+    return 0;
+}
+static int ps_insert(Ps *p,Stmt *st){
+    if(ps_name(p,st->tbl[0])) return -1;
+    if(ps_ch(p,'(')){
+        do{
+            if(st->ncol>=MAX_COLUMNS) return ps_fail(p,"Too many columns");
+            if(ps_name(p,st->col[st->ncol++])) return -1;
+        } while(ps_ch(p,','));
+        if(ps_needch(p,')')) return -1;
+    } else st->ncol=-1;   /* every column, in table order */
+    if(ps_need(p,"VALUES")||ps_needch(p,'(')) return -1;
+    do{
+        if(st->nval>=MAX_COLUMNS) return ps_fail(p,"Too many values");
+        if(ps_value(p,st->val[st->nval++])) return -1;
+    } while(ps_ch(p,','));
+    return ps_needch(p,')');
+}
+static int ps_update(Ps *p,Stmt *st){
+    if(ps_name(p,st->tbl[0])||ps_need(p,"SET")) return -1;
+    do{
+        if(st->ncol>=MAX_COLUMNS) return ps_fail(p,"Too many columns");
+        if(ps_name(p,st->col[st->ncol])) return -1;
+        if(p->l.t.k!=TK_OP||p->l.t.n!=1||*p->l.t.s!='=') return ps_fail(p,"Expected '='");
+        lex_next(&p->l);
+        if(ps_value(p,st->val[st->ncol++])) return -1;
+    } while(ps_ch(p,','));
+    st->nval=st->ncol;
+    return ps_kw(p,"WHERE")?ps_where(p,&st->w):0;
+}
+static int ps_create(Ps *p,Stmt *st){
+    if(ps_need(p,"TABLE")||ps_name(p,st->tbl[0])||ps_needch(p,'(')) return -1;
+    do{
+        if(st->ndef>=MAX_COLUMNS) return ps_fail(p,"Too many columns");
+        Col *c=&st->def[st->ndef++]; char tn[MAX_NAME_LEN];
+        memset(c,0,sizeof(*c)); c->nullable=1;
+        if(ps_name(p,c->name)) return -1;
+        if(p->l.t.k==TK_ID&&p->l.t.n<MAX_NAME_LEN){ memcpy(tn,p->l.t.s,(size_t)p->l.t.n); tn[p->l.t.n]=0; }
+        else return ps_fail(p,"Expected a type");
+        if(!(c->type=tparse(tn))){ snprintf(p->err,sizeof(p->err),"Unknown type '%s'",tn); return -1; }
+        lex_next(&p->l);
+        if(ps_ch(p,'(')){   /* VARCHAR(n): the length is not enforced */
+            if(p->l.t.k!=TK_NUM) return ps_fail(p,"Expected a length");
+            lex_next(&p->l); if(ps_needch(p,')')) return -1;
+        }
+        for(;;){
+            if(ps_kw(p,"PRIMARY")){ if(ps_need(p,"KEY")) return -1; c->pk=1; }
+            else if(ps_kw(p,"NOT")){ if(ps_need(p,"NULL")) return -1; c->nullable=0; }
+            else if(ps_kw(p,"NULL")) c->nullable=1;
+            else if(tok_is(&p->l.t,"DICT")){ if(c->type!=T_TEXT) return ps_fail(p,"DICT needs a TEXT column"); lex_next(&p->l); c->dict=1; }
+            else break;
+        }
+    } while(ps_ch(p,','));
+    if(ps_needch(p,')')) return -1;
+    if(!ps_kw(p,"PARTITION")) return 0;
+    return ps_need(p,"BY")||ps_need(p,"RANGE")||ps_needch(p,'(')||ps_name(p,st->pkey)||ps_needch(p,')');
+}
+/* Parses one statement into st in a single left-to-right pass. With lift,
+   every quoted or numeric literal becomes "?N", N counting from 0 in the
+   order sql_norm collects them. 0, or -1 with the message in r. */
+static int parse_sql(const char *sql,Stmt *st,int lift,Res *r){
+    Ps p; int rc;
+    lex_init(&p.l,sql); p.lift=lift; p.np=0; p.err[0]=0;
+    st->kind=st->ntbl=st->left=st->star=st->nsel=st->ngrp=st->ncol=st->nval=st->ndef=0;
+    st->w.n=0; st->alias[0][0]=st->alias[1][0]=st->pkey[0]=0;
+    if(ps_kw(&p,"SELECT")){ st->kind=SQ_SELECT; rc=ps_select(&p,st); }
+    else if(ps_kw(&p,"INSERT")){ st->kind=SQ_INSERT; rc=ps_need(&p,"INTO")||ps_insert(&p,st); }
+    else if(ps_kw(&p,"UPDATE")){ st->kind=SQ_UPDATE; rc=ps_update(&p,st); }
+    else if(ps_kw(&p,"DELETE")){
+        st->kind=SQ_DELETE;
+        rc=ps_need(&p,"FROM")||ps_name(&p,st->tbl[0])||(ps_kw(&p,"WHERE")&&ps_where(&p,&st->w));
+    }
+    else if(ps_kw(&p,"CREATE")){ st->kind=SQ_CREATE; rc=ps_create(&p,st); }
+    else if(ps_kw(&p,"DROP")){
+        st->kind=ps_kw(&p,"MATERIALIZED")?SQ_DROPMV:SQ_DROP;
+        rc=ps_need(&p,st->kind==SQ_DROP?"TABLE":"VIEW")||ps_name(&p,st->tbl[0]);
+    }
+    else rc=ps_fail(&p,"Unknown statement");
+    if(!rc&&p.l.t.k!=TK_END) rc=ps_fail(&p,"Unexpected");
+    if(rc){ res_err(r,p.err[0]?p.err:"Syntax error"); return -1; }
+    for(int k=0;k<st->ntbl;k++) if(!st->alias[k][0]) strcpy(st->alias[k],st->tbl[k]);
+    return 0;
+}
+
+/* ── GROUP BY ───────────────────────────────────────────────── */
+typedef struct { AggFn fn; int ci; } AggSpec;            /* ci<0: COUNT(*) */
+typedef struct { int64_t n,i; double f; Val m; } AggSt;   /* mergeable partial state */
+
+/* f: nf filters, one per table scanned: t itself or its partitions, which
+   share its columns. */
+typedef struct {
+    Table  *t; const Filter *f;
+    int     nf,nw,nk,kc[MAX_COLUMNS],na;
+    AggSpec ag[MAX_AGGS];
+} GBSpec;
+
+/* Open-addressing group table. ix[] holds entry+1 (0 = empty); entries live
+   densely in the parallel h/key/knull/st arrays so they can be spilled as-is. */
+typedef struct {
+    uint32_t n,ecap,cap,*ix;
+    uint64_t *h; Val *key; int8_t *knull; AggSt *st;
+} GTab;
+
+static size_t gt_bytes(const GBSpec *g,const GTab *gt){
+    return (size_t)gt->ecap*(8+g->nk*(sizeof(Val)+1)+g->na*sizeof(AggSt))+(size_t)gt->cap*4;
+}
+static void gt_free(GTab *gt){
+    free(gt->ix);free(gt->h);free(gt->key);free(gt->knull);free(gt->st);
+    memset(gt,0,sizeof(*gt));
+}
+static void gt_clear(GTab *gt){ gt->n=0; if(gt->ix) memset(gt->ix,0,sizeof(uint32_t)*gt->cap); }
+static int gt_rehash(GTab *gt,uint32_t cap){
+    uint32_t *ix=(uint32_t*)calloc(cap,sizeof(uint32_t)); if(!ix) return -1;
+    for(uint32_t e=0;e<gt->n;e++){
+        uint32_t i=(uint32_t)gt->h[e]&(cap-1);
+        while(ix[i]) i=(i+1)&(cap-1);
+        ix[i]=e+1;
+    }
+    free(gt->ix); gt->ix=ix; gt->cap=cap; return 0;
+}
+static int gt_reserve(const GBSpec *g,GTab *gt){
+    uint32_t e=gt->ecap?gt->ecap*2:64;
+    uint64_t *h=(uint64_t*)realloc(gt->h,sizeof(uint64_t)*e); if(!h) return -1; gt->h=h;
+    if(g->nk){
+        Val *k=(Val*)realloc(gt->key,sizeof(Val)*e*g->nk); if(!k) return -1; gt->key=k;
+        int8_t *kn=(int8_t*)realloc(gt->knull,(size_t)e*g->nk); if(!kn) return -1; gt->knull=kn;
+    }
+    if(g->na){ AggSt *st=(AggSt*)realloc(gt->st,sizeof(AggSt)*e*g->na); if(!st) return -1; gt->st=st; }
+    gt->ecap=e; return 0;
+}
+/* Returns the entry for key (inserting a zeroed one if absent), -1 on OOM. */
+static int gt_find(const GBSpec *g,GTab *gt,uint64_t h,const Val **kv,const int8_t *kn){
+    if((gt->n+1)*2>gt->cap&&gt_rehash(gt,gt->cap?gt->cap*2:128)) return -1;
+    uint32_t m=gt->cap-1,i=(uint32_t)h&m;
+    for(;gt->ix[i];i=(i+1)&m){
+        uint32_t e=gt->ix[i]-1; if(gt->h[e]!=h) continue;
+        int k=0;
+        for(;k<g->nk;k++){
+            int8_t en=gt->knull[e*g->nk+k];
+            if(en!=kn[k]) break;
+            if(!en&&val_cmp(&gt->key[e*g->nk+k],kv[k],g->t->cols[g->kc[k]].type)) break;
+        }
+        if(k==g->nk) return (int)e;
+    }
+    if(gt->n>=gt->ecap&&gt_reserve(g,gt)) return -1;
+    uint32_t e=gt->n++; gt->ix[i]=e+1; gt->h[e]=h;
+    for(int k=0;k<g->nk;k++){ gt->knull[e*g->nk+k]=kn[k]; if(!kn[k]) gt->key[e*g->nk+k]=*kv[k]; }
+    if(g->na) memset(&gt->st[(size_t)e*g->na],0,sizeof(AggSt)*g->na);
+    return (int)e;
+}
+
+/* -1 when MIN/MAX meets a value too long to keep in its state. */
+static int agg_step(AggSt *s,const AggSpec *a,Table *t,Row *row){
+    if(a->ci<0){s->n++;return 0;}
+    if(row->null[a->ci]) return 0;
+    if((a->fn==A_MIN||a->fn==A_MAX)&&col_big(t,row,a->ci)) return -1;
+    Val tmp; const Val *v=col_val(t,row,a->ci,&tmp); CType tp=t->cols[a->ci].type;
+    switch(a->fn){
+    case A_COUNT: break;
+    case A_SUM: case A_AVG:
+        if(tp==T_FLOAT) s->f+=v->f; else s->i+=tp==T_BOOL?v->b:v->i; break;
+    case A_MIN: if(!s->n||val_cmp(v,&s->m,tp)<0) s->m=*v; break;
+    case A_MAX: if(!s->n||val_cmp(v,&s->m,tp)>0) s->m=*v; break;
+    }
+    s->n++; return 0;
+}
+static void agg_merge(AggSt *d,const AggSt *s,const AggSpec *a,CType tp){
+    if(!s->n) return;
+    if(a->fn==A_MIN){ if(!d->n||val_cmp(&s->m,&d->m,tp)<0) d->m=s->m; }
+    else if(a->fn==A_MAX){ if(!d->n||val_cmp(&s->m,&d->m,tp)>0) d->m=s->m; }
+    d->n+=s->n; d->i+=s->i; d->f+=s->f;
+}
+static CType agg_type(const AggSpec *a,Table *t){
+    CType tp=a->ci<0?T_INT:t->cols[a->ci].type;
+    if(a->fn==A_COUNT) return T_INT;
+    if(a->fn==A_AVG) return T_FLOAT;
+    if(a->fn==A_SUM) return tp==T_FLOAT?T_FLOAT:T_INT;
+    return tp;
+}
+/* Final value of an aggregate, typed as agg_type says; 0 when NULL. */
+static int agg_val(const AggSt *s,const AggSpec *a,Table *t,Val *v){
+    CType tp=a->ci<0?T_INT:t->cols[a->ci].type;
+    if(a->fn==A_COUNT){v->i=s->n;return 1;}
+    if(!s->n) return 0;
+    if(a->fn==A_SUM){ if(tp==T_FLOAT) v->f=s->f; else v->i=s->i; }
+    else if(a->fn==A_AVG) v->f=tp==T_FLOAT?s->f/s->n:(double)s->i/s->n;
+    else *v=s->m;
+    return 1;
+}
+/* Worker i of nw aggregates block range i of each filter's rows into a
+   private table. When the table outgrows its share of GB_MEM_BUDGET its
+   partial states are flushed to hash-partitioned temp files and the table
+   starts over; partitions are merged one at a time afterwards, so no group
+   ever lives in two merges. */
+typedef struct {
+    const GBSpec *g; int i,err,spilled; size_t budget;
+    GTab  tab; FILE *part[GB_PARTS];
+    int64_t seen,hit;   /* rows tested / passed, for EXPLAIN ANALYZE */
+} GBWork;
+
+static uint64_t gb_hash(const GBSpec *g,const Val **kv,const int8_t *kn){
+    uint64_t h=0x84222325cbf29ce4ULL;
+    for(int k=0;k<g->nk;k++)
+        h=kn[k]?hmix(h^0x9e3779b97f4a7c15ULL):val_hash(kv[k],g->t->cols[g->kc[k]].type,h);
+    return h;
+}
+static int gb_spill(GBWork *w){
+    const GBSpec *g=w->g; GTab *gt=&w->tab;
+    for(uint32_t e=0;e<gt->n;e++){
+        int p=(int)((gt->h[e]>>40)%GB_PARTS);
+        if(!w->part[p]&&!(w->part[p]=tmpfile())) return -1;
+        FILE *f=w->part[p];
+        fwrite(&gt->h[e],sizeof(uint64_t),1,f);
+        if(g->nk){ fwrite(&gt->knull[e*g->nk],1,g->nk,f); fwrite(&gt->key[e*g->nk],sizeof(Val),g->nk,f); }
+        if(g->na) fwrite(&gt->st[(size_t)e*g->na],sizeof(AggSt),g->na,f);
+        if(ferror(f)) return -1;
+    }
+    gt_clear(gt); w->spilled=1; return 0;
+}
+static void *gb_worker(void *arg){
+    GBWork *w=(GBWork*)arg; const GBSpec *g=w->g;
+    const Val *kv[MAX_COLUMNS]; int8_t kn[MAX_COLUMNS]; Val kt[MAX_COLUMNS];
+    for(int q=0;q<g->nf&&!w->err;q++){
+        const Filter *f=&g->f[q]; Table *t=f->t; int hi=zone_split(f->nrows,w->i+1,g->nw);
+        for(int j=zone_split(f->nrows,w->i,g->nw);j<hi&&!w->err;j++){
+            if(zone_skip(f,j)){j|=ZONE_ROWS-1;continue;}
+            Row *row=&f->rows[j]; w->seen++;
+            if(!eval_filter(row,f)) continue;
+            w->hit++;
+            for(int k=0;k<g->nk;k++){
+                kv[k]=col_val(t,row,g->kc[k],&kt[k]); kn[k]=row->null[g->kc[k]];
+                if(!kn[k]&&col_big(t,row,g->kc[k])) w->err=2;
+            }
+            int e=w->err?-1:gt_find(g,&w->tab,gb_hash(g,kv,kn),kv,kn);
+            if(e<0){w->err|=1;break;}
+            for(int a=0;a<g->na;a++) if(agg_step(&w->tab.st[(size_t)e*g->na+a],&g->ag[a],t,row)) w->err=3;
+            if(gt_bytes(g,&w->tab)>w->budget&&gb_spill(w)) w->err|=1;
+        }
+    }
+    return NULL;
+}
+static int gb_merge(const GBSpec *g,GTab *d,uint64_t h,const Val **kv,const int8_t *kn,const AggSt *st){
+    int e=gt_find(g,d,h,kv,kn); if(e<0) return -1;
+    for(int a=0;a<g->na;a++){
+        CType tp=g->ag[a].ci<0?T_INT:g->t->cols[g->ag[a].ci].type;
+        agg_merge(&d->st[(size_t)e*g->na+a],&st[a],&g->ag[a],tp);
+    }
+    return 0;
+}
+/* Output item oi[j]: >=0 selects group key oi[j], <0 selects aggregate -oi[j]-1. */
+static void gb_emit(const GBSpec *g,const GTab *gt,const int *oi,int no,Res *r){
+    char rv[MAX_COLUMNS][MAX_STR_LEN]; Val av;
+    PROF(r,ST_MATERIALIZE);
+    for(uint32_t e=0;e<gt->n;e++){
+        for(int j=0;j<no;j++){
+            if(oi[j]>=0){
+                int k=oi[j];
+                res_cell(r,rv,j,gt->knull[e*g->nk+k]?NULL:&gt->key[e*g->nk+k],r->ctype[j]);
+            } else {
+                int a=-oi[j]-1;
+                res_cell(r,rv,j,agg_val(&gt->st[(size_t)e*g->na+a],&g->ag[a],g->t,&av)?&av:NULL,r->ctype[j]);
+            }
+        }
+        res_addrow(r,rv,no);
+    }
+    PROF(r,ST_AGGREGATE);
+}
+
+static void select_group(Table *t,const Stmt *st,const Filter *f,int nf,Res *r){
+    GBSpec g; memset(&g,0,sizeof(g)); g.t=t; g.f=f; g.nf=nf;
+    char m[128];
+    for(int i=0;i<st->ngrp;i++){
+        int ci=col_idx(t,st->grp[i]);
+        if(ci<0){snprintf(m,128,"Column '%s' not found",st->grp[i]);res_err(r,m);return;}
+        if(t->cols[ci].type==T_BLOB){snprintf(m,128,"Cannot GROUP BY BLOB column '%s'",st->grp[i]);res_err(r,m);return;}
+        g.kc[g.nk++]=ci;
+    }
+    int oi[MAX_COLUMNS],no=0;
+    for(int i=0;i<st->nsel;i++){
+        const SelItem *it=&st->sel[i];
+        strncpy(r->cname[no],it->text,MAX_NAME_LEN-1);
+        if(it->fn){
+            AggSpec a={(AggFn)it->fn,-1};
+            int bad=!strcmp(it->ref,"*")?a.fn!=A_COUNT:(a.ci=col_idx(t,it->ref))<0||
+                    ((a.fn==A_SUM||a.fn==A_AVG)&&t->cols[a.ci].type==T_TEXT)||
+                    (a.fn!=A_COUNT&&t->cols[a.ci].type==T_BLOB);
+            if(bad){snprintf(m,128,"Bad aggregate '%s'",it->text);res_err(r,m);return;}
+            if(g.na>=MAX_AGGS){res_err(r,"Too many aggregates");return;}
+            r->ctype[no]=agg_type(&a,t); g.ag[g.na]=a; oi[no++]=-(++g.na);
+            continue;
+        }
+        int k=0;
+        while(k<g.nk&&strcasecmp(t->cols[g.kc[k]].name,it->ref)) k++;
+        if(k==g.nk){snprintf(m,128,"Column '%s' must appear in GROUP BY",it->text);res_err(r,m);return;}
+        r->ctype[no]=t->cols[g.kc[k]].type; oi[no++]=k;
+    }
+    int nr=0; Prof *pr=r->prof;
+    for(int q=0;q<nf;q++) nr+=f[q].nrows;
+    int nw=g.nw=nworkers(nr);
+    if(pr){
+        for(int q=0;q<nf;q++) prof_plan(pr,f[q].t,"",&f[q],nw);
+        prof_note(pr,ST_FILTER,"tested inside the scan workers");
+        prof_note(pr,ST_AGGREGATE,"hash aggregate: %d key(s), %d aggregate(s); each worker's partial table "
+                  "merged, spilling to %d partitions past %u MB",g.nk,g.na,GB_PARTS,GB_MEM_BUDGET>>20);
+        prof_note(pr,ST_MATERIALIZE,"%d column(s) per group",no);
+        if(pr->plan){res_ok(r,"Planned",0);return;}
+        prof_enter(pr,ST_SCAN);
+    }
+    GBWork w[MAX_WORKERS]; memset(w,0,sizeof(w));
+    for(int i=0;i<nw;i++){
+        w[i].g=&g; w[i].i=i; w[i].budget=GB_MEM_BUDGET/nw;
+    }
+    par_run(nw,gb_worker,w,sizeof(GBWork));
+    int err=0,spilled=0;
+    for(int i=0;i<nw;i++){err|=w[i].err;spilled|=w[i].spilled;}
+    if(pr){
+        /* scan, filter and partial aggregation ran fused in the workers:
+           all of that time is the scan's */
+        int64_t v0=pr->in[ST_FILTER];
+        for(int i=0;i<nw;i++){ pr->in[ST_FILTER]+=w[i].seen; pr->out[ST_FILTER]+=w[i].hit; pr->in[ST_AGGREGATE]+=w[i].hit; }
+        for(int q=0;q<nf;q++) prof_scan(pr,&f[q],q?pr->in[ST_FILTER]:v0);
+        prof_enter(pr,ST_AGGREGATE);
+    }
+    GTab out; memset(&out,0,sizeof(out));
+    r->ok=1; r->ncols=no;
+    if(!err&&!spilled){
+        /* Everything fit: fold the other workers' tables into worker 0's. */
+        out=w[0].tab; memset(&w[0].tab,0,sizeof(GTab));
+        const Val *kv[MAX_COLUMNS];
+        for(int i=1;i<nw&&!err;i++){
+            GTab *s=&w[i].tab;
+            for(uint32_t e=0;e<s->n&&!err;e++){
+                for(int k=0;k<g.nk;k++) kv[k]=&s->key[e*g.nk+k];
+                err=gb_merge(&g,&out,s->h[e],kv,g.nk?&s->knull[e*g.nk]:NULL,g.na?&s->st[(size_t)e*g.na]:NULL)!=0;
+            }
+        }
+        if(!err&&!g.nk&&!out.n){ const Val *z[1]={0}; int8_t zn[1]={0}; err=gt_find(&g,&out,gb_hash(&g,z,zn),z,zn)<0; }
+        if(!err) gb_emit(&g,&out,oi,no,r);
+        gt_free(&out);
+    } else if(!err){
+        for(int i=0;i<nw&&!err;i++) err=gb_spill(&w[i])!=0;
+        Val *kb=(Val*)malloc(sizeof(Val)*(g.nk?g.nk:1));
+        AggSt st[MAX_AGGS]; int8_t kn[MAX_COLUMNS]; const Val *kv[MAX_COLUMNS]; uint64_t h;
+        for(int k=0;k<g.nk;k++) kv[k]=&kb[k];
+        for(int p=0;p<GB_PARTS&&!err&&kb;p++){
+            for(int i=0;i<nw&&!err;i++){
+                FILE *f=w[i].part[p]; if(!f) continue;
+                rewind(f);
+                while(!err&&fread(&h,sizeof(h),1,f)==1){
+                    if((g.nk&&(fread(kn,1,g.nk,f)!=(size_t)g.nk||fread(kb,sizeof(Val),g.nk,f)!=(size_t)g.nk))||
+                       (g.na&&fread(st,sizeof(AggSt),g.na,f)!=(size_t)g.na)){err=1;break;}
+                    err=gb_merge(&g,&out,h,kv,kn,st)!=0;
+                }
+            }
+            if(!err) gb_emit(&g,&out,oi,no,r);
+            gt_free(&out);
+        }
+        if(!kb) err=1;
+        free(kb);
+    }
+    for(int i=0;i<nw;i++){
+        gt_free(&w[i].tab);
+        for(int p=0;p<GB_PARTS;p++) if(w[i].part[p]) fclose(w[i].part[p]);
+    }
+    if(err){res_err(r,err&2?"GROUP BY key or MIN/MAX value longer than 255 bytes":"GROUP BY failed (out of memory or temp space)");return;}
+    if(pr){ pr->out[ST_AGGREGATE]=r->nrows; if(spilled) prof_note(pr,ST_AGGREGATE,"spilled"); }
+    snprintf(m,sizeof(m),"%d row(s) returned",r->nrows);
+    strncpy(r->msg,m,sizeof(r->msg)-1); r->affected=r->nrows;
+}
+
+/* ── JOIN ───────────────────────────────────────────────────── */
+typedef struct { Table *t; char alias[MAX_NAME_LEN]; Row *base; int *rows,n; } JSide;   /* rows index base */
+
+/* Resolves [alias.]col against both sides: 0 ok, -1 unknown, -2 ambiguous. */
+static int jcol(JSide *s,const char *ref,int *side,int *ci){
+    const char *dot=strchr(ref,'.'); int found=0;
+    for(int k=0;k<2;k++){
+        const char *cn=ref;
+        if(dot){
+            size_t l=(size_t)(dot-ref);
+            if(strncasecmp(ref,s[k].alias,l)||s[k].alias[l]) continue;
+            cn=dot+1;
+        }
+        for(int j=0;j<s[k].t->ncols;j++)
+            if(!strcasecmp(s[k].t->cols[j].name,cn)){*side=k;*ci=j;found++;break;}
+    }
+    return found==1?0:found?-2:-1;
+}
+static int jfilter(JSide *s,const Filter *f,Prof *p){
+    s->n=0; s->base=f->rows;
+    s->rows=(int*)malloc(sizeof(int)*(f->nrows?f->nrows:1)); if(!s->rows) return -1;
+    int64_t v0=p?p->in[ST_FILTER]:0;
+    for(int j=0;j<f->nrows;j++){
+        if(zone_skip(f,j)){j|=ZONE_ROWS-1;continue;}
+        Row *row=&f->rows[j];
+        if(!eval_prof(row,f,p,ST_SCAN)) continue;
+        s->rows[s->n++]=j;
+    }
+    if(p){ prof_scan(p,f,v0); p->allocs[ST_SCAN]++; p->bytes[ST_SCAN]+=(int64_t)sizeof(int)*f->nrows; }
+    return 0;
+}
+/* INT=FLOAT keys are joined on their double value; other types must match. */
+static uint64_t jhash(const Val *v,CType t,int dbl){
+    if(dbl){ Val d; d.f=t==T_INT?(double)v->i:v->f; return val_hash(&d,T_FLOAT,0); }
+    return val_hash(v,t,0);
+}
+static int jeq(const Val *a,CType ta,const Val *b,CType tb,int dbl){
+    if(dbl) return (ta==T_INT?(double)a->i:a->f)==(tb==T_INT?(double)b->i:b->f);
+    return val_cmp(a,b,ta)==0;
+}
+static void jemit(JSide *s,const int *osd,const int *oci,int no,Row *a,Row *b,Res *r){
+    char rv[MAX_COLUMNS][MAX_STR_LEN];
+    PROF(r,ST_MATERIALIZE);
+    for(int k=0;k<no;k++) res_col(r,rv,k,s[osd[k]].t,osd[k]?b:a,oci[k]);
+    res_addrow(r,rv,no);
+    PROF(r,ST_JOIN);
+}
+
+/* "t1 [a1] [INNER | LEFT [OUTER]] JOIN t2 [a2] ON x = y [WHERE ...]".
+   Each WHERE condition is pushed below the join into the side it names;
+   only right-side conditions under LEFT JOIN wait until after the probe,
+   since they must also see the NULL-extended rows. The hash table is built
+   over the smaller filtered side and probed with the larger one. */
+static int mv_stale(const Table *t,Res *r);
+static void select_join(DB *db,const Stmt *st,const Params *pa,Res *r,const Sess *ss){
+    const Where *wq=&st->w; const char *on=st->on[0],*rhs=st->on[1];
+    JSide s[2]; memset(s,0,sizeof(s));
+    int left=st->left; char m[160];
+    for(int k=0;k<2;k++){
+        if(!(s[k].t=find_tbl(db,st->tbl[k]))){snprintf(m,sizeof(m),"Table '%s' not found",st->tbl[k]);res_err(r,m);return;}
+        if(mv_stale(s[k].t,r)) return;
+        if(s[k].t->part){snprintf(m,sizeof(m),"JOIN with partitioned table '%s' not supported",st->tbl[k]);res_err(r,m);return;}
+        strncpy(s[k].alias,st->alias[k],MAX_NAME_LEN-1);
+    }
+    int ks[2],kc[2];
+    if(jcol(s,on,&ks[0],&kc[0])||jcol(s,rhs,&ks[1],&kc[1])){snprintf(m,sizeof(m),"Bad join column in '%s = %s'",on,rhs);res_err(r,m);return;}
+    if(ks[0]==ks[1]){res_err(r,"JOIN ON must compare one column from each table");return;}
+    if(ks[0]){int x=kc[0];kc[0]=kc[1];kc[1]=x;}
+    CType kt[2]={s[0].t->cols[kc[0]].type,s[1].t->cols[kc[1]].type};
+    int dbl=kt[0]!=kt[1];
+    if(dbl&&!((kt[0]==T_INT||kt[0]==T_FLOAT)&&(kt[1]==T_INT||kt[1]==T_FLOAT))){res_err(r,"Incompatible join key types");return;}
+    if(kt[0]==T_BLOB){res_err(r,"Cannot join on BLOB columns");return;}
+    /* Projection */
+    int osd[MAX_COLUMNS],oci[MAX_COLUMNS],no=0;
+    if(st->star){
+        for(int k=0;k<2;k++) for(int j=0;j<tbl_vcols(s[k].t);j++){
+            if(no>=MAX_COLUMNS){res_err(r,"Too many columns");return;}
+            osd[no]=k; oci[no++]=j;
+        }
+    } else for(int i=0;i<st->nsel;i++){
+        const char *cn=st->sel[i].ref; int e=jcol(s,cn,&osd[no],&oci[no]);
+        if(e){snprintf(m,sizeof(m),e==-2?"Column '%s' is ambiguous":"Column '%s' not found",cn);res_err(r,m);return;}
+        no++;
+    }
+    /* WHERE placement: ws[side] below the join, wp after the probe */
+    Where ws[2]={{0},{0}},wp={0};
+    for(int i=0;i<wq->n;i++){
+        int side,ci; Cond cc=wq->c[i];
+        if(jcol(s,cc.col,&side,&ci)){snprintf(m,sizeof(m),"Column '%s' not found",cc.col);res_err(r,m);return;}
+        strncpy(cc.col,s[side].t->cols[ci].name,MAX_NAME_LEN-1);
+        Where *d=left&&side==1?&wp:&ws[side]; d->c[d->n++]=cc;
+    }
+    Filter fs[2],fp; int post=wp.n>0; Prof *pf=r->prof;
+    compile_where(s[0].t,&ws[0],pa,&fs[0],ss); compile_where(s[1].t,&ws[1],pa,&fs[1],ss); compile_where(s[1].t,&wp,pa,&fp,ss);
+    if(pf){
+        for(int k=0;k<2;k++){ snprintf(m,sizeof(m),"%s.",s[k].alias); prof_plan(pf,s[k].t,m,&fs[k],1); }
+        if(post){ snprintf(m,sizeof(m),"after join %s.",s[1].alias); prof_preds(pf,s[1].t,m,&fp); }
+        prof_note(pf,ST_JOIN,"%s hash join on %s = %s; hash table over the smaller filtered side, probed with the other",
+                  left?"LEFT":"INNER",on,rhs);
+        prof_note(pf,ST_MATERIALIZE,"%d column(s) per row",no);
+        if(pf->plan){filter_free(&fs[0]);filter_free(&fs[1]);filter_free(&fp);res_ok(r,"Planned",0);return;}
+        prof_enter(pf,ST_SCAN);
+    }
+    int ferr=jfilter(&s[0],&fs[0],pf)||jfilter(&s[1],&fs[1],pf);
+    filter_free(&fs[0]); filter_free(&fs[1]);
+    if(ferr){filter_free(&fp);free(s[0].rows);free(s[1].rows);res_err(r,"OOM");return;}
+    r->ok=1; r->ncols=no;
+    for(int k=0;k<no;k++){
+        Table *t=s[osd[k]].t;
+        strncpy(r->cname[k],sel_name(st,k,t->cols[oci[k]].name),MAX_NAME_LEN-1); r->ctype[k]=t->cols[oci[k]].type;
+    }
+    /* Build */
+    int b=s[0].n<=s[1].n?0:1, pr=1-b;
+    if(pf){
+        prof_enter(pf,ST_JOIN); pf->in[ST_JOIN]=s[0].n+s[1].n;
+        prof_note(pf,ST_JOIN,"built over %s (%d rows)",s[b].alias,s[b].n);
+    }
+    uint32_t cap=16; while(cap<(uint32_t)s[b].n*2u) cap<<=1;
+    int32_t *head=(int32_t*)malloc(sizeof(int32_t)*cap), *next=(int32_t*)malloc(sizeof(int32_t)*(s[b].n+1));
+    uint64_t *hv=(uint64_t*)malloc(sizeof(uint64_t)*(s[b].n+1));
+    int8_t *hit=(int8_t*)calloc((size_t)s[b].n+1,1);
+    if(!head||!next||!hv||!hit){free(head);free(next);free(hv);free(hit);free(s[0].rows);free(s[1].rows);filter_free(&fp);res_err(r,"OOM");return;}
+    memset(head,0xff,sizeof(int32_t)*cap);
+    Table *bt=s[b].t,*pt=s[pr].t; Row *bb=s[b].base,*pb=s[pr].base; int big=0;
+    for(int i=0;i<s[b].n&&!big;i++){
+        Row *row=&bb[s[b].rows[i]]; if(row->null[kc[b]]) continue;
+        Val tmp; hv[i]=jhash(col_val(bt,row,kc[b],&tmp),kt[b],dbl); big=col_big(bt,row,kc[b]);
+        uint32_t sl=(uint32_t)hv[i]&(cap-1); next[i]=head[sl]; head[sl]=i;
+    }
+    /* Probe */
+    for(int i=0;i<s[pr].n&&!big;i++){
+        Row *prow=&pb[s[pr].rows[i]]; int matched=0;
+        if(!prow->null[kc[pr]]&&!(big=col_big(pt,prow,kc[pr]))){
+            Val pt_,bt_; const Val *pv=col_val(pt,prow,kc[pr],&pt_); uint64_t h=jhash(pv,kt[pr],dbl);
+            for(int e=head[(uint32_t)h&(cap-1)];e>=0;e=next[e]){
+                if(hv[e]!=h) continue;
+                Row *brow=&bb[s[b].rows[e]];
+                if(!jeq(pv,kt[pr],col_val(bt,brow,kc[b],&bt_),kt[b],dbl)) continue;
+                Row *lr=b?prow:brow,*rr=b?brow:prow;
+                hit[e]=1; matched=1;
+                if(!post||eval_filter(rr,&fp)) jemit(s,osd,oci,no,lr,rr,r);
+            }
+        }
+        if(left&&pr==0&&!matched&&filter_null_ok(&fp)) jemit(s,osd,oci,no,prow,NULL,r);
+    }
+    if(left&&b==0&&!big&&filter_null_ok(&fp))
+        for(int i=0;i<s[0].n;i++) if(!hit[i]) jemit(s,osd,oci,no,&bb[s[0].rows[i]],NULL,r);
+    free(head);free(next);free(hv);free(hit);free(s[0].rows);free(s[1].rows);filter_free(&fp);
+    if(big){res_err(r,"JOIN key longer than 255 bytes");return;}
+    if(pf){
+        pf->out[ST_JOIN]=r->nrows; pf->allocs[ST_JOIN]+=4;
+        pf->bytes[ST_JOIN]+=(int64_t)sizeof(int32_t)*cap+(int64_t)(s[b].n+1)*(sizeof(int32_t)+sizeof(uint64_t)+1);
+    }
+    snprintf(m,sizeof(m),"%d row(s) returned",r->nrows);
+    strncpy(r->msg,m,sizeof(r->msg)-1); r->affected=r->nrows;
+}
+
+/* ── Partitions ─────────────────────────────────────────────── */
+/* Partition i of t, NULL if its table is missing. */
+static Table *part_tbl(DB *db,const Table *t,int i){
+    char n[MAX_NAME_LEN*2+2]; snprintf(n,sizeof(n),"%s#%s",t->name,t->part->pn[i]);
+    return find_tbl(db,n);
+}
+/* True when t is one of p's partitions. */
+static int part_of(const Table *t,const Table *p){
+    size_t l=strlen(p->name);
+    return !strncasecmp(t->name,p->name,l)&&t->name[l]=='#';
+}
+/* The partition a row whose key is the literal v belongs in: -1 when no
+   bound is above it, -2 when v is NULL. */
+static int part_find(const Table *t,const char *v){
+    const Part *pt=t->part; CType tp=t->cols[pt->key].type; Val k;
+    if(!strcasecmp(v,"NULL")) return -2;
+    str2val(v,tp,&k);
+    for(int i=0;i<pt->n;i++) if(pt->max[i]||val_cmp(&k,&pt->hi[i],tp)<0) return i;
+    return -1;
+}
+/* True when no row of partition i can pass w: some condition on the key
+   excludes its whole range, as zone_skip does for a block. */
+static int part_skip(const Table *t,int i,const Where *w,const PredT *pt,const Params *pa){
+    const Part *p=t->part; CType tp=t->cols[p->key].type;
+    for(int c=0;c<w->n;c++){
+        const PredT *q=&pt[c]; Val v;
+        if(q->ci!=p->key) continue;
+        if(q->isnull){ if(q->nullexp) return 1; continue; }   /* keys are never NULL */
+        str2val(pval(w->c[c].val,pa),tp,&v);
+        int lo=i?val_cmp(&v,&p->hi[i-1],tp):1,hi=p->max[i]?-1:val_cmp(&v,&p->hi[i],tp);
+        switch(q->op){case OP_EQ:if(lo<0||hi>=0)return 1;break;
+                      case OP_LT:if(lo<=0)return 1;break;
+                      case OP_LE:if(lo<0)return 1;break;
+                      case OP_GT:case OP_GE:if(hi>=0)return 1;break;}
+    }
+    return 0;
+}
+static void part_note(Prof *p,const Table *t,int k){
+    prof_note(p,ST_SCAN,"%s: %d of %d partition(s) left after pruning on %s",t->name,k,t->part->n,t->cols[t->part->key].name);
+}
+
+/* ── Materialized views ─────────────────────────────────────── */
+/* CREATE MATERIALIZED VIEW v AS SELECT ... FROM b [WHERE ...] [GROUP BY ...]
+   makes v a table holding the query's result. mv_apply keeps it current
+   from the row versions each writing statement creates and ends in b,
+   inside the same transaction, so v commits, rolls back and is seen by a
+   snapshot together with b. A projection view holds one version per
+   version of b passing WHERE; vrow maps the one to the other. An
+   aggregate view holds one row per group: the selected columns, then the
+   "#" columns SELECT * and DESCRIBE leave out (keys not selected, the
+   group's row count "#n", per aggregate its non-NULL count and AVG's sum,
+   and "#prev", the version it replaced). gt maps a group key to its
+   entry and gv an entry to its newest version; versions a rollback killed
+   are stepped over through #prev. A version this statement created is
+   changed in place; an older one is replaced by a new version as UPDATE
+   does, so concurrent transactions changing one group conflict. Deleting
+   a group's MIN or MAX rescans b for that group. */
+typedef struct MView {
+    char    base[MAX_NAME_LEN];
+    Where   w; PredT pt[MAX_CONDS];
+    int     agg, np, pc[MAX_COLUMNS];   /* projection: view column i is base column pc[i] */
+    GBSpec  g; int kv[MAX_COLUMNS];     /* group keys, base columns in g.kc, view columns in kv */
+    int     na, ac[MAX_AGGS], cc[MAX_AGGS], sc[MAX_AGGS];   /* view columns: value, non-NULL count, AVG sum */
+    AggSpec ag[MAX_AGGS];
+    int     cn, cp;                     /* "#n", "#prev" */
+    GTab    gt; int *gv, gvcap;
+    int    *vrow, vcap;
+    Params *pa;                         /* the query's literals, whole, as "?N" in w binds them */
+    int     stale;                      /* the last rebuild failed: unreadable and not maintained until one succeeds */
+} MView;
+
+static void mv_free(MView *m){
+    if(!m) return;
+    gt_free(&m->gt); free(m->gv); free(m->vrow); free(m->pa); free(m);
+}
+/* The newest version of a group from j on that a rollback did not kill. */
+static int mv_live(const Table *v,const MView *m,int j){
+    while(j>=0&&!ald(&v->rows[j].xmin)) j=(int)v->rows[j].data[m->cp].i;
+    return j;
+}
+/* Sets view column vc of row to column bc of base row br: DICT strings
+   get codes in the view's own dictionary, long values are shared. */
+static int mv_copy(Table *v,Row *row,int vc,const Table *b,const Row *br,int bc){
+    Cell *c=&row->data[vc];
+    if(col_ovf(&v->cols[vc])) cell_drop(c,&v->ret);
+    if((row->null[vc]=br->null[bc])) return 0;
+    if(b->cols[bc].dict){
+        int k=dict_add(&v->dict[vc],dict_str(&b->dict[bc],br->data[bc].i),&v->ret);
+        if(k<0) return -1;
+        c->i=k; return 0;
+    }
+    *c=br->data[bc];
+    if(col_ovf(&v->cols[vc])&&c->in.n>CELL_INLINE) c->ov.pg->refs++;
+    return 0;
+}
+static void mv_null(Table *v,Row *row,int vc){
+    if(col_ovf(&v->cols[vc])) cell_drop(&row->data[vc],&v->ret);
+    row->null[vc]=1;
+}
+/* Group key of base row br; -1 when a key is longer than a Val holds. */
+static int mv_key(const MView *m,const Table *b,const Row *br,Val *kt,const Val **kv,int8_t *kn){
+    for(int k=0;k<m->g.nk;k++){
+        int c=m->g.kc[k]; kv[k]=&kt[k];
+        if((kn[k]=br->null[c])) continue;
+        if(col_big(b,br,c)) return -1;
+        col_val(b,br,c,&kt[k]);
+    }
+    return 0;
+}
+/* Entry of a group key, added without a version if new; -1 on OOM. */
+static int mv_entry(MView *m,const Val **kv,const int8_t *kn){
+    if(m->gt.n>=(uint32_t)m->gvcap){
+        int c=m->gvcap?m->gvcap*2:64,*gv=(int*)realloc(m->gv,sizeof(int)*c);
+        if(!gv) return -1;
+        m->gv=gv; m->gvcap=c;
+    }
+    uint32_t n=m->gt.n; int e=gt_find(&m->g,&m->gt,gb_hash(&m->g,kv,kn),kv,kn);
+    if(e>=0&&m->gt.n>n) m->gv[e]=-1;
+    return e;
+}
+/* Adds base row br to its group (sign 1) or takes it away (-1); with br
+   NULL, only makes sure the one group of a view without keys exists.
+   Versions from n0 on are this statement's and change in place. *stale
+   gets the entry when a MIN or MAX may have left with the row. 0, -1 on
+   OOM, -2 on a write conflict, -3 for a key or MIN/MAX value too long. */
+static int mv_group(DB *db,Table *v,MView *m,const Table *b,const Row *br,int sign,Sess *s,int n0,int *stale){
+    Val kt[MAX_COLUMNS],x,y; const Val *kv[MAX_COLUMNS]; int8_t kn[MAX_COLUMNS];
+    if(br&&mv_key(m,b,br,kt,kv,kn)) return -3;
+    for(int a=0;br&&a<m->na;a++){
+        int ci=m->ag[a].ci;
+        if((m->ag[a].fn==A_MIN||m->ag[a].fn==A_MAX)&&!br->null[ci]&&col_big(b,br,ci)) return -3;
+    }
+    int e=mv_entry(m,kv,kn); if(e<0) return -1;
+    int j=mv_live(v,m,m->gv[e]),pj=j; Row *cur=j>=0?&v->rows[j]:NULL;
+    if(cur){
+        uint64_t x1=ald(&cur->xmax);
+        if(x1){ if(x1!=s->tx&&(x1&TX_BIT||x1>s->snap)) return -2; cur=NULL; }   /* else the group was emptied */
+        else if(!row_visible(cur,s->snap,s->tx)) return -2;
+    }
+    if(!cur&&sign<0) return 0;
+    int64_t cnt=(cur?cur->data[m->cn].i:0)+sign;
+    if(cur&&!cnt&&m->g.nk){
+        if(tx_reserve(s,1)) return -1;
+        tx_note(s,db,v,j,0); ast(&cur->xmax,s->tx); return 0;
+    }
+    Row nr; int inpl=cur&&j>=n0,rc=0;
+    if(cur){ nr=*cur; if(!inpl) row_share(v,&nr); }
+    else {
+        memset(&nr,0,sizeof(nr)); memset(nr.null,1,(size_t)v->ncols);
+        for(int k=0;k<m->g.nk&&!rc;k++) rc=mv_copy(v,&nr,m->kv[k],b,br,m->g.kc[k]);
+        for(int a=0;a<m->na;a++){
+            if(m->ag[a].fn==A_COUNT) nr.null[m->ac[a]]=0;
+            if(m->cc[a]>=0) nr.null[m->cc[a]]=0;
+            if(m->sc[a]>=0) nr.null[m->sc[a]]=0;
+        }
+        nr.null[m->cn]=nr.null[m->cp]=0;
+    }
+    nr.data[m->cn].i=cnt;
+    for(int a=0;br&&a<m->na&&!rc;a++){
+        const AggSpec *g=&m->ag[a]; int vc=m->ac[a];
+        if(g->ci<0||(g->fn==A_COUNT&&!br->null[g->ci])){ nr.data[vc].i+=sign; continue; }
+        if(br->null[g->ci]||g->fn==A_COUNT) continue;
+        const Cell *bc=&br->data[g->ci]; CType tp=b->cols[g->ci].type;
+        int64_t c=nr.data[m->cc[a]].i+=sign;
+        if(g->fn==A_SUM||g->fn==A_AVG){
+            Cell *sm=&nr.data[g->fn==A_SUM?vc:m->sc[a]];
+            if(tp==T_FLOAT) sm->f=c?sm->f+sign*bc->f:0;
+            else sm->i=c?sm->i+sign*(tp==T_BOOL?bc->b:bc->i):0;
+            nr.null[vc]=!c;
+            if(c&&g->fn==A_AVG) nr.data[vc].f=tp==T_FLOAT?sm->f/c:(double)sm->i/c;
+            continue;
+        }
+        if(!c){ mv_null(v,&nr,vc); continue; }
+        int d=nr.null[vc]?0:val_cmp(col_val(b,br,g->ci,&x),col_val(v,&nr,vc,&y),tp);
+        if(sign<0){ if(!d&&!nr.null[vc]) *stale=e; }
+        else if(nr.null[vc]||(g->fn==A_MIN?d<0:d>0)) rc=mv_copy(v,&nr,vc,b,br,g->ci);
+    }
+    if(inpl){
+        int8_t on[MAX_COLUMNS]; memcpy(on,cur->null,sizeof(on));
+        *cur=nr;   /* even after OOM: each cell holds its own reference */
+        return rc||zone_note(v,j,on)?-1:0;
+    }
+    Row *row=rc?NULL:tbl_append(v);
+    if(!row||tx_reserve(s,2)){ row_drop(v,&nr,&v->ret); return -1; }
+    nr.xmin=s->tx; nr.xmax=0; nr.data[m->cp].i=pj;
+    *row=nr;
+    if(zone_note(v,v->nrows,NULL)){ row_drop(v,row,&v->ret); return -1; }
+    tx_note(s,db,v,v->nrows,1);
+    if(cur){ tx_note(s,db,v,j,0); ast(&v->rows[j].xmax,s->tx); }
+    m->gv[e]=v->nrows; ast(&v->nrows,v->nrows+1);
+    return 0;
+}
+/* Adds a view version for base version bj (sign 1) or ends it (-1). */
+static int mv_proj(DB *db,Table *v,MView *m,const Table *b,int bj,int sign,Sess *s){
+    if(sign<0){
+        int j=bj<m->vcap?m->vrow[bj]:-1;
+        if(j<0) return 0;
+        if(tx_reserve(s,1)) return -1;
+        tx_note(s,db,v,j,0); ast(&v->rows[j].xmax,s->tx); return 0;
+    }
+    if(bj>=m->vcap){
+        int c=m->vcap?m->vcap:64; while(c<=bj) c*=2;
+        int *vr=(int*)realloc(m->vrow,sizeof(int)*c); if(!vr) return -1;
+        for(int i=m->vcap;i<c;i++) vr[i]=-1;
+        m->vrow=vr; m->vcap=c;
+    }
+    Row *row=tbl_append(v); if(!row||tx_reserve(s,1)) return -1;
+    for(int c=0;c<m->np;c++) if(mv_copy(v,row,c,b,&b->rows[bj],m->pc[c])){ row_drop(v,row,&v->ret); return -1; }
+    row->xmin=s->tx;
+    if(zone_note(v,v->nrows,NULL)){ row_drop(v,row,&v->ret); return -1; }
+    tx_note(s,db,v,v->nrows,1); m->vrow[bj]=v->nrows; ast(&v->nrows,v->nrows+1);
+    return 0;
+}
+/* Recomputes MIN and MAX of the ns groups in st from the base rows f
+   sees; their newest versions are this statement's own. */
+static int mv_rescan(Table *v,MView *m,const Table *b,const Filter *f,const int *st,int ns){
+    uint32_t ne=m->gt.n; uint8_t *mk=(uint8_t*)calloc(ne+1,1); if(!mk) return -1;
+    Val kt[MAX_COLUMNS],x,y; const Val *kv[MAX_COLUMNS]; int8_t kn[MAX_COLUMNS]; int rc=0;
+    for(int i=0;i<ns;i++){
+        int j=mv_live(v,m,m->gv[st[i]]);
+        if(j<0||ald(&v->rows[j].xmax)) continue;
+        mk[st[i]]=1;
+        for(int a=0;a<m->na;a++) if(m->ag[a].fn==A_MIN||m->ag[a].fn==A_MAX) mv_null(v,&v->rows[j],m->ac[a]);
+    }
+    for(int j=0;j<f->nrows&&!rc;j++){
+        const Row *br=&f->rows[j];
+        if(!eval_filter(br,f)||mv_key(m,b,br,kt,kv,kn)) continue;
+        int e=mv_entry(m,kv,kn);
+        if(e<0){ rc=-1; break; }
+        if((uint32_t)e>=ne||!mk[e]) continue;
+        Row *vr=&v->rows[mv_live(v,m,m->gv[e])];
+        for(int a=0;a<m->na&&!rc;a++){
+            const AggSpec *g=&m->ag[a]; int vc=m->ac[a];
+            if((g->fn!=A_MIN&&g->fn!=A_MAX)||br->null[g->ci]) continue;
+            int d=vr->null[vc]?0:val_cmp(col_val(b,br,g->ci,&x),col_val(v,vr,vc,&y),b->cols[g->ci].type);
+            if(vr->null[vc]||(g->fn==A_MIN?d<0:d>0)) rc=mv_copy(v,vr,vc,b,br,g->ci);
+        }
+    }
+    /* a group with non-NULL values found one again: the null map is as before */
+    for(int i=0;i<ns&&!rc;i++) if(mk[st[i]]){ int j=mv_live(v,m,m->gv[st[i]]); rc=zone_note(v,j,v->rows[j].null); }
+    free(mk); return rc;
+}
+/* Brings every view up to date with the base row versions s's statement
+   created and ended since log entry `from`. 0, or -1 with the error in r;
+   the caller then undoes the statement, view changes included. */
+static int mv_apply(DB *db,Sess *s,int from,Res *r){
+    int end=s->nlog;
+    for(int i=0;i<db->hdr.ntables;i++){
+        Table *v=&db->tbl[i],*b; MView *m=v->mv;
+        if(!m||m->stale||!(b=find_tbl(db,m->base))) continue;
+        int bi=(int)(b-db->tbl),k=from,n0=v->nrows,rc=0,ns=0,*st=NULL,nd=0; char e[192];
+        while(k<end&&s->log[k].ti!=bi) k++;
+        if(k==end) continue;
+        PROF(r,ST_WRITE);
+        Filter f; m->g.t=b; where_bind(b,&m->w,m->pt,m->pa,&f,s);
+        for(;k<end&&!rc;k++){
+            TxLog l=s->log[k]; int sg=l.ins?1:-1,x=-1;
+            if(l.ti!=bi) continue;
+            if((l.ins||m->agg)&&!eval_preds(&b->rows[l.j],&f)) continue;
+            if(!m->agg){ rc=mv_proj(db,v,m,b,l.j,sg,s); nd++; continue; }
+            rc=mv_group(db,v,m,b,&b->rows[l.j],sg,s,n0,&x); nd++;
+            if(!rc&&x>=0){
+                int *ns2=(int*)realloc(st,sizeof(int)*(ns+1));
+                if(!ns2) rc=-1; else { st=ns2; st[ns++]=x; }
+            }
+        }
+        if(!rc&&ns) rc=mv_rescan(v,m,b,&f,st,ns);
+        free(st); filter_free(&f);
+        if(rc==-2){ res_err(r,ERR_CONFLICT); return -1; }
+        if(rc){
+            if(rc==-3) snprintf(e,sizeof(e),"Materialized view '%s': key or MIN/MAX value longer than 255 bytes",v->name);
+            else snprintf(e,sizeof(e),"Materialized view '%s': out of memory",v->name);
+            res_err(r,e); return -1;
+        }
+        if(r->prof) prof_note(r->prof,ST_WRITE,"maintain view %s: %d change(s)%s",v->name,nd,ns?", MIN/MAX rescanned":"");
+    }
+    return 0;
+}
+/* Rebuilds v from the committed rows of its base table, stamped ts. For
+   CREATE, loading and VACUUM: ddl is held exclusively and no transaction
+   is open, so nothing else sees v meanwhile. */
+static int mv_refresh(DB *db,Table *v,uint64_t ts){
+    MView *m=v->mv; Table *b=find_tbl(db,m->base); int rc=0;
+    if(!b) return -1;
+    for(int j=0;j<v->nrows;j++) row_drop(v,&v->rows[j],NULL);
+    v->nrows=0; ret_free(&v->ret,UINT64_MAX);
+    gt_free(&m->gt); m->g.t=b;
+    for(int j=0;j<m->vcap;j++) m->vrow[j]=-1;
+    Sess s; memset(&s,0,sizeof(s)); s.tx=s.snap=ts;
+    Filter f; where_bind(b,&m->w,m->pt,m->pa,&f,&s);
+    for(int j=0;j<f.nrows&&!rc;j++){
+        if(!eval_filter(&b->rows[j],&f)) continue;
+        rc=m->agg?mv_group(db,v,m,b,&b->rows[j],1,&s,0,NULL):mv_proj(db,v,m,b,j,1,&s);
+    }
+    if(!rc&&m->agg&&!m->g.nk&&!v->nrows) rc=mv_group(db,v,m,b,NULL,0,&s,0,NULL);
+    filter_free(&f); free(s.log);
+    if(zone_rebuild(v)) rc=-1;
+    v->relsn=ts; m->stale=rc!=0;
+    return rc;
+}
+/* True, with the error in r, when t is a view mv_refresh left half-built. */
+static int mv_stale(const Table *t,Res *r){
+    char m[192];
+    if(!t->mv||!t->mv->stale) return 0;
+    snprintf(m,sizeof(m),"Materialized view '%s' is incomplete after a failed rebuild; run VACUUM, reopen the file or re-create it",t->name);
+    res_err(r,m); return 1;
+}
+/* Appends a view column; -1 when the view would have too many. */
+static int mv_col(Col *cols,int *nc,const Col *from,const char *name,CType tp){
+    if(*nc>=MAX_COLUMNS) return -1;
+    Col *c=&cols[(*nc)++];
+    if(from) *c=*from; else { memset(c,0,sizeof(*c)); c->type=tp; }
+    snprintf(c->name,MAX_NAME_LEN,"%s",name); c->pk=0; c->nullable=1;
+    return 0;
+}
+static int sql_norm(const char *in,char *key,Params *pa);
+/* Compiles view v from v->mvsql against its base table and fills it,
+   stamped ts: at CREATE, where v has no columns yet and gets them here,
+   and when a file is loaded, where the saved ones must match. 0, or -1
+   with the error in r. */
+static int mv_compile(DB *db,Table *v,Res *r,uint64_t ts){
+    Stmt *st=(Stmt*)malloc(sizeof(Stmt)); MView *m=(MView*)calloc(1,sizeof(MView));
+    size_t n=strlen(v->mvsql); char *q=(char*)calloc(n+2,1),*key=(char*)malloc(MAX_SQL_LEN);   /* the lexer peeks one past the end */
+    Col cols[MAX_COLUMNS]; int nc=0; char e[192]="",h[16]; Table *b=NULL;
+    if(m) m->pa=(Params*)malloc(sizeof(Params));
+    if(!st||!m||!q||!key||!m->pa){ free(st); mv_free(m); free(q); free(key); res_err(r,"OOM"); return -1; }
+    memcpy(q,v->mvsql,n);
+    /* literals are lifted as do_stmt lifts them, so long ones stay whole */
+    int lift=n<MAX_SQL_LEN&&!sql_norm(q,key,m->pa);
+    if(!lift){ free(m->pa); m->pa=NULL; }
+    int rc=parse_sql(q,st,lift,r); free(q); free(key);
+    if(rc){ free(st); mv_free(m); return -1; }
+    for(int i=0;i<st->nsel;i++) m->agg|=st->sel[i].fn!=0;
+    m->agg|=st->ngrp>0;
+    if(st->kind!=SQ_SELECT) snprintf(e,sizeof(e),"Expected AS SELECT");
+    else if(st->ntbl>1) snprintf(e,sizeof(e),"Materialized views over a JOIN are not supported");
+    else if(!(b=find_tbl(db,st->tbl[0]))) snprintf(e,sizeof(e),"Table '%s' not found",st->tbl[0]);
+    else if(b->mv) snprintf(e,sizeof(e),"'%s' is a materialized view; build on its base table",b->name);
+    else if(b->part||strchr(b->name,'#')) snprintf(e,sizeof(e),"Materialized views over partitioned tables are not supported");
+    if(!*e){
+        where_resolve(b,&st->w,m->pt); m->w=st->w;
+        for(int i=0;i<st->w.n;i++) if(m->pt[i].ci<0) snprintf(e,sizeof(e),"Column '%s' not found",st->w.c[i].col);
+    }
+    if(!*e&&!m->agg){
+        for(int i=0;i<(st->star?b->ncols:st->nsel)&&!*e;i++){
+            int ci=st->star?i:col_idx(b,st->sel[i].ref);
+            if(ci<0) snprintf(e,sizeof(e),"Column '%s' not found",st->sel[i].ref);
+            else if(mv_col(cols,&nc,&b->cols[ci],sel_name(st,i,b->cols[ci].name),0)) snprintf(e,sizeof(e),"Too many columns");
+            else m->pc[m->np++]=ci;
+        }
+    } else if(!*e){
+        GBSpec *g=&m->g;
+        for(int i=0;i<st->ngrp&&!*e;i++){
+            int ci=col_idx(b,st->grp[i]);
+            if(ci<0) snprintf(e,sizeof(e),"Column '%s' not found",st->grp[i]);
+            else if(b->cols[ci].type==T_BLOB) snprintf(e,sizeof(e),"Cannot GROUP BY BLOB column '%s'",st->grp[i]);
+            else { m->kv[g->nk]=-1; g->kc[g->nk++]=ci; }
+        }
+        for(int i=0;i<st->nsel&&!*e;i++){
+            const SelItem *it=&st->sel[i]; int k=0;
+            if(it->fn){
+                AggSpec a={(AggFn)it->fn,-1};
+                int bad=!strcmp(it->ref,"*")?a.fn!=A_COUNT:(a.ci=col_idx(b,it->ref))<0||
+                        ((a.fn==A_SUM||a.fn==A_AVG)&&b->cols[a.ci].type==T_TEXT)||
+                        (a.fn!=A_COUNT&&b->cols[a.ci].type==T_BLOB);
+                if(bad){ snprintf(e,sizeof(e),"Bad aggregate '%s'",it->text); break; }
+                if(m->na>=MAX_AGGS){ snprintf(e,sizeof(e),"Too many aggregates"); break; }
+                m->ac[m->na]=nc; m->ag[m->na++]=a;
+                if(mv_col(cols,&nc,a.fn==A_MIN||a.fn==A_MAX?&b->cols[a.ci]:NULL,it->text,agg_type(&a,b)))
+                    snprintf(e,sizeof(e),"Too many columns");
+                continue;
+            }
+            while(k<g->nk&&strcasecmp(b->cols[g->kc[k]].name,it->ref)) k++;
+            if(k==g->nk){ snprintf(e,sizeof(e),"Column '%s' must appear in GROUP BY",it->text); break; }
+            if(m->kv[k]<0) m->kv[k]=nc;
+            if(mv_col(cols,&nc,&b->cols[g->kc[k]],sel_name(st,i,b->cols[g->kc[k]].name),0)) snprintf(e,sizeof(e),"Too many columns");
+        }
+        for(int k=0;k<g->nk&&!*e;k++){
+            if(m->kv[k]>=0) continue;
+            snprintf(h,sizeof(h),"#k%d",k); m->kv[k]=nc;
+            if(mv_col(cols,&nc,&b->cols[g->kc[k]],h,0)) snprintf(e,sizeof(e),"Too many columns");
+        }
+        m->cn=nc;
+        if(!*e&&mv_col(cols,&nc,NULL,"#n",T_INT)) snprintf(e,sizeof(e),"Too many columns");
+        for(int a=0;a<m->na&&!*e;a++){
+            const AggSpec *ag=&m->ag[a]; m->cc[a]=m->sc[a]=-1;
+            if(ag->fn==A_COUNT) continue;
+            snprintf(h,sizeof(h),"#c%d",a); m->cc[a]=nc;
+            if(mv_col(cols,&nc,NULL,h,T_INT)) snprintf(e,sizeof(e),"Too many columns");
+            if(ag->fn!=A_AVG||*e) continue;
+            snprintf(h,sizeof(h),"#s%d",a); m->sc[a]=nc;
+            if(mv_col(cols,&nc,NULL,h,b->cols[ag->ci].type==T_FLOAT?T_FLOAT:T_INT)) snprintf(e,sizeof(e),"Too many columns");
+        }
+        m->cp=nc;
+        if(!*e&&mv_col(cols,&nc,NULL,"#prev",T_INT)) snprintf(e,sizeof(e),"Too many columns");
+    }
+    for(int i=0;i<nc&&!*e&&cols[i].name[0]!='#';i++)
+        for(int j=0;j<i;j++) if(!strcasecmp(cols[i].name,cols[j].name)){
+            snprintf(e,sizeof(e),"Duplicate column '%s'; name it with AS",cols[i].name); break;
+        }
+    if(!*e&&v->ncols){
+        int ok=v->ncols==nc;
+        for(int i=0;ok&&i<nc;i++) ok=!strcmp(v->cols[i].name,cols[i].name)&&v->cols[i].type==cols[i].type&&v->cols[i].dict==cols[i].dict;
+        if(!ok) snprintf(e,sizeof(e),"Materialized view '%s' does not match its definition",v->name);
+    }
+    free(st);
+    if(*e){ mv_free(m); res_err(r,e); return -1; }
+    if(!v->ncols){ memcpy(v->cols,cols,sizeof(Col)*(size_t)nc); v->ncols=nc; }
+    snprintf(m->base,sizeof(m->base),"%s",b->name);
+    mv_free(v->mv); v->mv=m;
+    if(mv_refresh(db,v,ts)){ res_err(r,"Materialized view: building the rows failed (out of memory or a value longer than 255 bytes)"); return -1; }
+    return 0;
+}
+
+/* ── Commands ───────────────────────────────────────────────── */
+static void do_create(DB *db,char *sql,Res *r){
+    if(db->hdr.ntables>=MAX_TABLES){res_err(r,"Max tables reached");return;}
+    Stmt *st=(Stmt*)malloc(sizeof(Stmt)); if(!st){res_err(r,"OOM");return;}
+    if(parse_sql(sql,st,0,r)){free(st);return;}
+    char m[192]; const char *tn=st->tbl[0]; int pk=-1;
+    for(int j=0;*st->pkey&&j<st->ndef;j++) if(!strcasecmp(st->def[j].name,st->pkey)) pk=j;
+    if(st->kind!=SQ_CREATE) res_err(r,"Expected CREATE TABLE");
+    else if(find_tbl(db,tn)){snprintf(m,sizeof(m),"Table '%s' exists",tn);res_err(r,m);}
+    else if(*st->pkey&&(pk<0||(st->def[pk].type!=T_INT&&st->def[pk].type!=T_FLOAT)))
+        {snprintf(m,sizeof(m),"Partition key '%s' must be an INT or FLOAT column",st->pkey);res_err(r,m);}
+    else{
+        Table *t=&db->tbl[db->hdr.ntables];
+        memset(t,0,sizeof(Table));
+        strcpy(t->name,tn);
+        t->cap=16; t->rows=(Row*)malloc(sizeof(Row)*t->cap);
+        if(pk>=0&&(t->part=(Part*)calloc(1,sizeof(Part)))) t->part->key=pk;
+        if(!t->rows||(pk>=0&&!t->part)){free(t->rows);free(t->part);free(st);res_err(r,"OOM");return;}
+        memcpy(t->cols,st->def,sizeof(Col)*(size_t)st->ndef); t->ncols=st->ndef; t->relsn=db->wts;
+        db->hdr.ntables++; pc_clear(db);
+        save_db(db);
+        if(pk<0) snprintf(m,sizeof(m),"Table '%s' created (%d cols)",tn,t->ncols);
+        else snprintf(m,sizeof(m),"Table '%s' created (%d cols, partitioned by %s)",tn,t->ncols,st->pkey);
+        res_ok(r,m,0);
+    }
+    free(st);
+}
+
+/* Frees table idx and closes the gap it leaves in db->tbl; the caller
+   holds ddl exclusively and no transaction is open. */
+static void tbl_drop(DB *db,int idx){
+    Table *t=&db->tbl[idx];
+    for(int j=0;j<t->nrows;j++) row_drop(t,&t->rows[j],NULL);
+    free(t->rows); free(t->zones); free(t->stats); free(t->part); free(t->mvsql); mv_free(t->mv);
+    for(int k=0;k<t->nix;k++) ix_free(t,t->ix[k]);
+    for(int c=0;c<t->ncols;c++) dict_free(&t->dict[c]);
+    ret_free(&t->ret,UINT64_MAX);
+    for(int i=idx;i<db->hdr.ntables-1;i++) db->tbl[i]=db->tbl[i+1];
+    db->hdr.ntables--;
+}
+/* CREATE MATERIALIZED VIEW name AS SELECT ...: see Materialized views. */
+static void do_mview(DB *db,const char *sql,Res *r){
+    Lex l; lex_init(&l,sql); for(int i=0;i<3;i++) lex_next(&l);   /* CREATE MATERIALIZED VIEW */
+    char vn[MAX_NAME_LEN],m[192];
+    if(l.t.k!=TK_ID||l.t.n>=MAX_NAME_LEN){res_err(r,"Expected CREATE MATERIALIZED VIEW name AS SELECT ...");return;}
+    tok_lit(&l.t,vn,sizeof(vn)); lex_next(&l);
+    if(!tok_is(&l.t,"AS")){res_err(r,"Expected AS SELECT after the view name");return;}
+    lex_next(&l);
+    if(find_tbl(db,vn)){snprintf(m,sizeof(m),"Table '%s' exists",vn);res_err(r,m);return;}
+    if(db->hdr.ntables>=MAX_TABLES){res_err(r,"Max tables reached");return;}
+    Table *v=&db->tbl[db->hdr.ntables];
+    memset(v,0,sizeof(Table));
+    strcpy(v->name,vn);
+    if(!(v->mvsql=strdup(l.t.s))){res_err(r,"OOM");return;}
+    db->hdr.ntables++;
+    if(mv_compile(db,v,r,db->wts)){ tbl_drop(db,db->hdr.ntables-1); return; }
+    pc_clear(db);
+    save_db(db);
+    snprintf(m,sizeof(m),"Materialized view '%s' created (%d row(s))",vn,v->nrows);
+    res_ok(r,m,0);
+}
+/* CREATE INDEX x ON t (key) [INCLUDE (c, ...)] / DROP INDEX x: see
+   Indexes. Index names are unique across the database. */
+static Index *find_ix(DB *db,const char *n,Table **tp){
+    for(int i=0;i<db->hdr.ntables;i++) for(int k=0;k<db->tbl[i].nix;k++)
+        if(!strcasecmp(db->tbl[i].ix[k]->name,n)){ if(tp) *tp=&db->tbl[i]; return db->tbl[i].ix[k]; }
+    return NULL;
+}
+static void do_index(DB *db,const char *sql,Res *r){
+    Lex l; lex_init(&l,sql); int drop=tok_is(&l.t,"DROP"); lex_next(&l); lex_next(&l);   /* CREATE|DROP INDEX */
+    char xn[MAX_NAME_LEN],tn[MAX_NAME_LEN],cn[MAX_NAME_LEN],m[192]; Table *t=NULL;
+    if(l.t.k!=TK_ID||l.t.n>=MAX_NAME_LEN){res_err(r,drop?"Expected DROP INDEX name":"Expected CREATE INDEX name ON table (column)");return;}
+    tok_lit(&l.t,xn,sizeof(xn)); lex_next(&l);
+    Index *x=find_ix(db,xn,&t);
+    if(drop){
+        if(l.t.k!=TK_END){snprintf(m,sizeof(m),"Unexpected '%.*s' after the index name",l.t.n,l.t.s);res_err(r,m);return;}
+        if(!x){snprintf(m,sizeof(m),"Index '%s' not found",xn);res_err(r,m);return;}
+        int k=0; while(t->ix[k]!=x) k++;
+        ix_free(t,x); memmove(&t->ix[k],&t->ix[k+1],sizeof(Index*)*(size_t)(--t->nix-k));
+        pc_clear(db); save_db(db);
+        snprintf(m,sizeof(m),"Index '%s' dropped",xn);res_ok(r,m,0);return;
+    }
+    if(x){snprintf(m,sizeof(m),"Index '%s' exists",xn);res_err(r,m);return;}
+    if(!tok_is(&l.t,"ON")){res_err(r,"Expected ON table after the index name");return;}
+    lex_next(&l); tok_lit(&l.t,tn,sizeof(tn));
+    if(l.t.k!=TK_ID||!(t=find_tbl(db,tn))){snprintf(m,sizeof(m),"Table '%.*s' not found",l.t.n,l.t.s);res_err(r,m);return;}
+    if(t->mv||t->part||strchr(t->name,'#')){res_err(r,"Indexes on materialized views and partitioned tables are not supported");return;}
+    if(t->nix>=MAX_INDEXES){res_err(r,"Max indexes per table reached");return;}
+    if(!(x=(Index*)calloc(1,sizeof(Index)))){res_err(r,"OOM");return;}
+    strcpy(x->name,xn); lex_next(&l);
+    for(int inc=0;inc<2;inc++){
+        if(inc){ if(l.t.k==TK_END) break; if(!tok_is(&l.t,"INCLUDE")){snprintf(m,sizeof(m),"Expected INCLUDE (columns) near '%.*s'",l.t.n,l.t.s);goto bad;} lex_next(&l); }
+        if(l.t.k!=TK_PUNCT||*l.t.s!='('){res_err(r,"Expected ( column list )");free(x);return;}
+        do {
+            lex_next(&l); tok_lit(&l.t,cn,sizeof(cn));
+            int ci=l.t.k==TK_ID?col_idx(t,cn):-1;
+            if(ci<0){snprintf(m,sizeof(m),"Column '%.*s' not found",l.t.n,l.t.s);goto bad;}
+            if(ix_has(x,ci)){snprintf(m,sizeof(m),"Column '%s' listed twice",t->cols[ci].name);goto bad;}
+            if(!x->nc&&t->cols[ci].type==T_BLOB){snprintf(m,sizeof(m),"BLOB column '%s' cannot be an index key",cn);goto bad;}
+            x->col[x->nc++]=ci; lex_next(&l);
+        } while(!inc?0:l.t.k==TK_PUNCT&&*l.t.s==',');
+        if(l.t.k!=TK_PUNCT||*l.t.s!=')'){snprintf(m,sizeof(m),inc?"Expected , or ) near '%.*s'":"An index has one key column; use INCLUDE for others (near '%.*s')",l.t.n,l.t.s);goto bad;}
+        lex_next(&l);
+    }
+    if(l.t.k!=TK_END){snprintf(m,sizeof(m),"Unexpected '%.*s' after the column list",l.t.n,l.t.s);goto bad;}
+    if(ix_build(t,x)){res_err(r,"OOM");ix_free(t,x);return;}
+    t->ix[t->nix++]=x;
+    pc_clear(db); save_db(db);
+    snprintf(m,sizeof(m),"Index '%s' on '%s' created (%d entries)",xn,t->name,x->run->nm);
+    res_ok(r,m,0); return;
+bad:
+    res_err(r,m); free(x);
+}
+static void do_drop(DB *db,char *sql,Res *r){
+    Stmt *st=(Stmt*)malloc(sizeof(Stmt)); if(!st){res_err(r,"OOM");return;}
+    if(parse_sql(sql,st,0,r)){free(st);return;}
+    char m[128],tn[MAX_NAME_LEN]; strcpy(tn,st->tbl[0]);
+    int kind=st->kind; free(st);
+    if(kind!=SQ_DROP&&kind!=SQ_DROPMV){res_err(r,"Expected DROP TABLE");return;}
+    Table *t=find_tbl(db,tn);
+    if(!t){snprintf(m,128,"Table '%s' not found",tn);res_err(r,m);return;}
+    if(kind==SQ_DROPMV&&!t->mv){snprintf(m,128,"'%s' is not a materialized view",tn);res_err(r,m);return;}
+    if(kind==SQ_DROP&&t->mv){snprintf(m,128,"'%s' is a materialized view; use DROP MATERIALIZED VIEW",tn);res_err(r,m);return;}
+    for(int i=0;i<db->hdr.ntables;i++) if(db->tbl[i].mv&&!strcasecmp(db->tbl[i].mv->base,tn)){
+        snprintf(m,128,"Materialized view '%s' depends on '%s'; drop it first",db->tbl[i].name,tn);res_err(r,m);return;
+    }
+    for(int i=t->part?t->part->n-1:-1;i>=0;i--){
+        Table *c=part_tbl(db,t,i);
+        if(c){ tbl_drop(db,(int)(c-db->tbl)); t=find_tbl(db,tn); }
+    }
+    tbl_drop(db,(int)(t-db->tbl)); pc_clear(db);
+    save_db(db);
+    snprintf(m,128,"%s '%s' dropped",kind==SQ_DROP?"Table":"Materialized view",tn);res_ok(r,m,0);
+}
+
+/* A parsed statement with its names resolved: table and column ordinals,
+   WHERE reduced to PredT. Literals stay text, possibly "?N" placeholders
+   bound through pval on each run, so one plan serves every statement of the
+   same shape. Runs only read a plan; cached ones are shared, refs counting
+   the cache and each run holding it. PL_NONE is a SELECT with JOIN,
+   GROUP BY or aggregates, which resolves its names as it runs. A
+   PL_SELECT reads index ix of its table (-1: none), from the entries
+   alone when cover is set. */
+enum { PL_NONE, PL_SELECT, PL_INSERT, PL_UPDATE, PL_DELETE };
+typedef struct Plan {
+    int kind, ti, refs, nc, oc[MAX_COLUMNS], ix, cover;
+    PredT pt[MAX_CONDS];
+    Stmt st;
+} Plan;
+
+/* Picks the index a PL_SELECT reads: one it can answer from alone and
+   whose key a condition bounds, else one of the two; among equals, with
+   statistics, the one whose key has the most distinct values. Whether the
+   bound literals leave the key range narrow enough is left to ix_worth,
+   as cached plans are shared by every literal. */
+static void pl_index(const Table *t,Plan *pl){
+    int best=0; double bd=-1; const TStat *st=ald(&t->stats);
+    pl->ix=-1; pl->cover=0;
+    if(pl->kind!=PL_SELECT) return;
+    for(int i=0;i<t->nix;i++){
+        const Index *x=t->ix[i]; int cover=1,key=0;
+        for(int k=0;k<pl->nc;k++) cover&=ix_has(x,pl->oc[k]);
+        for(int c=0;c<pl->st.w.n;c++){
+            const PredT *q=&pl->pt[c];
+            cover&=q->ci>=0&&ix_has(x,q->ci);
+            key|=q->ci==x->col[0]&&!q->isnull&&q->op!=OP_NE;
+        }
+        double d=st?st->c[x->col[0]].ndv:0;
+        if(2*key+cover>best||(best&&2*key+cover==best&&d>bd)){ best=2*key+cover; bd=d; pl->ix=i; pl->cover=cover; }
+    }
+}
+/* Resolves pl->st (a SELECT, INSERT, UPDATE or DELETE): 0, or -1 with
+   the error in r. */
+static int plan_build(DB *db,Plan *pl,Res *r){
+    const Stmt *st=&pl->st; char m[128];
+    pl->nc=0; pl->kind=PL_NONE;
+    if(st->kind==SQ_SELECT){
+        if(st->ntbl>1||st->ngrp) return 0;
+        for(int i=0;i<st->nsel;i++) if(st->sel[i].fn) return 0;
+    }
+    Table *t=find_tbl(db,st->tbl[0]);
+    if(!t){snprintf(m,sizeof(m),"Table '%s' not found",st->tbl[0]);res_err(r,m);return -1;}
+    pl->ti=(int)(t-db->tbl);
+    if(st->kind!=SQ_SELECT&&t->mv){snprintf(m,sizeof(m),"Materialized view '%s' is read-only",t->name);res_err(r,m);return -1;}
+    switch(st->kind){
+        case SQ_SELECT:
+            pl->kind=PL_SELECT;
+            if(st->star){ for(int j=0;j<tbl_vcols(t);j++) pl->oc[pl->nc++]=j; break; }
+            for(int i=0;i<st->nsel;i++){
+                int ci=col_idx(t,st->sel[i].ref);
+                if(ci<0){snprintf(m,sizeof(m),"Column '%s' not found",st->sel[i].ref);res_err(r,m);return -1;}
+                pl->oc[pl->nc++]=ci;
+            }
+            break;
+        case SQ_INSERT:
+            pl->kind=PL_INSERT;
+            if(st->ncol<0){ for(int j=0;j<t->ncols;j++) pl->oc[pl->nc++]=j; }
+            else for(int i=0;i<st->ncol;i++){
+                int ci=col_idx(t,st->col[i]);
+                if(ci<0){snprintf(m,sizeof(m),"Column '%s' not found",st->col[i]);res_err(r,m);return -1;}
+                pl->oc[pl->nc++]=ci;
+            }
+            if(st->nval>pl->nc){snprintf(m,sizeof(m),"%d value(s) for %d column(s)",st->nval,pl->nc);res_err(r,m);return -1;}
+            break;
+        case SQ_UPDATE:
+            /* an unknown SET column is skipped (oc -1), not an error */
+            pl->kind=PL_UPDATE;
+            for(int i=0;i<st->ncol;i++) pl->oc[pl->nc++]=col_idx(t,st->col[i]);
+            break;
+        default: pl->kind=PL_DELETE; break;
+    }
+    where_resolve(t,&st->w,pl->pt);
+    pl_index(t,pl);
+    return 0;
+}
+
+static void run_insert(DB *db,Table *t,const Plan *pl,const Params *pa,Res *r,Sess *s){
+    if(r->prof){
+        prof_note(r->prof,ST_WRITE,"append 1 row version to %s",t->name);
+        if(r->prof->plan){res_ok(r,"Planned",0);return;}
+        prof_enter(r->prof,ST_WRITE); r->prof->in[ST_WRITE]=r->prof->out[ST_WRITE]=1; r->prof->bytes[ST_WRITE]=sizeof(Row);
+    }
+    Row *row=tbl_append(t); if(!row||tx_reserve(s,1)){res_err(r,"OOM");return;}
+    for(int j=0;j<t->ncols;j++) row->null[j]=1;
+    for(int vi=0;vi<pl->st.nval;vi++){
+        int ci=pl->oc[vi]; const char *v=pval(pl->st.val[vi],pa);
+        if(col_set(t,row,ci,strcasecmp(v,"NULL")?v:NULL)){row_drop(t,row,&t->ret);res_err(r,"OOM");return;}
+    }
+    row->xmin=s->tx;
+    if(zone_note(t,t->nrows,NULL)||ix_note(t,t->nrows)){row_drop(t,row,&t->ret);res_err(r,"OOM");return;}
+    tx_note(s,db,t,t->nrows,1); ast(&t->nrows,t->nrows+1); ast(&t->next_id,t->next_id+1);
+    res_ok(r,"1 row inserted",1);
+}
+
+/* SELECT through index x: the sorted entries in the key range the
+   conditions on the key bound, then the whole tail. A TEXT key compares
+   by its first MAX_STR_LEN-1 bytes, so its bounds are taken inclusive;
+   each entry is tested against every condition anyway. With cover set,
+   the conditions and result read a scratch row holding the entry's
+   cells, and of the version itself only xmin/xmax; otherwise the version. */
+static void run_ixscan(Table *t,const Plan *pl,Filter *f,Res *r){
+    const Index *x=t->ix[pl->ix]; const IxRun *ir=ald(&x->run); Prof *pr=r->prof;
+    int nm=ir->nm,nt=ald(&ir->nt),lo=0,hi=nm,key=x->col[0],no=pl->nc,seen=0,exact=t->cols[key].type!=T_TEXT;
+    for(int i=0;i<f->n;i++){
+        const Pred *p=&f->p[i];
+        if(p->ci!=key||p->isnull) continue;
+        if(!lo) lo=ix_bound(t,x,ir,NULL,1);   /* past the NULL keys */
+        int a=p->op==OP_EQ||p->op==OP_GE||(p->op==OP_GT&&!exact),b=p->op==OP_EQ||p->op==OP_LE||(p->op==OP_LT&&!exact);
+        if(a||p->op==OP_GT){ int k=ix_bound(t,x,ir,&p->cv,!a); if(k>lo) lo=k; }
+        if(b||p->op==OP_LT){ int k=ix_bound(t,x,ir,&p->cv,b); if(k<hi) hi=k; }
+    }
+    if(pr){
+        prof_note(pr,ST_SCAN,"%s: %s %s, %d of %d sorted entries in the key range, %d unsorted, %zu bytes each",
+                  t->name,pl->cover?"index-only scan of":"index scan of",x->name,hi>lo?hi-lo:0,nm,nt,ix_stride(x));
+        prof_preds(pr,t,"",f);
+        prof_note(pr,ST_MATERIALIZE,"%d column(s) per row",no);
+        if(pr->plan){res_ok(r,"Planned",0);return;}
+        prof_enter(pr,ST_SCAN);
+    }
+    r->ok=1; r->ncols=no;
+    for(int j=0;j<no;j++){strncpy(r->cname[j],sel_name(&pl->st,j,t->cols[pl->oc[j]].name),MAX_NAME_LEN-1);r->ctype[j]=t->cols[pl->oc[j]].type;}
+    char rv[MAX_COLUMNS][MAX_STR_LEN]; Row sr;
+    for(int i=lo<hi?lo:nm;i<nm+nt;i=i+1==hi?nm:i+1){
+        const IxEnt *e=ix_ent(x,ir,i); const Row *row;
+        if(e->j>=f->nrows) continue;   /* appended after the scan began */
+        seen++; row=&f->rows[e->j];
+        if(pl->cover){
+            for(int k=0;k<x->nc;k++){ sr.data[x->col[k]]=e->c[k]; sr.null[x->col[k]]=(int8_t)(e->nul>>k&1); }
+            sr.xmin=ald(&row->xmin); sr.xmax=ald(&row->xmax); row=&sr;
+        }
+        if(!eval_prof(row,f,pr,ST_MATERIALIZE)) continue;
+        for(int k=0;k<no;k++) res_col(r,rv,k,t,row,pl->oc[k]);
+        res_addrow(r,rv,no);
+        PROF(r,ST_SCAN);
+    }
+    if(pr){
+        pr->in[ST_SCAN]+=seen; pr->out[ST_SCAN]+=seen;
+        pr->bytes[ST_SCAN]+=(int64_t)seen*(int64_t)(ix_stride(x)+(pl->cover?2*sizeof(uint64_t):sizeof(Row)));
+    }
+    char m[64];snprintf(m,64,"%d row(s) returned",r->nrows);
+    strncpy(r->msg,m,sizeof(r->msg)-1); r->affected=r->nrows;
+}
+/* Whether to read the plan's index for f's literals: always when it
+   covers the query, as its entries are smaller than the rows; otherwise
+   unless statistics put more than IX_SCAN_SEL of the rows in the key
+   range, where reading rows by slot loses to a full scan with zone maps.
+   Without statistics a bounded key is taken to be selective. */
+static int ix_worth(const Table *t,const Plan *pl,const Filter *f,Prof *pr){
+    const Index *x=t->ix[pl->ix]; double e=1; int est=0;
+    if(pl->cover) return 1;
+    for(int i=0;i<f->n;i++){
+        const Pred *p=&f->p[i];
+        if(p->ci==x->col[0]&&!p->isnull&&p->op!=OP_NE&&p->sel>=0){ e*=p->sel; est=1; }
+    }
+    if(!est||e<=IX_SCAN_SEL) return 1;
+    if(pr) prof_note(pr,ST_SCAN,"%s: index %s not used, ~%.0f%% of rows in its key range",t->name,x->name,100*e);
+    return 0;
+}
+static void run_select(Table *t,const Plan *pl,const Params *pa,Res *r,const Sess *s){
+    Filter f; Prof *pr=r->prof; int no=pl->nc;
+    where_bind(t,&pl->st.w,pl->pt,pa,&f,s);
+    if(pl->ix>=0&&ix_worth(t,pl,&f,pr)){ run_ixscan(t,pl,&f,r); filter_free(&f); return; }
+    if(pr){
+        prof_plan(pr,t,"",&f,1); prof_note(pr,ST_MATERIALIZE,"%d column(s) per row",no);
+        if(pr->plan){filter_free(&f);res_ok(r,"Planned",0);return;}
+        prof_enter(pr,ST_SCAN);
+    }
+    r->ok=1; r->ncols=no;
+    for(int j=0;j<no;j++){strncpy(r->cname[j],sel_name(&pl->st,j,t->cols[pl->oc[j]].name),MAX_NAME_LEN-1);r->ctype[j]=t->cols[pl->oc[j]].type;}
+    char rv[MAX_COLUMNS][MAX_STR_LEN]; int64_t v0=pr?pr->in[ST_FILTER]:0;
+    for(int j=0;j<f.nrows;j++){
+        if(zone_skip(&f,j)){j|=ZONE_ROWS-1;continue;}
+        Row *row=&f.rows[j];
+        if(!eval_prof(row,&f,pr,ST_MATERIALIZE)) continue;
+        for(int k=0;k<no;k++) res_col(r,rv,k,t,row,pl->oc[k]);
+        res_addrow(r,rv,no);
+        PROF(r,ST_SCAN);
+    }
+    if(pr) prof_scan(pr,&f,v0);
+    filter_free(&f);
+    char m[64];snprintf(m,64,"%d row(s) returned",r->nrows);
+    strncpy(r->msg,m,sizeof(r->msg)-1); r->affected=r->nrows;
+}
+
+/* With pinned set, t is a partition the SET moves every row out of. */
+static void run_update(DB *db,Table *t,const Plan *pl,const Params *pa,Res *r,Sess *s,int pinned){
+    Filter f; Prof *pr=r->prof;
+    /* Each match gets a new version appended; the scan is bounded by the
+       view so those are not revisited. A visible version that already has
+       an xmax was replaced by someone else since our snapshot. */
+    where_bind(t,&pl->st.w,pl->pt,pa,&f,s);
+    if(pr){
+        prof_plan(pr,t,"",&f,1);
+        prof_note(pr,ST_WRITE,"append a new version of each matching row, end the old one (%d column(s) set)",pl->nc);
+        if(pr->plan){filter_free(&f);res_ok(r,"Planned",0);return;}
+        prof_enter(pr,ST_SCAN);
+    }
+    int upd=0; int64_t v0=pr?pr->in[ST_FILTER]:0;
+    for(int j=0;j<f.nrows;j++){
+        if(zone_skip(&f,j)){j|=ZONE_ROWS-1;continue;}
+        if(!eval_prof(&t->rows[j],&f,pr,ST_WRITE)) continue;
+        if(ald(&t->rows[j].xmax)){filter_free(&f);res_err(r,ERR_CONFLICT);return;}
+        if(pinned){filter_free(&f);res_err(r,"UPDATE would move rows to another partition");return;}
+        Row *row=tbl_append(t); if(!row||tx_reserve(s,2)){filter_free(&f);res_err(r,"OOM");return;}
+        *row=t->rows[j]; row->xmin=s->tx; row->xmax=0; row_share(t,row);
+        for(int k=0;k<pl->nc;k++){
+            int ci=pl->oc[k]; const char *v=pval(pl->st.val[k],pa);
+            if(ci<0) continue;
+            if(col_set(t,row,ci,strcasecmp(v,"NULL")?v:NULL)){row_drop(t,row,&t->ret);filter_free(&f);res_err(r,"OOM");return;}
+        }
+        if(zone_note(t,t->nrows,NULL)||ix_note(t,t->nrows)){row_drop(t,row,&t->ret);filter_free(&f);res_err(r,"OOM");return;}
+        tx_note(s,db,t,t->nrows,1); tx_note(s,db,t,j,0);
+        ast(&t->rows[j].xmax,s->tx); ast(&t->nrows,t->nrows+1);
+        upd++;
+        PROF(r,ST_SCAN);
+    }
+    if(pr){ prof_scan(pr,&f,v0); pr->in[ST_WRITE]+=upd; pr->out[ST_WRITE]+=upd; pr->bytes[ST_WRITE]+=(int64_t)upd*sizeof(Row); }
+    filter_free(&f);
+    char m[64];snprintf(m,64,"%d row(s) updated",upd);res_ok(r,m,upd);
+}
+
+static void run_delete(DB *db,Table *t,const Plan *pl,const Params *pa,Res *r,Sess *s){
+    Filter f; Prof *pr=r->prof;
+    where_bind(t,&pl->st.w,pl->pt,pa,&f,s);
+    if(pr){
+        prof_plan(pr,t,"",&f,1); prof_note(pr,ST_WRITE,"end each matching row version (set its xmax)");
+        if(pr->plan){filter_free(&f);res_ok(r,"Planned",0);return;}
+        prof_enter(pr,ST_SCAN);
+    }
+    int del=0; int64_t v0=pr?pr->in[ST_FILTER]:0;
+    for(int j=0;j<f.nrows;j++){
+        if(zone_skip(&f,j)){j|=ZONE_ROWS-1;continue;}
+        Row *row=&t->rows[j];
+        if(!eval_prof(row,&f,pr,ST_WRITE)) continue;
+        if(ald(&row->xmax)){filter_free(&f);res_err(r,ERR_CONFLICT);return;}
+        if(tx_reserve(s,1)){filter_free(&f);res_err(r,"OOM");return;}
+        tx_note(s,db,t,j,0); ast(&row->xmax,s->tx); del++;
+        PROF(r,ST_SCAN);
+    }
+    if(pr){ prof_scan(pr,&f,v0); pr->in[ST_WRITE]+=del; pr->out[ST_WRITE]+=del; pr->bytes[ST_WRITE]+=(int64_t)del*sizeof(uint64_t); }
+    filter_free(&f);
+    char m[64];snprintf(m,64,"%d row(s) deleted",del);res_ok(r,m,del);
+}
+
+/* A plan on a partitioned table: INSERT goes to the partition its key
+   falls in; the others run on each partition part_skip leaves, in bound
+   order, and report the sum. With none left they run on the empty table
+   itself, which still names the result columns. */
+static void run_parts(DB *db,const Plan *pl,const Params *pa,Res *r,Sess *s){
+    Table *t=&db->tbl[pl->ti],*c[MAX_PARTS]; const Part *pt=t->part; const char *kn=t->cols[pt->key].name;
+    int8_t pin[MAX_PARTS]; int n=0,mv=-3,tot=0; char m[160];   /* mv: the key's partition if SET, else -3 */
+    if(pl->kind==PL_INSERT){
+        int vi=0; while(vi<pl->st.nval&&pl->oc[vi]!=pt->key) vi++;
+        const char *v=vi<pl->st.nval?pval(pl->st.val[vi],pa):"NULL";
+        int i=part_find(t,v); Table *p=i>=0?part_tbl(db,t,i):NULL;
+        if(i==-2) snprintf(m,sizeof(m),"Partition key '%s' cannot be NULL",kn);
+        else if(!p) snprintf(m,sizeof(m),"No partition of '%s' holds %s = %.64s",t->name,kn,v);
+        if(!p){res_err(r,m);return;}
+        if(r->prof) prof_note(r->prof,ST_WRITE,"%s = %.64s: partition %s",kn,v,pt->pn[i]);
+        run_insert(db,p,pl,pa,r,s); return;
+    }
+    if(pl->kind==PL_UPDATE) for(int k=0;k<pl->nc;k++) if(pl->oc[k]==pt->key) mv=part_find(t,pval(pl->st.val[k],pa));
+    if(mv==-2){snprintf(m,sizeof(m),"Partition key '%s' cannot be NULL",kn);res_err(r,m);return;}
+    for(int i=0;i<pt->n;i++){
+        if(part_skip(t,i,&pl->st.w,pl->pt,pa)||!(c[n]=part_tbl(db,t,i))) continue;
+        pin[n++]=(int8_t)(mv!=-3&&mv!=i);
+    }
+    if(r->prof) part_note(r->prof,t,n);
+    for(int i=0;i<(n?n:1);i++){
+        Table *p=n?c[i]:t;
+        switch(pl->kind){
+            case PL_SELECT: run_select(p,pl,pa,r,s); break;
+            case PL_UPDATE: run_update(db,p,pl,pa,r,s,n&&pin[i]); break;
+            default:        run_delete(db,p,pl,pa,r,s); break;
+        }
+        if(!r->ok) return;
+        tot+=r->affected;
+    }
+    if(pl->kind==PL_SELECT||(r->prof&&r->prof->plan)) return;
+    snprintf(m,sizeof(m),"%d row(s) %s",tot,pl->kind==PL_UPDATE?"updated":"deleted");
+    res_ok(r,m,tot);
+}
+
+static void select_generic(DB *db,const Stmt *st,const Params *pa,Res *r,const Sess *s);
+static void run_plan(DB *db,const Plan *pl,const Params *pa,Res *r,Sess *s){
+    Table *t=pl->kind==PL_NONE?NULL:&db->tbl[pl->ti];
+    if(t&&mv_stale(t,r)) return;
+    if(t&&t->part){ run_parts(db,pl,pa,r,s); return; }
+    switch(pl->kind){
+        case PL_NONE:   select_generic(db,&pl->st,pa,r,s); break;
+        case PL_SELECT: run_select(t,pl,pa,r,s); break;
+        case PL_INSERT: run_insert(db,t,pl,pa,r,s); break;
+        case PL_UPDATE: run_update(db,t,pl,pa,r,s,0); break;
+        case PL_DELETE: run_delete(db,t,pl,pa,r,s); break;
+    }
+}
+
+/* SELECT with JOIN, GROUP BY or aggregates. */
+static void select_generic(DB *db,const Stmt *st,const Params *pa,Res *r,const Sess *s){
+    int agg=st->ngrp>0;
+    for(int i=0;i<st->nsel;i++) agg|=st->sel[i].fn!=0;
+    if(st->ntbl>1){
+        if(agg){res_err(r,"Aggregates over JOIN not supported");return;}
+        select_join(db,st,pa,r,s); return;
+    }
+    Table *t=find_tbl(db,st->tbl[0]);
+    if(!t){char m[128];snprintf(m,128,"Table '%s' not found",st->tbl[0]);res_err(r,m);return;}
+    if(mv_stale(t,r)) return;
+    /* a partitioned table is aggregated over the partitions left after
+       pruning, as one scan */
+    Filter *f=(Filter*)malloc(sizeof(Filter)*(t->part?t->part->n+1:1)); int nf=0;
+    if(!f){res_err(r,"OOM");return;}
+    if(t->part){
+        PredT pt[MAX_CONDS]; Table *c; where_resolve(t,&st->w,pt);
+        for(int i=0;i<t->part->n;i++)
+            if(!part_skip(t,i,&st->w,pt,pa)&&(c=part_tbl(db,t,i))) where_bind(c,&st->w,pt,pa,&f[nf++],s);
+        if(r->prof) part_note(r->prof,t,nf);
+    }
+    if(!nf) compile_where(t,&st->w,pa,&f[nf++],s);
+    select_group(t,st,f,nf,r);
+    for(int i=0;i<nf;i++) filter_free(&f[i]);
+    free(f);
+}
+
+static int tbl_live(Table *t,const Sess *s){
+    int rc=0,n=ald(&t->nrows); const Row *rows=ald(&t->rows);
+    for(int j=0;j<n;j++) rc+=row_visible(&rows[j],s->snap,s->tx);
+    return rc;
+}
+/* Partitions are listed as part of their table, not on their own. */
+static void do_show(DB *db,Res *r,const Sess *s){
+    r->ok=1; r->ncols=3;
+    strcpy(r->cname[0],"Table");   r->ctype[0]=T_TEXT;
+    strcpy(r->cname[1],"Columns"); r->ctype[1]=T_INT;
+    strcpy(r->cname[2],"Rows");    r->ctype[2]=T_INT;
+    char v[MAX_COLUMNS][MAX_STR_LEN];
+    for(int i=0;i<db->hdr.ntables;i++){
+        Table *t=&db->tbl[i],*c; if(strchr(t->name,'#')) continue;
+        int rc=tbl_live(t,s);
+        for(int k=0;t->part&&k<t->part->n;k++) if((c=part_tbl(db,t,k))) rc+=tbl_live(c,s);
+        strncpy(v[0],t->name,MAX_STR_LEN-1);
+        snprintf(v[1],MAX_STR_LEN,"%d",tbl_vcols(t));
+        snprintf(v[2],MAX_STR_LEN,"%d",rc);
+        res_addrow(r,v,3);
+    }
+    char m[64];snprintf(m,64,"%d table(s)",r->nrows);
+    strncpy(r->msg,m,sizeof(r->msg)-1); r->affected=r->nrows;
+}
+
+static void do_desc(DB *db,char *sql,Res *r){
+    char *p=sql; while(*p&&!isspace((unsigned char)*p))p++; strtrim(p);
+    Table *t=find_tbl(db,p);
+    if(!t){char m[128];snprintf(m,128,"Table '%s' not found",p);res_err(r,m);return;}
+    r->ok=1; r->ncols=4;
+    strcpy(r->cname[0],"Column");  r->ctype[0]=T_TEXT;
+    strcpy(r->cname[1],"Type");    r->ctype[1]=T_TEXT;
+    strcpy(r->cname[2],"Nullable");r->ctype[2]=T_TEXT;
+    strcpy(r->cname[3],"PK");      r->ctype[3]=T_TEXT;
+    char v[MAX_COLUMNS][MAX_STR_LEN]; int nc=tbl_vcols(t);
+    for(int i=0;i<nc;i++){
+        strncpy(v[0],t->cols[i].name,MAX_STR_LEN-1);
+        snprintf(v[1],MAX_STR_LEN,"%s%s",tname(t->cols[i].type),t->cols[i].dict?" DICT":"");
+        strcpy(v[2],t->cols[i].nullable?"YES":"NO");
+        strcpy(v[3],t->cols[i].pk?"YES":"NO");
+        res_addrow(r,v,4);
+    }
+    char m[sizeof(r->msg)];snprintf(m,sizeof(m),"%s '%s': %d column(s)",t->mv?"Materialized view":"Table",t->name,nc);
+    if(t->part) snprintf(m+strlen(m),sizeof(m)-strlen(m),", PARTITION BY RANGE (%s), %d partition(s)",
+                         t->cols[t->part->key].name,t->part->n);
+    if(t->mv) snprintf(m+strlen(m),sizeof(m)-strlen(m),", AS %s",t->mvsql);
+    for(int i=0;i<t->nix;i++){
+        const Index *x=t->ix[i];
+        snprintf(m+strlen(m),sizeof(m)-strlen(m),", index %s (%s)",x->name,t->cols[x->col[0]].name);
+        for(int k=1;k<x->nc;k++) snprintf(m+strlen(m),sizeof(m)-strlen(m),"%s%s%s",k==1?" INCLUDE (":", ",t->cols[x->col[k]].name,k==x->nc-1?")":"");
+    }
+    memcpy(r->msg,m,sizeof(m));
+}
+
+/* Runs with ddl held exclusively, so no snapshot can see superseded
+   versions or retired arrays any more. */
+static void do_vacuum(DB *db,Res *r){
+    int tot=0,mx=0,*map=NULL;
+    /* the slot map for indexes is the one allocation: nothing has moved if it fails */
+    for(int i=0;i<db->hdr.ntables;i++) if(db->tbl[i].nix&&db->tbl[i].nrows>mx) mx=db->tbl[i].nrows;
+    if(mx&&!(map=(int*)malloc(sizeof(int)*(size_t)mx))){res_err(r,"OOM");return;}
+    for(int i=0;i<db->hdr.ntables;i++){
+        Table *t=&db->tbl[i]; int w=0;
+        for(int j=0;j<t->nrows;j++){
+            if(t->nix) map[j]=t->rows[j].xmax?-1:w;
+            if(!t->rows[j].xmax) t->rows[w++]=t->rows[j]; else { row_drop(t,&t->rows[j],NULL); tot++; }
+        }
+        for(int k=0;k<t->nix;k++) ix_compact(t,t->ix[k],map);
+        t->nrows=w; zone_rebuild(t); ret_free(&t->ret,UINT64_MAX); t->relsn=db->wts;
+    }
+    free(map);
+    /* base rows moved: views map and count them afresh */
+    char m[sizeof(r->msg)]; int nb=0;
+    snprintf(m,sizeof(m),"VACUUM: purged %d row(s)",tot);
+    for(int i=0;i<db->hdr.ntables;i++) if(db->tbl[i].mv&&mv_refresh(db,&db->tbl[i],db->wts))
+        snprintf(m+strlen(m),sizeof(m)-strlen(m),"%s'%s'",nb++?", ":", but these materialized views could not be rebuilt (OOM) and are unreadable until they are: ",db->tbl[i].name);
+    save_db(db);
+    if(nb){ res_err(r,m); return; }
+    res_ok(r,m,tot);
+}
+
+/* BACKUP TO 'path' [INCREMENTAL] [THROTTLE mb]: a consistent copy taken
+   while reads and writes go on. The backup holds a snapshot as BEGIN does
+   (DROP and VACUUM wait for it) and writes what that snapshot sees to
+   path.tmp, at most mb MB/s, before renaming it to path. INCREMENTAL
+   writes only the row blocks changed since the last backup this process
+   took, judged by the lsn of their zones; --restore rebuilds a database
+   from a full backup and the deltas that follow it. */
+static void do_backup(DB *db,const char *sql,Res *r){
+    Lex l; lex_init(&l,sql); lex_next(&l);
+    char path[512],tmpn[sizeof(path)+8],m[640]; double rate=0; int inc=0;
+    if(!tok_is(&l.t,"TO")){res_err(r,"Expected BACKUP TO 'path'");return;}
+    lex_next(&l);
+    if(l.t.k!=TK_STR){res_err(r,"Expected a quoted path after BACKUP TO");return;}
+    tok_lit(&l.t,path,sizeof(path)); lex_next(&l);
+    if(tok_is(&l.t,"INCREMENTAL")){ inc=1; lex_next(&l); }
+    if(tok_is(&l.t,"THROTTLE")){
+        lex_next(&l);
+        if(l.t.k!=TK_NUM||(rate=strtod(l.t.s,NULL))<=0){res_err(r,"THROTTLE needs a rate in MB/s");return;}
+        lex_next(&l);
+    }
+    if(l.t.k!=TK_END&&!(l.t.k==TK_PUNCT&&*l.t.s==';')){res_err(r,"Unexpected text after BACKUP TO 'path'");return;}
+    if(!*path||!strcmp(path,db->file)){res_err(r,"BACKUP needs a path other than the database file");return;}
+    snprintf(tmpn,sizeof(tmpn),"%s.tmp",path);
+    mtx_lock(&db->ckl); uint64_t since=inc?db->bksnap:0; uint32_t base=db->bkcrc,sum; mtx_unlock(&db->ckl);
+    if(inc&&!since){res_err(r,"No backup taken since the database was opened; take a full BACKUP first");return;}
+    rw_rdlock(&db->ddl);
+    aadd(&db->ntx,1);
+    uint64_t snap; int slot=snap_begin(db,&snap); DBHdr h=db->hdr;
+    rw_unlock(&db->ddl);
+    Io io; memset(&io,0,sizeof(io));
+    double t0=mono_now();
+    int rc=save_image(db,&io,tmpn,&h,snap,rate*1048576.0,since,base,&sum);
+    snap_end(db,slot); aadd(&db->ntx,-1); io_free(&io);
+    if(!rc&&replace_file(tmpn,path)){ remove(tmpn); rc=-1; }
+    if(rc){ snprintf(m,sizeof(m),"Backup to '%s' failed",path); res_err(r,m); return; }
+    fsync_dir(path);
+    /* the next delta follows this file; a backup that started earlier but
+       finished later does not take its place */
+    mtx_lock(&db->ckl); if(snap>=db->bksnap){ db->bksnap=snap; db->bkcrc=sum; } mtx_unlock(&db->ckl);
+    snprintf(m,sizeof(m),"BACKUP TO '%s'%s: %d table(s) in %.2f s",path,inc?" INCREMENTAL":"",h.ntables,mono_now()-t0);
+    res_ok(r,m,h.ntables);
+}
+/* ANALYZE [table]: rebuilds the statistics of one table (and its
+   partitions) or every table from the caller's snapshot, publishes them
+   in place of the old ones (retired, as readers may be planning with
+   them) and writes them to the file. */
+static void do_analyze(DB *db,char *sql,Res *r,const Sess *s){
+    char *p=sql+7; strtrim(p);
+    Table *one=NULL;
+    if(*p&&!(one=find_tbl(db,p))){char m[128];snprintf(m,128,"Table '%.64s' not found",p);res_err(r,m);return;}
+    const char *cn[]={"Table","Column","NullFrac","Distinct","Buckets","Min","Max"};
+    CType ct[]={T_TEXT,T_TEXT,T_FLOAT,T_INT,T_INT,T_TEXT,T_TEXT};
+    r->ok=1; r->ncols=7;
+    for(int j=0;j<7;j++){strcpy(r->cname[j],cn[j]);r->ctype[j]=ct[j];}
+    char v[MAX_COLUMNS][MAX_STR_LEN]; int nt=0; int64_t nr=0;
+    for(int i=0;i<db->hdr.ntables;i++){
+        Table *t=&db->tbl[i]; if(one&&t!=one&&!part_of(t,one)) continue;
+        TStat *st=stat_build(t,s->snap,s->tx);
+        if(!st){res_err(r,"OOM");return;}
+        retire(&t->ret,t->stats); ast(&t->stats,st);
+        nt++; nr+=st->rows;
+        for(int c=0;c<tbl_vcols(t);c++){
+            const CStat *cs=&st->c[c];
+            snprintf(v[0],MAX_STR_LEN,"%s",t->name); snprintf(v[1],MAX_STR_LEN,"%s",t->cols[c].name);
+            snprintf(v[2],MAX_STR_LEN,"%.4f",cs->nullfrac); snprintf(v[3],MAX_STR_LEN,"%.0f",cs->ndv);
+            snprintf(v[4],MAX_STR_LEN,"%d",cs->nb);
+            if(cs->nb){ val2str((Val*)&cs->b[0],t->cols[c].type,v[5],MAX_STR_LEN); val2str((Val*)&cs->b[cs->nb],t->cols[c].type,v[6],MAX_STR_LEN); }
+            else { strcpy(v[5],"NULL"); strcpy(v[6],"NULL"); }
+            res_addrow(r,v,7);
+        }
+    }
+    pc_clear(db);   /* cached plans chose their index without these */
+    save_db(db);
+    snprintf(r->msg,sizeof(r->msg),"ANALYZE: %d table(s), %lld row(s)",nt,(long long)nr); r->affected=r->nrows;
+}
+
+/* ALTER TABLE t ADD PARTITION p VALUES LESS THAN (v | MAXVALUE) and
+   ALTER TABLE t DROP PARTITION p, for a table created PARTITION BY RANGE.
+   A new partition takes the keys from the last bound up to v, so bounds
+   only ascend; a row whose key is above every bound is refused. DROP
+   PARTITION frees that partition's table and nothing else: retiring old
+   rows costs what they occupy, not a DELETE and VACUUM of the table, and
+   later inserts in the dropped range go to the next partition. */
+static void do_alter(DB *db,const char *sql,Res *r){
+    Lex l; lex_init(&l,sql); lex_next(&l); lex_next(&l);   /* ALTER TABLE */
+    char tn[MAX_NAME_LEN],pn[MAX_NAME_LEN],lit[MAX_STR_LEN],cn[MAX_NAME_LEN*2+2],m[512]; int add,mx=0;
+    if(l.t.k!=TK_ID||l.t.n>=MAX_NAME_LEN){res_err(r,"Expected ALTER TABLE name");return;}
+    tok_lit(&l.t,tn,sizeof(tn)); lex_next(&l);
+    add=tok_is(&l.t,"ADD");
+    if(!add&&!tok_is(&l.t,"DROP")){res_err(r,"Expected ADD PARTITION or DROP PARTITION");return;}
+    lex_next(&l);
+    if(!tok_is(&l.t,"PARTITION")){res_err(r,"Expected ADD PARTITION or DROP PARTITION");return;}
+    lex_next(&l);
+    if(l.t.k!=TK_ID||l.t.n>=MAX_NAME_LEN){res_err(r,"Expected a partition name");return;}
+    tok_lit(&l.t,pn,sizeof(pn)); lex_next(&l);
+    if(add){
+        const char *kw[]={"VALUES","LESS","THAN"};
+        for(int i=0;i<3;i++){
+            if(!tok_is(&l.t,kw[i])){res_err(r,"Expected VALUES LESS THAN (value | MAXVALUE)");return;}
+            lex_next(&l);
+        }
+        if(l.t.k!=TK_PUNCT||*l.t.s!='('){res_err(r,"Expected VALUES LESS THAN (value | MAXVALUE)");return;}
+        lex_next(&l);
+        if(tok_is(&l.t,"MAXVALUE")) mx=1;
+        else if(l.t.k==TK_NUM) tok_lit(&l.t,lit,sizeof(lit));
+        else {res_err(r,"Expected a number or MAXVALUE");return;}
+        lex_next(&l);
+        if(l.t.k!=TK_PUNCT||*l.t.s!=')'){res_err(r,"Expected ')'");return;}
+        lex_next(&l);
+    }
+    if(l.t.k!=TK_END&&!(l.t.k==TK_PUNCT&&*l.t.s==';')){res_err(r,"Unexpected text after ALTER TABLE");return;}
+    Table *t=find_tbl(db,tn); Part *pt=t?t->part:NULL;
+    if(!t){snprintf(m,sizeof(m),"Table '%s' not found",tn);res_err(r,m);return;}
+    if(!pt){snprintf(m,sizeof(m),"Table '%s' is not partitioned",tn);res_err(r,m);return;}
+    int i=0; while(i<pt->n&&strcasecmp(pt->pn[i],pn)) i++;
+    snprintf(cn,sizeof(cn),"%s#%s",t->name,pn);
+    if(add){
+        CType tp=t->cols[pt->key].type; Val hi; memset(&hi,0,sizeof(hi));
+        if(!mx) str2val(lit,tp,&hi);
+        if(i<pt->n){snprintf(m,sizeof(m),"Partition '%s' exists",pn);res_err(r,m);return;}
+        if(pt->n>=MAX_PARTS){res_err(r,"Max partitions reached");return;}
+        if(db->hdr.ntables>=MAX_TABLES){res_err(r,"Max tables reached");return;}
+        if(strlen(cn)>=MAX_NAME_LEN){res_err(r,"Table and partition names too long together");return;}
+        if(pt->n&&(pt->max[pt->n-1]||(!mx&&val_cmp(&hi,&pt->hi[pt->n-1],tp)<=0))){
+            snprintf(m,sizeof(m),"Partition bounds must ascend: '%s' would not be above '%s'",pn,pt->pn[pt->n-1]);
+            res_err(r,m); return;
+        }
+        Table *c=&db->tbl[db->hdr.ntables];
+        memset(c,0,sizeof(Table));
+        strcpy(c->name,cn);
+        c->cap=16; c->rows=(Row*)malloc(sizeof(Row)*c->cap);
+        if(!c->rows){res_err(r,"OOM");return;}
+        memcpy(c->cols,t->cols,sizeof(Col)*(size_t)t->ncols); c->ncols=t->ncols; c->relsn=db->wts;
+        db->hdr.ntables++;
+        strcpy(pt->pn[pt->n],pn); pt->hi[pt->n]=hi; pt->max[pt->n]=(int8_t)mx; pt->n++;
+        snprintf(m,sizeof(m),"Partition '%s' of '%s' added (%s < %s)",pn,tn,t->cols[pt->key].name,mx?"MAXVALUE":lit);
+    } else {
+        if(i==pt->n){snprintf(m,sizeof(m),"Partition '%s' not found",pn);res_err(r,m);return;}
+        Table *c=find_tbl(db,cn); int n=c?c->nrows:0;
+        if(c) tbl_drop(db,(int)(c-db->tbl));   /* pt is not in db->tbl: it stays put */
+        memmove(pt->pn[i],pt->pn[i+1],sizeof(pt->pn[0])*(size_t)(pt->n-i-1));
+        memmove(&pt->hi[i],&pt->hi[i+1],sizeof(Val)*(size_t)(pt->n-i-1));
+        memmove(&pt->max[i],&pt->max[i+1],(size_t)(pt->n-i-1));
+        pt->n--;
+        snprintf(m,sizeof(m),"Partition '%s' of '%s' dropped (%d row version(s))",pn,tn,n);
+    }
+    pc_clear(db);
+    save_db(db);
+    res_ok(r,m,0);
+}
+/* SHOW PARTITIONS t: each partition's upper bound and live rows. */
+static void do_partitions(DB *db,char *sql,Res *r,const Sess *s){
+    char *p=sql+15; strtrim(p);
+    Table *t=find_tbl(db,p),*c;
+    if(!t){char m[128];snprintf(m,128,"Table '%.64s' not found",p);res_err(r,m);return;}
+    if(!t->part){char m[128];snprintf(m,128,"Table '%s' is not partitioned",t->name);res_err(r,m);return;}
+    const char *cn[]={"Partition","LessThan","Rows"}; CType ct[]={T_TEXT,T_TEXT,T_INT};
+    r->ok=1; r->ncols=3;
+    for(int j=0;j<3;j++){strcpy(r->cname[j],cn[j]);r->ctype[j]=ct[j];}
+    char v[MAX_COLUMNS][MAX_STR_LEN]; const Part *pt=t->part;
+    for(int i=0;i<pt->n;i++){
+        snprintf(v[0],MAX_STR_LEN,"%s",pt->pn[i]);
+        if(pt->max[i]) strcpy(v[1],"MAXVALUE"); else val2str((Val*)&pt->hi[i],t->cols[pt->key].type,v[1],MAX_STR_LEN);
+        snprintf(v[2],MAX_STR_LEN,"%d",(c=part_tbl(db,t,i))?tbl_live(c,s):0);
+        res_addrow(r,v,3);
+    }
+    snprintf(r->msg,sizeof(r->msg),"%d partition(s)",r->nrows); r->affected=r->nrows;
+}
+
+/* ── Plan cache ─────────────────────────────────────────────── */
+/* sql_norm writes a statement's tokens to key, one space apart, with each
+   quoted or numeric literal copied whole into pa and written as '?';
+   statements that differ only in their literals share a key. It returns
+   -1 when the statement is not cacheable: a bad token or more than
+   MAX_PARAMS literals. */
+static int sql_norm(const char *in,char *key,Params *pa){
+    Lex l; char *o=key,*b=pa->buf; pa->n=0;
+    for(lex_init(&l,in);l.t.k!=TK_END;lex_next(&l)){
+        if(l.t.k==TK_BAD||o+l.t.n+2>=key+MAX_SQL_LEN) return -1;
+        if(o>key) *o++=' ';
+        if(l.t.k==TK_STR||l.t.k==TK_NUM){
+            if(pa->n>=MAX_PARAMS||b+l.t.n+1>pa->buf+MAX_SQL_LEN) return -1;
+            pa->v[pa->n++]=b; tok_lit(&l.t,b,(size_t)l.t.n+1); b+=strlen(b)+1; *o++='?';
+        } else { memcpy(o,l.t.s,(size_t)l.t.n); o+=l.t.n; }
+    }
+    *o=0; return 0;
+}
+static void plan_put(DB *db,Plan *pl){
+    mtx_lock(&db->pcl); int last=--pl->refs==0; mtx_unlock(&db->pcl);
+    if(last) free(pl);
+}
+static Plan *pc_get(DB *db,const char *key,uint64_t h){
+    Plan *pl=NULL;
+    mtx_lock(&db->pcl);
+    for(int i=0;i<PLAN_CACHE;i++){
+        PEnt *e=&db->pc[i];
+        if(e->plan&&e->h==h&&!strcmp(e->key,key)){e->used=++db->pctick;pl=e->plan;pl->refs++;break;}
+    }
+    mtx_unlock(&db->pcl);
+    return pl;
+}
+/* Caches pl (the caller keeps its own reference) in a free slot or over the
+   least recently used one. A key another thread added first is left be. */
+static void pc_add(DB *db,const char *key,uint64_t h,Plan *pl){
+    char *k=strdup(key); if(!k) return;
+    Plan *old=NULL; char *okey=NULL; PEnt *v=NULL;
+    mtx_lock(&db->pcl);
+    for(int i=0;i<PLAN_CACHE;i++){
+        PEnt *e=&db->pc[i];
+        if(e->plan&&e->h==h&&!strcmp(e->key,key)){v=NULL;break;}
+        if(!v||(v->plan&&(!e->plan||e->used<v->used))) v=e;
+    }
+    if(v){
+        if(v->plan&&--v->plan->refs==0) old=v->plan;
+        okey=v->key; v->h=h; v->key=k; v->plan=pl; v->used=++db->pctick; pl->refs++; k=NULL;
+    }
+    mtx_unlock(&db->pcl);
+    free(old); free(okey); free(k);
+}
+/* Plans hold table and column ordinals, so CREATE, DROP and ALTER (under the
+   exclusive ddl lock) throw every one away. */
+static void pc_clear(DB *db){
+    mtx_lock(&db->pcl);
+    for(int i=0;i<PLAN_CACHE;i++){
+        PEnt *e=&db->pc[i];
+        if(e->plan&&--e->plan->refs==0) free(e->plan);
+        free(e->key); e->key=NULL; e->plan=NULL;
+    }
+    mtx_unlock(&db->pcl);
+}
+
+/* SELECT, INSERT, UPDATE and DELETE. A cache hit skips the parse and
+   name resolution and only binds the statement's literals; statements
+   sql_norm rejects are parsed and run without caching. */
+static void do_stmt(DB *db,char *sql,Res *r,Sess *s){
+    char key[MAX_SQL_LEN]; Params *pa=(Params*)malloc(sizeof(Params));
+    if(!pa){res_err(r,"OOM");return;}
+    int lift=!sql_norm(sql,key,pa); uint64_t h=lift?str_hash(key):0;
+    Plan *pl=lift?pc_get(db,key,h):NULL; int hit=pl!=NULL;
+    if(!pl){
+        if(!(pl=(Plan*)malloc(sizeof(Plan)))){free(pa);res_err(r,"OOM");return;}
+        if(parse_sql(sql,&pl->st,lift,r)||plan_build(db,pl,r)){free(pl);free(pa);return;}
+        pl->refs=1;
+        if(lift) pc_add(db,key,h,pl);
+    }
+    if(r->prof) prof_note(r->prof,ST_PARSE,hit?"plan cache hit, %d literal(s) bound":
+        lift?"parsed to a syntax tree, names resolved; plan cached with %d literal(s) as parameters":
+        "parsed to a syntax tree, names resolved (not cacheable)",pa->n);
+    run_plan(db,pl,lift?pa:NULL,r,s);
+    plan_put(db,pl); free(pa);
+}
+/* ── Transactions ───────────────────────────────────────────── */
+/* BEGIN takes a snapshot for the whole block (snapshot isolation): a
+   version it wants to change that was changed after that snapshot is a
+   write conflict. Changes persist once, at COMMIT. */
+static void tx_begin(DB *db,Sess *s,Res *r){
+    if(!s){res_err(r,"Transactions need a session");return;}
+    if(s->open){res_err(r,"Already in a transaction");return;}
+    rw_rdlock(&db->ddl);   /* DROP/VACUUM check ntx under the write lock */
+    aadd(&db->ntx,1);
+    s->slot=snap_begin(db,&s->snap); s->tx=TX_BIT|aadd(&db->txseq,1);
+    s->open=1; s->nlog=0;
+    rw_unlock(&db->ddl);
+    res_ok(r,"BEGIN",0);
+}
+static void tx_end(DB *db,Sess *s,Res *r,int commit){
+    if(!s||!s->open){res_err(r,"No transaction in progress");return;}
+    int n=s->nlog; uint64_t dw=0;
+    rw_rdlock(&db->ddl); mtx_lock(&db->wlock);
+    db->wts=db->clock+1;
+    if(!commit) tx_undo(db,s,0);
+    else if(n){ tx_stamp(db,s); dw=db_durable(db,s); }
+    wr_commit(db);
+    mtx_unlock(&db->wlock); rw_unlock(&db->ddl);
+    ck_wait(db,dw);
+    snap_end(db,s->slot); aadd(&db->ntx,-1);
+    s->open=0; s->tx=0;
+    char m[64]; snprintf(m,64,commit?"COMMIT: %d change(s)":"ROLLBACK: %d change(s) undone",n);
+    res_ok(r,m,n);
+}
+/* SET [GLOBAL] DURABILITY SYNC|GROUP|ASYNC [ms], SHOW DURABILITY. The
+   plain form sets the session's level (DEFAULT: the database's again);
+   GLOBAL sets the database's, and ms its GROUP window or ASYNC delay. */
+static void do_durability(DB *db,Sess *s,const char *sql,Res *r){
+    Lex l; lex_init(&l,sql); char m[128];
+    if(tok_is(&l.t,"SHOW")){
+        static const char *const bg[]={"","; BGSAVE running","; last BGSAVE done","; last BGSAVE failed"};
+        mtx_lock(&db->ckl);
+#ifdef HAVE_THREADS
+        int st=db->bgst;
+#else
+        int st=0;
+#endif
+        snprintf(m,sizeof(m),"DURABILITY %s (database %s, GROUP %d ms, ASYNC %d ms%s)",
+                 dur_name[s&&s->dur?s->dur:db->dur],dur_name[db->dur],db->group_ms,db->async_ms,bg[st]);
+        mtx_unlock(&db->ckl);
+        res_ok(r,m,0); return;
+    }
+    lex_next(&l); int g=tok_is(&l.t,"GLOBAL"),lv=0; long ms=0;
+    if(g) lex_next(&l);
+    if(!tok_is(&l.t,"DURABILITY")){res_err(r,"Expected SET [GLOBAL] DURABILITY");return;}
+    lex_next(&l);
+    for(int i=DUR_SYNC;i<=DUR_ASYNC;i++) if(tok_is(&l.t,dur_name[i])) lv=i;
+    if(!lv&&(g||!tok_is(&l.t,"DEFAULT"))){res_err(r,"Expected SYNC, GROUP or ASYNC");return;}
+    lex_next(&l);
+    if(g&&lv!=DUR_SYNC&&l.t.k==TK_NUM){
+        ms=strtol(l.t.s,NULL,10); lex_next(&l);
+        if(ms<1||ms>60000){res_err(r,"Interval must be 1 to 60000 ms");return;}
+    }
+    if(l.t.k!=TK_END&&!(l.t.k==TK_PUNCT&&*l.t.s==';')){res_err(r,"Unexpected text after the durability level");return;}
+    if(!g&&!s){res_err(r,"SET DURABILITY needs a session; use SET GLOBAL DURABILITY");return;}
+    if(g){
+        mtx_lock(&db->ckl);
+        db->dur=lv;
+        if(ms) *(lv==DUR_GROUP?&db->group_ms:&db->async_ms)=(int)ms;
+#ifdef HAVE_THREADS
+        pthread_cond_signal(&db->ckc);   /* a shorter delay applies now */
+#endif
+        mtx_unlock(&db->ckl);
+    } else s->dur=lv;
+    snprintf(m,sizeof(m),"SET %sDURABILITY %s",g?"GLOBAL ":"",lv?dur_name[lv]:"DEFAULT");
+    res_ok(r,m,0);
+}
+/* Rolls back whatever s left open and releases it. */
+void sess_end(DB *db,Sess *s){
+    if(s->open){ Res r; memset(&r,0,sizeof(r)); tx_end(db,s,&r,0); }
+    free(s->log); memset(s,0,sizeof(*s));
+}
+
+/* ── Dispatcher ─────────────────────────────────────────────── */
+static void do_explain(DB *db,Sess *s,char *sql,Res *r);
+/* s carries the client's transaction; NULL runs every statement alone. */
+void db_exec(DB *db,Sess *s,const char *in,Res *r){
+    int8_t typed=r->typed; Prof *prof=r->prof;
+    memset(r,0,sizeof(*r)); r->typed=typed; r->prof=prof;
+    char sql[MAX_SQL_LEN]; snprintf(sql,sizeof(sql),"%s",in); strtrim(sql);
+    int l=(int)strlen(sql); if(l>0&&sql[l-1]==';') sql[--l]=0; strtrim(sql);
+    if(!*sql){res_ok(r,"Empty",0);return;}
+    if(strswci(sql,"BEGIN"))         {tx_begin(db,s,r);return;}
+    if(strswci(sql,"COMMIT"))        {tx_end(db,s,r,1);return;}
+    if(strswci(sql,"ROLLBACK"))      {tx_end(db,s,r,0);return;}
+    if(strswci(sql,"EXPLAIN"))       {do_explain(db,s,sql,r);return;}
+    if(strswci(sql,"SET ")||strswci(sql,"SHOW DURABILITY")){do_durability(db,s,sql,r);return;}
+    if(strswci(sql,"SHOW REPLICATION")){do_replication(db,r);return;}
+    if(strswci(sql,"BGSAVE"))        {do_bgsave(db,r);return;}
+    if(strswci(sql,"BACKUP"))        {do_backup(db,sql,r);return;}
+    int ddl=strswci(sql,"CREATE TABLE")||strswci(sql,"DROP TABLE")||strswci(sql,"ALTER TABLE")||strswci(sql,"VACUUM")||
+            strswci(sql,"CREATE MATERIALIZED")||strswci(sql,"DROP MATERIALIZED")||strswci(sql,"CREATE INDEX")||strswci(sql,"DROP INDEX");
+    int wr=ddl||strswci(sql,"INSERT INTO")||strswci(sql,"UPDATE")||strswci(sql,"DELETE FROM")||strswci(sql,"ANALYZE");
+    if(wr&&*db->follow){res_err(r,"Read-only: this database follows another");return;}
+    Sess one; memset(&one,0,sizeof(one)); uint64_t dw=0;
+    Sess *cs=s&&s->open?s:&one;
+    if(ddl&&cs==s){res_err(r,"Not allowed inside a transaction");return;}
+    if(ddl) rw_wrlock(&db->ddl); else rw_rdlock(&db->ddl);
+    if(wr){
+        mtx_lock(&db->wlock); db->wts=db->clock+1;
+        if(cs==&one){ one.snap=db->clock; one.tx=TX_BIT|aadd(&db->txseq,1); }
+    } else if(cs==&one) one.slot=snap_begin(db,&one.snap);
+    int mark=cs->nlog;
+    if(ddl&&!strswci(sql,"CREATE TABLE")&&ald(&db->ntx)) res_err(r,"Transactions are open; retry once they finish");
+    else if(strswci(sql,"CREATE TABLE")) do_create(db,sql,r);
+    else if(strswci(sql,"CREATE MATERIALIZED")) do_mview(db,sql,r);
+    else if(strswci(sql,"CREATE INDEX")||strswci(sql,"DROP INDEX")) do_index(db,sql,r);
+    else if(strswci(sql,"DROP TABLE")||strswci(sql,"DROP MATERIALIZED")) do_drop(db,sql,r);
+    else if(strswci(sql,"ALTER TABLE")) do_alter(db,sql,r);
+    else if(strswci(sql,"INSERT INTO")||strswci(sql,"SELECT")||strswci(sql,"UPDATE")||strswci(sql,"DELETE FROM"))
+        do_stmt(db,sql,r,cs);
+    else if(strswci(sql,"SHOW TABLES")) do_show(db,r,cs);
+    else if(strswci(sql,"SHOW PARTITIONS")) do_partitions(db,sql,r,cs);
+    else if(strswci(sql,"DESCRIBE")||strswci(sql,"DESC ")) do_desc(db,sql,r);
+    else if(strswci(sql,"VACUUM"))      do_vacuum(db,r);
+    else if(strswci(sql,"ANALYZE"))     do_analyze(db,sql,r,cs);
+    else res_err(r,"Unknown command");
+    if(wr){
+        if(r->ok&&cs->nlog>mark) mv_apply(db,cs,mark,r);
+        /* a failed statement leaves no trace, even inside a transaction */
+        if(!r->ok) tx_undo(db,cs,mark);
+        else if(cs==&one&&one.nlog){
+            if(prof){ prof_enter(prof,ST_COMMIT); prof->in[ST_COMMIT]=prof->out[ST_COMMIT]=one.nlog; }
+            tx_stamp(db,&one); dw=db_durable(db,s);
+        }
+        wr_commit(db); mtx_unlock(&db->wlock);
+    } else if(cs==&one) snap_end(db,one.slot);
+    rw_unlock(&db->ddl);
+    ck_wait(db,dw);
+    free(one.log);
+}
+
+/* ── Printer ────────────────────────────────────────────────── */
+static void buf_printf(Buf *b,const char *fmt,...){
+    va_list ap; va_start(ap,fmt);
+    int n=vsnprintf(NULL,0,fmt,ap); va_end(ap);
+    if(n<0||buf_reserve(b,(size_t)n+1)) return;
+    va_start(ap,fmt); vsnprintf((char*)b->p+b->n,(size_t)n+1,fmt,ap); va_end(ap);
+    b->n+=(size_t)n;
+}
+static void rule_res(Res *r,const int *w,Buf *b){
+    buf_put(b,"+",1);
+    for(int j=0;j<r->ncols;j++){for(int k=0;k<w[j]+2;k++)buf_put(b,"-",1);buf_put(b,"+",1);}
+    buf_put(b,"\n",1);
+}
+/* Appends r as the text table the REPL shows. */
+static void render_res(Res *r,Buf *b){
+    if(!r->ok){buf_printf(b,"ERROR: %s\n",r->msg);return;}
+    if(!r->ncols){buf_printf(b,"OK: %s\n",r->msg);return;}
+    int w[MAX_COLUMNS];
+    for(int j=0;j<r->ncols;j++){
+        w[j]=(int)strlen(r->cname[j]);
+        for(int i=0;i<r->nrows;i++){int l=(int)strlen(res_get(r,i,j));if(l>w[j])w[j]=l;}
+    }
+    rule_res(r,w,b);
+    buf_put(b,"|",1);for(int j=0;j<r->ncols;j++) buf_printf(b," %-*s |",w[j],r->cname[j]);buf_put(b,"\n",1);
+    rule_res(r,w,b);
+    for(int i=0;i<r->nrows;i++){
+        buf_put(b,"|",1);for(int j=0;j<r->ncols;j++) buf_printf(b," %-*s |",w[j],res_get(r,i,j));buf_put(b,"\n",1);
+    }
+    rule_res(r,w,b);
+    buf_printf(b,"%s\n",r->msg);
+}
+static void print_res(Res *r){
+    Buf b={0}; render_res(r,&b);
+    if(b.n) fwrite(b.p,1,b.n,r->ok?stdout:stderr);
+    free(b.p);
+}
+
+/* ── EXPLAIN ────────────────────────────────────────────────── */
+/* EXPLAIN <stmt> lists, per stage, what a SELECT, INSERT, UPDATE or DELETE
+   would do without touching a row. EXPLAIN ANALYZE runs it (writes
+   included) and adds each stage's wall time, rows in and out, bytes
+   touched and allocations; the statement's own rows are rendered as the
+   REPL would print them, to time that too, and then dropped. Switching
+   stages reads the clock, twice per row reaching the filter, so filter
+   times carry that overhead. */
+static void do_explain(DB *db,Sess *s,char *sql,Res *r){
+    static const char *stn[ST_N]={"parse","scan","filter","join","aggregate","write","materialize","commit","print"};
+    char *p=sql+7; while(isspace((unsigned char)*p))p++;
+    int an=strswci(p,"ANALYZE")&&isspace((unsigned char)p[7]);
+    if(an){p+=7;while(isspace((unsigned char)*p))p++;}
+    int wr=strswci(p,"INSERT INTO")||strswci(p,"UPDATE")||strswci(p,"DELETE FROM");
+    if(!wr&&!strswci(p,"SELECT")){res_err(r,"EXPLAIN supports SELECT, INSERT, UPDATE and DELETE");return;}
+    Prof *pr=(Prof*)calloc(1,sizeof(Prof)); Res *in=(Res*)calloc(1,sizeof(Res));
+    if(!pr||!in){free(pr);free(in);res_err(r,"OOM");return;}
+    pr->plan=!an; in->prof=pr;
+    if(wr) prof_note(pr,ST_COMMIT,s&&s->open?"deferred to COMMIT":"autocommit: stamp the new versions, rewrite the file");
+    prof_note(pr,ST_PRINT,"text table as the REPL prints it");
+    double t0=pr->t0=mono_now(); pr->cur=ST_PARSE;
+    db_exec(db,s,p,in);
+    prof_enter(pr,ST_PRINT);
+    Buf b={0}; render_res(in,&b);
+    prof_enter(pr,ST_PRINT);
+    double tt=mono_now()-t0;
+    pr->in[ST_PRINT]=pr->out[ST_PRINT]=in->nrows; pr->bytes[ST_PRINT]=(int64_t)b.n;
+    for(size_t c=b.cap;c>=4096;c/=2) pr->allocs[ST_PRINT]++;   /* buf_reserve doubles from 4 KB */
+    free(b.p);
+    if(!in->ok){res_err(r,in->msg);res_free(in);free(pr);return;}
+    const char *cn[]={"stage","detail","time_ms","rows_in","rows_out","bytes","allocs"};
+    CType ct[]={T_TEXT,T_TEXT,T_FLOAT,T_INT,T_INT,T_INT,T_INT};
+    r->ok=1; r->ncols=an?7:2;
+    for(int j=0;j<r->ncols;j++){strcpy(r->cname[j],cn[j]);r->ctype[j]=ct[j];}
+    char rv[MAX_COLUMNS][MAX_STR_LEN]; Val v;
+    for(int st=0;st<ST_N;st++){
+        if(!pr->note[st][0]&&!(an&&pr->t[st]>0)) continue;
+        snprintf(v.s,sizeof(v.s),"%s",stn[st]); res_cell(r,rv,0,&v,T_TEXT);
+        snprintf(v.s,sizeof(v.s),"%s",pr->note[st]); res_cell(r,rv,1,&v,T_TEXT);
+        if(an){
+            v.f=pr->t[st]*1e3; res_cell(r,rv,2,&v,T_FLOAT);
+            v.i=pr->in[st]; res_cell(r,rv,3,&v,T_INT);     v.i=pr->out[st]; res_cell(r,rv,4,&v,T_INT);
+            v.i=pr->bytes[st]; res_cell(r,rv,5,&v,T_INT);  v.i=pr->allocs[st]; res_cell(r,rv,6,&v,T_INT);
+        }
+        res_addrow(r,rv,r->ncols);
+    }
+    if(an) snprintf(r->msg,sizeof(r->msg),"%.900s in %.3f ms",in->msg,tt*1e3);
+    else snprintf(r->msg,sizeof(r->msg),"%d stage(s)",r->nrows);
+    r->affected=r->nrows;
+    res_free(in); free(pr);
+}
+
+/* potatorf_bench.c includes this file for the engine alone: it brings its
+   own main and has no use for the server. */
+#ifndef POTATORF_NO_MAIN
+/* ── Restore ────────────────────────────────────────────────── */
+/* Checksum of a whole file, as BACKUP computes it while writing one. */
+static int file_crc(const char *path,uint32_t *crc){
+    FILE *f=fopen(path,"rb"); if(!f) return -1;
+    static uint8_t b[1<<16]; size_t k; uint32_t c=0;
+    while((k=fread(b,1,sizeof(b),f))>0) c=crc32c(c,b,k);
+    int rc=ferror(f)?-1:0; fclose(f); *crc=c; return rc;
+}
+/* Blocks are moved between files as they are, still compressed; loading
+   the result checks them. */
+static int blk_skip(FILE *f){
+    BlkHdr h;
+    return fread(&h,sizeof(h),1,f)!=1||h.clen>h.raw||fseeko(f,h.clen,SEEK_CUR)?-1:0;
+}
+static int blk_copy(FILE *f,Fw *w,Buf *tmp){
+    BlkHdr h;
+    if(fread(&h,sizeof(h),1,f)!=1||h.clen>h.raw) return -1;
+    tmp->n=0; if(buf_reserve(tmp,h.clen)) return -1;
+    if(h.clen&&fread(tmp->p,1,h.clen,f)!=h.clen) return -1;
+    fw_put(w,&h,sizeof(h)); fw_put(w,tmp->p,h.clen);
+    return w->err?-1:0;
+}
+/* Reads a table meta block into raw: the table's name and row blocks. */
+static int rst_meta(FILE *f,Buf *raw,Buf *tmp,char *name,int *nb){
+    if(blk_read(f,raw,tmp)) return -1;
+    Rd rd={raw->p,raw->n,0,0}; int nc=0,n=0; uint8_t cols[sizeof(Col)*MAX_COLUMNS];
+    rd_get(&rd,name,MAX_NAME_LEN); rd_get(&rd,&nc,sizeof(int));
+    if(rd.err||nc<0||nc>MAX_COLUMNS) return -1;
+    rd_get(&rd,cols,sizeof(Col)*(size_t)nc); rd_get(&rd,&n,sizeof(int));
+    if(rd.err||n<0) return -1;
+    name[MAX_NAME_LEN-1]=0; *nb=(n+ZONE_ROWS-1)/ZONE_ROWS;
+    return 0;
+}
+/* Where a table's row blocks start in the image being updated. */
+typedef struct { char name[MAX_NAME_LEN]; int nb; int64_t at; } RstTbl;
+/* Writes to w the image p updated by the delta d: every table of the
+   delta with its meta, dictionary and changed row blocks from d and its
+   other row blocks from p's table of the same name. */
+static int rst_merge(FILE *p,FILE *d,Fw *w,Buf *raw,Buf *tmp){
+    DBHdr ph; DltHdr dh; RstTbl pt[MAX_TABLES]; uint32_t crc,end=0; char name[MAX_NAME_LEN]; int nb;
+    if(fread(&ph,sizeof(ph),1,p)!=1||fread(&crc,sizeof(crc),1,p)!=1||ph.magic!=DB_MAGIC||
+       ph.version!=DB_VERSION||crc!=crc32c(0,&ph,sizeof(ph))||ph.ntables<0||ph.ntables>MAX_TABLES) return -1;
+    for(int i=0;i<ph.ntables;i++){
+        if(rst_meta(p,raw,tmp,pt[i].name,&pt[i].nb)||(pt[i].at=ftello(p))<0) return -1;
+        for(int b=0;b<=pt[i].nb;b++) if(blk_skip(p)) return -1;   /* and the dictionary block */
+    }
+    if(fread(&dh,sizeof(dh),1,d)!=1||fread(&crc,sizeof(crc),1,d)!=1||dh.magic!=DLT_MAGIC||
+       dh.version!=DB_VERSION||crc!=crc32c(0,&dh,sizeof(dh))||dh.db.ntables<0||dh.db.ntables>MAX_TABLES) return -1;
+    crc=crc32c(0,&dh.db,sizeof(DBHdr));
+    fw_put(w,&dh.db,sizeof(DBHdr)); fw_put(w,&crc,sizeof(crc));
+    for(int i=0;i<dh.db.ntables;i++){
+        if(rst_meta(d,raw,tmp,name,&nb)||blk_write(w,raw,tmp)||blk_read(d,raw,tmp)||raw->n!=(size_t)nb) return -1;
+        const RstTbl *o=NULL;
+        for(int k=0;k<ph.ntables;k++) if(!strcasecmp(pt[k].name,name)) o=&pt[k];
+        if(o&&fseeko(p,o->at,SEEK_SET)) return -1;
+        for(int b=0;b<nb;b++){
+            int old=o&&b<o->nb;
+            if(!raw->p[b]&&!old) return -1;   /* not a delta of this image */
+            if(old&&(raw->p[b]?blk_skip(p):blk_copy(p,w,tmp))) return -1;
+            if(raw->p[b]&&blk_copy(d,w,tmp)) return -1;
+        }
+        if(blk_copy(d,w,tmp)) return -1;
+    }
+    if(fread(&end,sizeof(end),1,d)!=1||end!=DB_END_MAGIC) return -1;
+    fw_put(w,&end,sizeof(end));
+    return w->err?-1:0;
+}
+static int rst_apply(Io *io,const char *prev,const char *dlt,const char *out){
+    FILE *p=fopen(prev,"rb"),*d=fopen(dlt,"rb");
+    Buf raw={0},tmp={0}; Fw w; int rc=-1;
+    if(p&&d&&!fw_open(io,&w,out)){
+        rc=rst_merge(p,d,&w,&raw,&tmp);
+        if(rc) w.err=1;
+        if(fw_close(&w)) rc=-1;
+    }
+    if(rc) remove(out);
+    if(p) fclose(p);
+    if(d) fclose(d);
+    free(raw.p); free(tmp.p);
+    return rc;
+}
+/* <out> --restore full delta...: rebuilds a database from a full BACKUP
+   and the INCREMENTAL ones taken after it, in order. Each delta names the
+   checksum of the file it follows, so a missing or misplaced one is
+   refused before anything is written. The deltas are applied in turn
+   through out.tmp0/1, and the result is loaded once to check it before it
+   is renamed to out. */
+static int restore(const char *out,char **fl,int n){
+    char tn[2][520]; uint32_t crc; DltHdr dh;
+    if(n<2){ fprintf(stderr,"Fatal: --restore needs a full backup and at least one delta\n"); return 1; }
+    FILE *f=fopen(out,"rb");
+    if(f){ fclose(f); fprintf(stderr,"Fatal: '%s' exists; restore into a new file\n",out); return 1; }
+    if(file_crc(fl[0],&crc)){ fprintf(stderr,"Fatal: cannot read '%s'\n",fl[0]); return 1; }
+    for(int i=1;i<n;i++){
+        int ok=(f=fopen(fl[i],"rb"))&&fread(&dh,sizeof(dh),1,f)==1&&dh.magic==DLT_MAGIC;
+        if(f) fclose(f);
+        if(!ok){ fprintf(stderr,"Fatal: '%s' is not an incremental backup\n",fl[i]); return 1; }
+        if(dh.base!=crc){ fprintf(stderr,"Fatal: '%s' does not follow '%s'\n",fl[i],fl[i-1]); return 1; }
+        if(file_crc(fl[i],&crc)){ fprintf(stderr,"Fatal: cannot read '%s'\n",fl[i]); return 1; }
+    }
+    Io io; memset(&io,0,sizeof(io));
+    const char *src=fl[0]; int rc=0;
+    for(int i=1;i<n&&!rc;i++){
+        snprintf(tn[i&1],sizeof(tn[0]),"%s.tmp%d",out,i&1);
+        if((rc=rst_apply(&io,src,fl[i],tn[i&1]))) fprintf(stderr,"Fatal: cannot apply '%s' to '%s'\n",fl[i],src);
+        if(i>1) remove(src);
+        src=tn[i&1];
+    }
+    io_free(&io);
+    if(rc) return 1;
+    DB *db=open_db(src);
+    if(!db){ fprintf(stderr,"Fatal: the restored database does not load\n"); remove(src); return 1; }
+    int nt=db->hdr.ntables; close_db(db);
+    if(replace_file(src,out)){ fprintf(stderr,"Fatal: cannot rename '%s' to '%s'\n",src,out); remove(src); return 1; }
+    fsync_dir(out);
+    printf("Restored %d table(s) to '%s' from %d backup(s)\n",nt,out,n);
+    return 0;
+}
+
+/* ── Follow ─────────────────────────────────────────────────── */
+#ifdef HAVE_THREADS
+/* Applies the primary's image if it changed: 0 applied or nothing new,
+   1 deferred (a snapshot is open), -1 it did not load. */
+static int flw_poll(DB *db){
+    struct stat st;
+    mtx_lock(&db->ckl); struct stat cur=db->fid,bad=db->fbad; mtx_unlock(&db->ckl);
+    if(stat(db->follow,&st)||st_same(&st,&cur)||st_same(&st,&bad)) return 0;
+    DB *n=(DB*)calloc(1,sizeof(DB)); if(!n) return -1;
+    snprintf(n->file,sizeof(n->file),"%s",db->follow);
+    int rc=load_db(n);
+    if(rc){ rc=-1; free_tables(n,MAX_TABLES); }
+    else {
+        rw_wrlock(&db->ddl);
+        if(ald(&db->ntx)) rc=1;
+        else {
+            DBHdr h=db->hdr; db->hdr=n->hdr; n->hdr=h;
+            for(int i=0;i<MAX_TABLES;i++){ Table t=db->tbl[i]; db->tbl[i]=n->tbl[i]; n->tbl[i]=t; }
+            /* a new clock dates the image for INCREMENTAL backups */
+            ast(&db->clock,db->clock+1);
+            for(int i=0;i<db->hdr.ntables;i++) db->tbl[i].relsn=db->clock;
+            pc_clear(db);
+        }
+        rw_unlock(&db->ddl);
+        free_tables(n,n->hdr.ntables);
+    }
+    free(n);
+    mtx_lock(&db->ckl);
+    if(!rc){ db->fid=st; db->fn++; db->flag=st_age(&st); }
+    else if(rc<0) db->fbad=st;
+    mtx_unlock(&db->ckl);
+    return rc;
+}
+static void *flw_main(void *arg){
+    DB *db=(DB*)arg;
+    while(!ald(&db->fstop)){ flw_poll(db); sleep_sec(FOLLOW_MS/1000.0); }
+    return NULL;
+}
+#endif
+/* Makes db a follower of primary: applies its current image, if there is
+   one yet, and starts watching it. */
+static int flw_start(DB *db,const char *primary){
+#ifdef HAVE_THREADS
+    struct stat a,b;
+    if(!stat(primary,&a)&&!stat(db->file,&b)&&a.st_dev==b.st_dev&&a.st_ino==b.st_ino){
+        fprintf(stderr,"Fatal: a database cannot follow itself\n"); return -1;
+    }
+    snprintf(db->follow,sizeof(db->follow),"%s",primary);
+    if(flw_poll(db)<0) fprintf(stderr,"Warning: cannot load '%s'; waiting for a new image\n",primary);
+    else if(!db->fn) fprintf(stderr,"Warning: '%s' does not exist yet; waiting for it\n",primary);
+    if(!(db->frun=pthread_create(&db->fth,NULL,flw_main,db)==0)){ fprintf(stderr,"Fatal: cannot start the follower\n"); return -1; }
+    return 0;
+#else
+    (void)db; (void)primary;
+    fprintf(stderr,"Fatal: follower mode is not available on this platform\n"); return -1;
+#endif
+}
+
+/* ── Server ─────────────────────────────────────────────────── */
+#ifdef HAVE_SERVER
+/* One epoll loop owns every socket and a fixed pool of workers runs the
+   statements, so a long scan never stalls other clients. A connection
+   speaks text (one statement per line, replies as the REPL prints them)
+   unless it opens with the binary hello below. Either way clients may
+   pipeline: each connection runs its statements one at a time in arrival
+   order, and stops taking new ones while SRV_OUT_HIGH bytes of replies
+   are still unsent, so a client that stops reading stops being served. */
+#define SRV_MAX_LISTEN 8
+#define SRV_EVENTS     64
+#define SRV_OUT_HIGH   (256u<<10)
+#define SRV_MIN_WORKERS 8   /* a GROUP commit holds its worker until the checkpoint */
+
+/* Binary protocol. The client opens with WIRE_HELLO followed by a u32
+   version; the server echoes both. After that both sides send frames
+       u32 len | u8 type | payload[len-1]         (integers little-endian)
+   Client frames:
+       'Q'  u32 fetch | SQL text       run a statement; fetch = rows per
+                                       batch, 0 for a single batch
+       'X'                             close the connection
+   Every 'Q' is answered, in order, by either
+       'E'  u16 n | message
+   or by a row-less 'D', or by 'C' 'B'... 'D' for statements with columns:
+       'C'  u16 ncols | ncols x (u8 type | u8 n | name)
+            (type 1 INT, 2 FLOAT, 3 TEXT, 4 BOOL, 5 BLOB)
+       'B'  u32 nrows | per column: null bitmap ((nrows+7)/8 bytes, bit set
+            = NULL) then the non-NULL values: INT i64, FLOAT f64, BOOL u8,
+            TEXT and BLOB u16 n | bytes
+       'D'  i32 affected | u16 n | message */
+#define WIRE_HELLO     "\xffPRF"
+#define WIRE_VERSION   1u
+#define WIRE_MAX_FRAME (MAX_SQL_LEN+16)
+
+enum { C_CLIENT, C_LISTEN, C_WAKE };
+typedef struct Conn {
+    struct Conn *prev,*next;
+    int fd,kind,busy,dead,quit,armed,bin;   /* bin: 0 undecided, 1 text, 2 binary */
+    Buf in,out; size_t sent;
+    Sess sess;   /* touched only by the worker running the conn's job */
+} Conn;
+typedef struct Job {
+    struct Job *next; Conn *c; Buf out;
+    int bin; uint32_t fetch; char sql[MAX_SQL_LEN];
+} Job;
+typedef struct {
+    DB *db; int ep,nw; Conn wake,lst[SRV_MAX_LISTEN]; int nl;
+    Conn *conns;
+    pthread_mutex_t mu; pthread_cond_t cv;
+    Job *qh,*qt,*done; int stop;
+} Srv;
+
+static volatile sig_atomic_t srv_quit;
+static void srv_sig(int sig){ (void)sig; srv_quit=1; }
+
+/* "unix:/path" or "[host:]port"; a bare port binds to loopback only. */
+static int srv_listen(const char *a){
+    int fd=-1;
+    if(!strncmp(a,"unix:",5)){
+        struct sockaddr_un u; memset(&u,0,sizeof(u)); u.sun_family=AF_UNIX;
+        if(!a[5]||strlen(a+5)>=sizeof(u.sun_path)) return -1;
+        strcpy(u.sun_path,a+5); unlink(u.sun_path);
+        if((fd=socket(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0))<0) return -1;
+        if(bind(fd,(struct sockaddr*)&u,sizeof(u))||listen(fd,128)){close(fd);return -1;}
+        return fd;
+    }
+    char host[256]="127.0.0.1"; const char *port=a, *c=strrchr(a,':');
+    if(c){ size_t l=(size_t)(c-a); if(l>=sizeof(host)) return -1; memcpy(host,a,l); host[l]=0; port=c+1; }
+    struct addrinfo h,*ai,*p; memset(&h,0,sizeof(h));
+    h.ai_family=AF_UNSPEC; h.ai_socktype=SOCK_STREAM; h.ai_flags=AI_PASSIVE;
+    if(getaddrinfo(*host?host:NULL,port,&h,&ai)) return -1;
+    for(p=ai;p;p=p->ai_next){
+        if((fd=socket(p->ai_family,p->ai_socktype|SOCK_NONBLOCK|SOCK_CLOEXEC,p->ai_protocol))<0) continue;
+        int one=1; setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+        if(!bind(fd,p->ai_addr,p->ai_addrlen)&&!listen(fd,128)) break;
+        close(fd); fd=-1;
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+static size_t wire_begin(Buf *b,char type){
+    size_t at=b->n; uint32_t z=0; buf_put(b,&z,4); buf_put(b,&type,1); return at;
+}
+static void wire_end(Buf *b,size_t at){
+    if(b->err) return;
+    uint32_t l=(uint32_t)(b->n-at-4); memcpy(b->p+at,&l,4);
+}
+static void wire_str(Buf *b,const char *s,size_t max){
+    size_t l=strlen(s); if(l>max) l=max;
+    uint16_t n=(uint16_t)l; buf_put(b,&n,2); buf_put(b,s,l);
+}
+/* A BLOB cell holds \x and hex (see cell_hex); the wire carries its bytes. */
+static void wire_blob(Buf *b,const char *s){
+    size_t l=strlen(s); if(buf_reserve(b,l+2)) return;
+    size_t n=blob_lit(s,(char*)b->p+b->n+2); if(n>UINT16_MAX) n=UINT16_MAX;
+    uint16_t x=(uint16_t)n; memcpy(b->p+b->n,&x,2); b->n+=2+n;
+}
+static void wire_res(Res *r,uint32_t fetch,Buf *b){
+    size_t at;
+    if(!r->ok){ at=wire_begin(b,'E'); wire_str(b,r->msg,UINT16_MAX); wire_end(b,at); return; }
+    if(r->ncols){
+        at=wire_begin(b,'C');
+        uint16_t nc=(uint16_t)r->ncols; buf_put(b,&nc,2);
+        for(int j=0;j<r->ncols;j++){
+            uint8_t tp=(uint8_t)r->ctype[j], l=(uint8_t)strlen(r->cname[j]);
+            buf_put(b,&tp,1); buf_put(b,&l,1); buf_put(b,r->cname[j],l);
+        }
+        wire_end(b,at);
+        uint32_t step=fetch?fetch:(uint32_t)(r->nrows?r->nrows:1);
+        for(uint32_t lo=0;lo<(uint32_t)r->nrows;lo+=step){
+            uint32_t n=(uint32_t)r->nrows-lo; if(n>step) n=step;
+            at=wire_begin(b,'B'); buf_put(b,&n,4);
+            for(int j=0;j<r->ncols;j++){
+                size_t bm=b->n; if(buf_reserve(b,(n+7)/8)) return;
+                memset(b->p+bm,0,(n+7)/8); b->n+=(n+7)/8;
+                for(uint32_t i=0;i<n;i++){
+                    size_t c=(size_t)(lo+i)*r->ncols+j;
+                    const Val *v=r->vals?&r->vals[c]:NULL; Val tmp;
+                    int isnull=r->vnull?r->vnull[c]:0;
+                    if(!v){ str2val(res_get(r,(int)(lo+i),j),r->ctype[j],&tmp); v=&tmp; }
+                    if(isnull){ b->p[bm+i/8]|=(uint8_t)(1u<<(i%8)); continue; }
+                    switch(r->ctype[j]){
+                        case T_INT:   buf_put(b,&v->i,8); break;
+                        case T_FLOAT: buf_put(b,&v->f,8); break;
+                        case T_BOOL:  { uint8_t x=v->b?1:0; buf_put(b,&x,1); break; }
+                        case T_BLOB:  wire_blob(b,res_get(r,(int)(lo+i),j)); break;
+                        default:      wire_str(b,res_get(r,(int)(lo+i),j),UINT16_MAX); break;
+                    }
+                }
+            }
+            wire_end(b,at);
+        }
+    }
+    at=wire_begin(b,'D');
+    int32_t af=r->affected; buf_put(b,&af,4); wire_str(b,r->msg,UINT16_MAX);
+    wire_end(b,at);
+}
+
+static void *srv_worker(void *arg){
+    Srv *s=(Srv*)arg; Res *r=(Res*)calloc(1,sizeof(Res));
+    for(;;){
+        pthread_mutex_lock(&s->mu);
+        while(!s->qh&&!s->stop) pthread_cond_wait(&s->cv,&s->mu);
+        Job *j=s->qh;
+        if(!j){pthread_mutex_unlock(&s->mu);break;}
+        if(!(s->qh=j->next)) s->qt=NULL;
+        pthread_mutex_unlock(&s->mu);
+        if(r){
+            res_reset(r); r->typed=(int8_t)j->bin; db_exec(s->db,&j->c->sess,j->sql,r);
+            if(j->bin) wire_res(r,j->fetch,&j->out); else render_res(r,&j->out);
+        }
+        if(!r||j->out.err){
+            j->out.n=j->out.err=0;
+            if(!j->bin) buf_printf(&j->out,"ERROR: OOM\n");
+            else { size_t at=wire_begin(&j->out,'E'); wire_str(&j->out,"OOM",3); wire_end(&j->out,at); }
+        }
+        pthread_mutex_lock(&s->mu); j->next=s->done; s->done=j; pthread_mutex_unlock(&s->mu);
+        uint64_t one=1; if(write(s->wake.fd,&one,sizeof(one))<0){}
+    }
+    if(r){res_reset(r);free(r);}
+    return NULL;
+}
+
+static void srv_arm(Srv *s,Conn *c,int out){
+    if(c->armed==out) return;
+    struct epoll_event ev={0}; ev.events=EPOLLIN|(out?EPOLLOUT:0); ev.data.ptr=c;
+    epoll_ctl(s->ep,EPOLL_CTL_MOD,c->fd,&ev); c->armed=out;
+}
+/* Closes the socket now; the Conn itself lives until its job comes back. */
+static void srv_drop(Srv *s,Conn *c){
+    if(!c->dead){
+        epoll_ctl(s->ep,EPOLL_CTL_DEL,c->fd,NULL); close(c->fd); c->dead=1;
+        if(c->prev) c->prev->next=c->next; else s->conns=c->next;
+        if(c->next) c->next->prev=c->prev;
+    }
+    if(!c->busy){ sess_end(s->db,&c->sess); free(c->in.p); free(c->out.p); free(c); }
+}
+/* Returns -1 once c has been dropped. */
+static int srv_flush(Srv *s,Conn *c){
+    while(c->sent<c->out.n){
+        ssize_t k=send(c->fd,c->out.p+c->sent,c->out.n-c->sent,MSG_NOSIGNAL);
+        if(k<0&&errno==EINTR) continue;
+        if(k<0&&(errno==EAGAIN||errno==EWOULDBLOCK)){ srv_arm(s,c,1); return 0; }
+        if(k<=0){ srv_drop(s,c); return -1; }
+        c->sent+=(size_t)k;
+    }
+    c->out.n=c->sent=0; srv_arm(s,c,0);
+    if(c->quit){ srv_drop(s,c); return -1; }
+    return 0;
+}
+/* Cuts the next request off c->in into j: 1 when one was taken, 0 when
+   more input is needed, -1 when the stream is unusable (reply left in
+   c->out). */
+static int srv_take(Conn *c,Job *j){
+    uint8_t *p=c->in.p; size_t n=c->in.n,used,l;
+    if(!c->bin){
+        if(!n) return 0;
+        if(p[0]!=0xff) c->bin=1;
+        else {
+            uint32_t v=WIRE_VERSION,cv;
+            if(n<8) return 0;
+            if(memcmp(p,WIRE_HELLO,4)){ c->bin=1; buf_printf(&c->out,"ERROR: Bad hello\n"); return -1; }
+            memcpy(&cv,p+4,4); c->bin=2;
+            c->in.n-=8; memmove(p,p+8,c->in.n);
+            buf_put(&c->out,WIRE_HELLO,4); buf_put(&c->out,&v,4);
+            if(cv!=WIRE_VERSION){ size_t at=wire_begin(&c->out,'E'); wire_str(&c->out,"Unsupported version",64); wire_end(&c->out,at); return -1; }
+            return srv_take(c,j);
+        }
+    }
+    if(c->bin==1){
+        uint8_t *nl=(uint8_t*)memchr(p,'\n',n);
+        if(!nl){
+            if(n<MAX_SQL_LEN) return 0;
+            buf_printf(&c->out,"ERROR: Statement too long\n"); return -1;
+        }
+        l=(size_t)(nl-p); used=l+1;
+        if(l>=MAX_SQL_LEN){ buf_printf(&c->out,"ERROR: Statement too long\n"); return -1; }
+        memcpy(j->sql,p,l); j->sql[l]=0;
+    } else {
+        uint32_t fl;
+        if(n<4) return 0;
+        memcpy(&fl,p,4);
+        if(fl<1||fl>WIRE_MAX_FRAME){
+            size_t at=wire_begin(&c->out,'E'); wire_str(&c->out,"Bad frame",64); wire_end(&c->out,at); return -1;
+        }
+        if(n<4+(size_t)fl) return 0;
+        used=4+(size_t)fl;
+        if(p[4]=='X') strcpy(j->sql,"quit");
+        else if(p[4]!='Q'||fl<5){
+            size_t at=wire_begin(&c->out,'E'); wire_str(&c->out,"Bad frame",64); wire_end(&c->out,at); return -1;
+        } else {
+            memcpy(&j->fetch,p+5,4); l=fl-5;
+            if(l>=MAX_SQL_LEN){ size_t at=wire_begin(&c->out,'E'); wire_str(&c->out,"Statement too long",64); wire_end(&c->out,at); return -1; }
+            memcpy(j->sql,p+9,l); j->sql[l]=0;
+        }
+        j->bin=1;
+    }
+    c->in.n-=used; memmove(p,p+used,c->in.n);
+    strtrim(j->sql);
+    return 1;
+}
+/* Starts the next buffered statement of c when it is idle. Returns -1
+   once c has been dropped. */
+static int srv_next(Srv *s,Conn *c){
+    while(!c->busy&&!c->dead&&c->out.n<SRV_OUT_HIGH){
+        Job *j=(Job*)malloc(sizeof(Job));
+        if(!j){ buf_printf(&c->out,"ERROR: OOM\n"); c->quit=1; return srv_flush(s,c); }
+        memset(j,0,offsetof(Job,sql));   /* srv_take fills sql */
+        int k=srv_take(c,j);
+        if(k<=0){
+            free(j);
+            if(!k) return c->out.n?srv_flush(s,c):0;
+            c->quit=1; return srv_flush(s,c);
+        }
+        if(!*j->sql){ free(j); continue; }
+        if(!strcasecmp(j->sql,"quit")||!strcasecmp(j->sql,"exit")){ free(j); c->quit=1; return srv_flush(s,c); }
+        j->c=c; c->busy=1;
+        pthread_mutex_lock(&s->mu);
+        if(s->qt) s->qt->next=j; else s->qh=j;
+        s->qt=j;
+        pthread_cond_signal(&s->cv); pthread_mutex_unlock(&s->mu);
+    }
+    return c->dead?-1:0;
+}
+static void srv_accept(Srv *s,Conn *l){
+    for(;;){
+        int fd=accept4(l->fd,NULL,NULL,SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if(fd<0){ if(errno==EINTR) continue; return; }
+        Conn *c=(Conn*)calloc(1,sizeof(Conn));
+        struct epoll_event ev={0}; ev.events=EPOLLIN; ev.data.ptr=c;
+        if(!c||epoll_ctl(s->ep,EPOLL_CTL_ADD,fd,&ev)){ free(c); close(fd); continue; }
+        c->fd=fd; c->kind=C_CLIENT;
+        c->next=s->conns; if(s->conns) s->conns->prev=c; s->conns=c;
+    }
+}
+static void srv_read(Srv *s,Conn *c){
+    for(;;){
+        if(buf_reserve(&c->in,4096)){ srv_drop(s,c); return; }
+        ssize_t k=recv(c->fd,c->in.p+c->in.n,c->in.cap-c->in.n,0);
+        if(k<0&&errno==EINTR) continue;
+        if(k<0&&(errno==EAGAIN||errno==EWOULDBLOCK)) break;
+        if(k<=0){ srv_drop(s,c); return; }
+        c->in.n+=(size_t)k;
+        if(c->in.n>MAX_SQL_LEN*4&&!memchr(c->in.p,'\n',c->in.n)) break;
+    }
+    srv_next(s,c);
+}
+/* Hands finished replies back to their connections. */
+static void srv_done(Srv *s){
+    uint64_t v; if(read(s->wake.fd,&v,sizeof(v))<0){}
+    pthread_mutex_lock(&s->mu); Job *j=s->done; s->done=NULL; pthread_mutex_unlock(&s->mu);
+    while(j){
+        Job *n=j->next; Conn *c=j->c; c->busy=0;
+        if(c->dead) srv_drop(s,c);
+        else { buf_put(&c->out,j->out.p,j->out.n); if(!srv_flush(s,c)) srv_next(s,c); }
+        free(j->out.p); free(j); j=n;
+    }
+}
+
+/* Serves db on every address until SIGINT/SIGTERM. */
+static int serve(DB *db,char **addr,int na){
+    Srv *s=(Srv*)calloc(1,sizeof(Srv)); if(!s) return 1;
+    s->db=db; pthread_mutex_init(&s->mu,NULL); pthread_cond_init(&s->cv,NULL);
+    int rc=1; pthread_t th[MAX_WORKERS];
+    if((s->ep=epoll_create1(EPOLL_CLOEXEC))<0||(s->wake.fd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC))<0){ perror("epoll"); goto out; }
+    s->wake.kind=C_WAKE;
+    struct epoll_event ev={0}; ev.events=EPOLLIN; ev.data.ptr=&s->wake;
+    epoll_ctl(s->ep,EPOLL_CTL_ADD,s->wake.fd,&ev);
+    for(int i=0;i<na&&i<SRV_MAX_LISTEN;i++){
+        Conn *l=&s->lst[s->nl];
+        if((l->fd=srv_listen(addr[i]))<0){ fprintf(stderr,"Fatal: cannot listen on '%s'\n",addr[i]); goto out; }
+        l->kind=C_LISTEN; ev.data.ptr=l; epoll_ctl(s->ep,EPOLL_CTL_ADD,l->fd,&ev); s->nl++;
+        printf("listening on %s\n",addr[i]);
+    }
+    fflush(stdout);
+    long nc=sysconf(_SC_NPROCESSORS_ONLN);
+    int want=nc>SRV_MIN_WORKERS?(int)(nc<MAX_WORKERS?nc:MAX_WORKERS):SRV_MIN_WORKERS;
+    while(s->nw<want&&!pthread_create(&th[s->nw],NULL,srv_worker,s)) s->nw++;
+    if(!s->nw){ fprintf(stderr,"Fatal: no worker threads\n"); goto out; }
+    struct sigaction sa; memset(&sa,0,sizeof(sa)); sa.sa_handler=srv_sig;
+    sigaction(SIGINT,&sa,NULL); sigaction(SIGTERM,&sa,NULL);
+    struct epoll_event evs[SRV_EVENTS];
+    while(!srv_quit){
+        int n=epoll_wait(s->ep,evs,SRV_EVENTS,-1);
+        if(n<0){ if(errno==EINTR) continue; perror("epoll_wait"); break; }
+        for(int i=0;i<n;i++){
+            Conn *c=(Conn*)evs[i].data.ptr;
+            if(c->kind==C_WAKE){ srv_done(s); continue; }
+            if(c->kind==C_LISTEN){ srv_accept(s,c); continue; }
+            if(c->dead) continue;
+            if(evs[i].events&(EPOLLERR|EPOLLHUP)&&!(evs[i].events&EPOLLIN)){ srv_drop(s,c); continue; }
+            if(evs[i].events&EPOLLOUT&&(srv_flush(s,c)||srv_next(s,c))) continue;
+            if(evs[i].events&EPOLLIN) srv_read(s,c);
+        }
+    }
+    rc=0;
+out:
+    /* Let queued statements finish so none is half-applied at close_db. */
+    pthread_mutex_lock(&s->mu); s->stop=1; pthread_cond_broadcast(&s->cv); pthread_mutex_unlock(&s->mu);
+    for(int i=0;i<s->nw;i++) pthread_join(th[i],NULL);
+    for(Job *j=s->done,*n;j;j=n){
+        n=j->next; j->c->busy=0;
+        if(j->c->dead) srv_drop(s,j->c);
+        free(j->out.p); free(j);
+    }
+    while(s->conns) srv_drop(s,s->conns);
+    for(int i=0;i<s->nl;i++) close(s->lst[i].fd);
+    for(int i=0;i<na&&i<s->nl;i++) if(!strncmp(addr[i],"unix:",5)) unlink(addr[i]+5);
+    if(s->wake.fd>0) close(s->wake.fd);
+    if(s->ep>0) close(s->ep);
+    pthread_mutex_destroy(&s->mu); pthread_cond_destroy(&s->cv); free(s);
+    return rc;
+}
+#endif
+
+/* ── Main ───────────────────────────────────────────────────── */
+int main(int argc,char *argv[]){
+    if(argc<2){
+        fprintf(stderr,"Usage:\n  %s <db.dbm>         — REPL\n  %s <db.dbm> \"SQL\"  — single command\n"
+                       "  %s <db.dbm> --serve unix:/path | [host:]port ...  — server\n"
+                       "  %s <db.dbm> --restore full.dbm delta ...  — rebuild from backups\n"
+                       "  %s <replica.dbm> --follow primary.dbm [--serve ...]  — read-only follower\n",
+                argv[0],argv[0],argv[0],argv[0],argv[0]);
+        return 1;
+    }
+    char fn[512]; strncpy(fn,argv[1],sizeof(fn)-1);
+    if(!strstr(fn,".dbm")) strncat(fn,".dbm",sizeof(fn)-strlen(fn)-1);
+    if(argc>=3&&!strcmp(argv[2],"--restore")) return restore(fn,argv+3,argc-3);
+    DB *db=open_db(fn);
+    if(!db){fprintf(stderr,"Fatal: cannot open '%s'\n",fn);return 1;}
+    int a=2;   /* first argument after the database and --follow */
+    if(argc>=3&&!strcmp(argv[2],"--follow")){
+        if(argc<4||flw_start(db,argv[3])){ if(argc<4) fprintf(stderr,"Fatal: --follow needs the primary's file\n"); close_db(db); return 1; }
+        a=4;
+    }
+    printf("potatorf v1.0  db=%s  tables=%d\n",db->hdr.name,db->hdr.ntables);
+    if(argc>a&&!strcmp(argv[a],"--serve")){
+#ifdef HAVE_SERVER
+        int rc=argc>a+1?serve(db,argv+a+1,argc-a-1):(fprintf(stderr,"Fatal: --serve needs an address\n"),1);
+#else
+        int rc=1; fprintf(stderr,"Fatal: server mode is not available on this platform\n");
+#endif
+        close_db(db); printf("Goodbye.\n"); return rc;
+    }
+    Res *r=(Res*)calloc(1,sizeof(Res)); if(!r){close_db(db);return 1;}
+    if(argc>a){
+        char sql[MAX_SQL_LEN]={0};
+        for(int i=a;i<argc;i++){strncat(sql,argv[i],sizeof(sql)-strlen(sql)-1);if(i<argc-1)strncat(sql," ",sizeof(sql)-strlen(sql)-1);}
+        db_exec(db,NULL,sql,r); print_res(r); res_free(r);
+    } else {
+        printf("Type SQL (end with ;) or 'quit'.\n\n");
+        char line[MAX_SQL_LEN],buf[MAX_SQL_LEN]={0}; Sess ss; memset(&ss,0,sizeof(ss));
+        while(1){
+            printf(*buf==0?"db> ":"... "); fflush(stdout);
+            if(!fgets(line,sizeof(line),stdin)) break;
+            strtrim(line);
+            if(!strcasecmp(line,"quit")||!strcasecmp(line,"exit")) break;
+            if(!*line) continue;
+            strncat(buf,line,sizeof(buf)-strlen(buf)-1);
+            strncat(buf," ",sizeof(buf)-strlen(buf)-1);
+            if(strchr(line,';')||strswci(buf,"SHOW")||strswci(buf,"VACUUM")||strswci(buf,"DESC")||
+               strswci(buf,"BEGIN")||strswci(buf,"COMMIT")||strswci(buf,"ROLLBACK")||strswci(buf,"ANALYZE")||
+               strswci(buf,"BGSAVE")){
+                res_reset(r);
+                db_exec(db,&ss,buf,r); print_res(r); buf[0]=0;
+            }
+        }
+        sess_end(db,&ss); res_free(r);
+    }
+    close_db(db); printf("Goodbye.\n"); return 0;
+}
+#endif
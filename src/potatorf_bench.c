@@ -0,0 +1,207 @@
+/*
+ * potatorf_bench.c — Synthetic workload benchmark for potatorf
+ *
+ * Builds one table of configurable width and type mix, then times INSERT,
+ * point SELECT, range SELECT, UPDATE, DELETE, VACUUM and open/close through
+ * the same db_exec path the REPL and server use. Each phase prints one
+ * record: ops, wall seconds, ops/sec and p50/p99/p999 latency in µs.
+ *
+ * Build:  gcc -Wall -O2 -pthread -o potatorf-bench potatorf_bench.c
+ * Usage:  ./potatorf-bench [-r rows] [-w width] [-m mix] [-n ops] [-b batch]
+ *                          [-R span] [-z null%] [-s seed] [-o json|csv] [-k]
+ *                          [bench.dbm]
+ */
+
+#define POTATORF_NO_MAIN
+#include "potatorf.c"
+
+/* ── Options ────────────────────────────────────────────────── */
+typedef struct {
+    int  rows, width, ops, batch, span, nullpct, keep, csv;
+    unsigned long long seed;
+    const char *mix; char file[512];
+} BOpt;
+
+static void b_usage(const char *a){
+    fprintf(stderr,
+        "Usage: %s [options] [file.dbm]\n"
+        "  -r N     rows to insert                     (default 100000)\n"
+        "  -w N     payload columns besides the INT id, 1..31 (default 8)\n"
+        "  -m MIX   column types, cycled: i=INT f=FLOAT t=TEXT b=BOOL d=TEXT DICT\n"
+        "                                               (default ifbtd)\n"
+        "  -n N     statements per SELECT/UPDATE/DELETE phase (default 1000)\n"
+        "  -b N     statements per transaction; 1 = autocommit (default 1000)\n"
+        "  -R N     rows covered by each range SELECT   (default 100)\n"
+        "  -z PCT   percentage of payload values that are NULL (default 0)\n"
+        "  -s SEED  random seed                         (default 1)\n"
+        "  -o FMT   json (one object per line) or csv   (default json)\n"
+        "  -k       keep the database file afterwards\n",a);
+}
+
+/* ── Helpers ────────────────────────────────────────────────── */
+static unsigned long long b_st;
+static unsigned b_rand(void){   /* xorshift64*: cheap and reproducible */
+    b_st^=b_st>>12; b_st^=b_st<<25; b_st^=b_st>>27;
+    return (unsigned)((b_st*0x2545F4914F6CDD1Dull)>>32);
+}
+static int b_cmp(const void *a,const void *b){
+    double x=*(const double*)a,y=*(const double*)b; return (x>y)-(x<y);
+}
+/* Nearest-rank percentile of a sorted sample, in µs. */
+static double b_pct(const double *l,int n,double q){
+    if(n<=0) return 0;
+    int i=(int)(q*n+0.999999)-1; if(i<0)i=0; if(i>=n)i=n-1;
+    return l[i]*1e6;
+}
+static void b_report(const BOpt *o,const char *ph,double *l,int n,double secs){
+    qsort(l,(size_t)n,sizeof(double),b_cmp);
+    double p50=b_pct(l,n,.50),p99=b_pct(l,n,.99),p999=b_pct(l,n,.999),ops=secs>0?n/secs:0;
+    if(o->csv) printf("%s,%d,%.6f,%.1f,%.1f,%.1f,%.1f\n",ph,n,secs,ops,p50,p99,p999);
+    else printf("{\"phase\":\"%s\",\"ops\":%d,\"secs\":%.6f,\"ops_per_sec\":%.1f,"
+                "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f}\n",ph,n,secs,ops,p50,p99,p999);
+    fflush(stdout);
+}
+/* Runs one statement; any failure ends the run, since later phases would
+   time a different workload than the one asked for. */
+static void b_exec(DB *db,Sess *s,const char *sql,Res *r){
+    res_reset(r); db_exec(db,s,sql,r);
+    if(!r->ok){ fprintf(stderr,"bench: %.200s\n",sql); print_res(r); exit(1); }
+}
+static char b_type(const BOpt *o,int c){ return o->mix[c%strlen(o->mix)]; }
+static void b_value(const BOpt *o,int c,char *p,size_t n){
+    static const char al[]="abcdefghijklmnopqrstuvwxyz0123456789";
+    if(o->nullpct&&(int)(b_rand()%100)<o->nullpct){ snprintf(p,n,"NULL"); return; }
+    switch(b_type(o,c)){
+        case 'i': snprintf(p,n,"%d",(int)(b_rand()%2000001)-1000000); break;
+        case 'f': snprintf(p,n,"%.3f",(b_rand()%2000000)/1000.0-1000.0); break;
+        case 'b': snprintf(p,n,b_rand()&1?"true":"false"); break;
+        case 'd': snprintf(p,n,"'cat%u'",b_rand()%16); break;
+        default: {
+            int k=8+(int)(b_rand()%17); size_t m=0; p[m++]='\'';
+            for(int i=0;i<k&&m+2<n;i++) p[m++]=al[b_rand()%(sizeof(al)-1)];
+            p[m++]='\''; p[m]=0;
+        }
+    }
+}
+/* Opens a transaction every batch statements and commits after the last;
+   the COMMIT (and its save) counts toward the statement that closes it. */
+static void b_step(DB *db,Sess *s,const BOpt *o,int i,int n,const char *sql,Res *r){
+    if(o->batch>1&&i%o->batch==0) b_exec(db,s,"BEGIN",r);
+    b_exec(db,s,sql,r);
+    if(o->batch>1&&(i%o->batch==o->batch-1||i==n-1)) b_exec(db,s,"COMMIT",r);
+}
+
+/* ── Main ───────────────────────────────────────────────────── */
+int main(int argc,char *argv[]){
+    BOpt o={100000,8,1000,1000,100,0,0,0,1,"ifbtd",{0}};
+    const char *fn="bench.dbm";
+    for(int i=1;i<argc;i++){
+        const char *a=argv[i];
+        if(a[0]=='-'&&a[1]&&!a[2]&&strchr("rwmnbRzso",a[1])){
+            if(i+1>=argc){ b_usage(argv[0]); return 1; }
+            const char *v=argv[++i];
+            switch(a[1]){
+                case 'r': o.rows=atoi(v); break;      case 'w': o.width=atoi(v); break;
+                case 'm': o.mix=v; break;             case 'n': o.ops=atoi(v); break;
+                case 'b': o.batch=atoi(v); break;     case 'R': o.span=atoi(v); break;
+                case 'z': o.nullpct=atoi(v); break;   case 's': o.seed=strtoull(v,NULL,10); break;
+                case 'o': o.csv=!strcasecmp(v,"csv"); break;
+            }
+        } else if(!strcmp(a,"-k")) o.keep=1;
+        else if(a[0]!='-') fn=a;
+        else { b_usage(argv[0]); return 1; }
+    }
+    if(o.rows<1||o.ops<1||o.batch<1||o.span<1||o.width<1||o.width>MAX_COLUMNS-1||
+       !*o.mix||strspn(o.mix,"ifbtd")!=strlen(o.mix)||o.nullpct<0||o.nullpct>100){
+        b_usage(argv[0]); return 1;
+    }
+    strncpy(o.file,fn,sizeof(o.file)-1);
+    if(!strstr(o.file,".dbm")) strncat(o.file,".dbm",sizeof(o.file)-strlen(o.file)-1);
+    b_st=o.seed?o.seed:1;
+    remove(o.file);
+
+    DB *db=open_db(o.file);
+    if(!db){ fprintf(stderr,"bench: cannot open '%s'\n",o.file); return 1; }
+    Res *r=(Res*)calloc(1,sizeof(Res)); Sess s; memset(&s,0,sizeof(s));
+    int nl=o.rows>o.ops?o.rows:o.ops;
+    double *lat=(double*)malloc(sizeof(double)*(size_t)nl);
+    int *ids=(int*)malloc(sizeof(int)*(size_t)o.rows);
+    if(!r||!lat||!ids){ fprintf(stderr,"bench: out of memory\n"); return 1; }
+    char sql[MAX_SQL_LEN],v[MAX_STR_LEN];
+
+    if(o.csv) printf("phase,ops,secs,ops_per_sec,p50_us,p99_us,p999_us\n");
+    else printf("{\"config\":{\"rows\":%d,\"width\":%d,\"mix\":\"%s\",\"ops\":%d,\"batch\":%d,"
+                "\"span\":%d,\"null_pct\":%d,\"seed\":%llu}}\n",
+                o.rows,o.width,o.mix,o.ops,o.batch,o.span,o.nullpct,o.seed);
+
+    int n=snprintf(sql,sizeof(sql),"CREATE TABLE bench (id INT PRIMARY KEY");
+    for(int c=0;c<o.width;c++){
+        char t=b_type(&o,c);
+        n+=snprintf(sql+n,sizeof(sql)-n,", c%d %s",c,t=='i'?"INT":t=='f'?"FLOAT":t=='b'?"BOOL":t=='d'?"TEXT DICT":"TEXT");
+    }
+    snprintf(sql+n,sizeof(sql)-n,")");
+    b_exec(db,NULL,sql,r);
+
+    /* INSERT: ids 1..rows in order, so zone maps see clustered keys */
+    double t0=mono_now();
+    for(int i=0;i<o.rows;i++){
+        n=snprintf(sql,sizeof(sql),"INSERT INTO bench VALUES (%d",i+1);
+        for(int c=0;c<o.width;c++){ b_value(&o,c,v,sizeof(v)); n+=snprintf(sql+n,sizeof(sql)-n,", %s",v); }
+        snprintf(sql+n,sizeof(sql)-n,")");
+        double a=mono_now(); b_step(db,&s,&o,i,o.rows,sql,r); lat[i]=mono_now()-a;
+    }
+    b_report(&o,"insert",lat,o.rows,mono_now()-t0);
+
+    t0=mono_now();
+    for(int i=0;i<o.ops;i++){
+        snprintf(sql,sizeof(sql),"SELECT * FROM bench WHERE id = %d",1+(int)(b_rand()%o.rows));
+        double a=mono_now(); b_exec(db,NULL,sql,r); lat[i]=mono_now()-a;
+    }
+    b_report(&o,"point_select",lat,o.ops,mono_now()-t0);
+
+    t0=mono_now();
+    for(int i=0;i<o.ops;i++){
+        int lo=1+(int)(b_rand()%o.rows);
+        snprintf(sql,sizeof(sql),"SELECT * FROM bench WHERE id >= %d AND id < %d",lo,lo+o.span);
+        double a=mono_now(); b_exec(db,NULL,sql,r); lat[i]=mono_now()-a;
+    }
+    b_report(&o,"range_select",lat,o.ops,mono_now()-t0);
+
+    /* UPDATE the first payload column of a random row */
+    t0=mono_now();
+    for(int i=0;i<o.ops;i++){
+        int id=1+(int)(b_rand()%o.rows);
+        b_value(&o,0,v,sizeof(v)); snprintf(sql,sizeof(sql),"UPDATE bench SET c0 = %s WHERE id = %d",v,id);
+        double a=mono_now(); b_step(db,&s,&o,i,o.ops,sql,r); lat[i]=mono_now()-a;
+    }
+    b_report(&o,"update",lat,o.ops,mono_now()-t0);
+
+    /* DELETE distinct ids so every statement removes exactly one row */
+    for(int i=0;i<o.rows;i++) ids[i]=i+1;
+    int nd=o.ops<o.rows?o.ops:o.rows;
+    for(int i=0;i<nd;i++){ int j=i+(int)(b_rand()%(unsigned)(o.rows-i)),x=ids[i]; ids[i]=ids[j]; ids[j]=x; }
+    t0=mono_now();
+    for(int i=0;i<nd;i++){
+        snprintf(sql,sizeof(sql),"DELETE FROM bench WHERE id = %d",ids[i]);
+        double a=mono_now(); b_step(db,&s,&o,i,nd,sql,r); lat[i]=mono_now()-a;
+    }
+    b_report(&o,"delete",lat,nd,mono_now()-t0);
+
+    t0=mono_now(); b_exec(db,NULL,"VACUUM",r); lat[0]=mono_now()-t0;
+    b_report(&o,"vacuum",lat,1,lat[0]);
+
+    /* open/close: close saves the whole file, open loads and verifies it */
+    enum{K=5}; double lc[K],lo[K],tc=0,to=0;
+    for(int i=0;i<K;i++){
+        double a=mono_now(); close_db(db); lc[i]=mono_now()-a; tc+=lc[i];
+        a=mono_now(); db=open_db(o.file); lo[i]=mono_now()-a; to+=lo[i];
+        if(!db){ fprintf(stderr,"bench: cannot reopen '%s'\n",o.file); return 1; }
+    }
+    b_report(&o,"close",lc,K,tc);
+    b_report(&o,"open",lo,K,to);
+
+    sess_end(db,&s); res_free(r); close_db(db);
+    free(lat); free(ids);
+    if(!o.keep) remove(o.file);
+    return 0;
+}